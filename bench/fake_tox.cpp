@@ -0,0 +1,189 @@
+#include "./fake_tox.hpp"
+
+#include <algorithm>
+
+struct Tox {
+	FakeNet* net {nullptr};
+	size_t node {0};
+};
+
+struct FakeNet::Node {
+	Tox tox;
+	NGC_EXT_CTX ext;
+};
+
+FakeNet::FakeNet(size_t node_count, const LinkParams& params, uint32_t seed) : _params(params), _rng(seed) {
+	for (size_t i = 0; i < node_count; i++) {
+		auto& node = _nodes.emplace_back(std::make_unique<Node>());
+		node->tox.net = this;
+		node->tox.node = i;
+	}
+	_links.resize(node_count * node_count);
+}
+
+FakeNet::~FakeNet(void) {
+}
+
+Tox* FakeNet::tox(size_t node) {
+	return &_nodes.at(node)->tox;
+}
+
+NGC_EXT_CTX* FakeNet::ext(size_t node) {
+	return &_nodes.at(node)->ext;
+}
+
+size_t FakeNet::deliver(void) {
+	std::vector<Packet> due;
+	{
+		std::lock_guard lock{_mutex};
+		const auto now = clock::now();
+		while (!_queue.empty() && _queue.top().due <= now) {
+			due.push_back(std::move(const_cast<Packet&>(_queue.top())));
+			_queue.pop();
+		}
+	}
+
+	// outside the lock, the handlers send
+	for (const auto& pkt : due) {
+		// same as NGC_EXT_handle_group_custom_packet()
+		auto& node = *_nodes[pkt.to];
+		const uint8_t pkg_id = pkt.data.front();
+		if (node.ext.callbacks[pkg_id] == nullptr) {
+			continue;
+		}
+		node.ext.callbacks[pkg_id](&node.tox, &node.ext, 0, uint32_t(pkt.from), pkt.data.data()+1, pkt.data.size()-1, node.ext.user_data[pkg_id]);
+	}
+
+	return due.size();
+}
+
+float FakeNet::nextDue(void) {
+	std::lock_guard lock{_mutex};
+	if (_queue.empty()) {
+		return -1.f;
+	}
+	return std::max(0.f, std::chrono::duration<float>(_queue.top().due - clock::now()).count());
+}
+
+bool FakeNet::idle(void) {
+	std::lock_guard lock{_mutex};
+	return _queue.empty();
+}
+
+FakeNet::Stats FakeNet::stats(void) {
+	std::lock_guard lock{_mutex};
+	return _stats;
+}
+
+bool FakeNet::send(size_t from, uint32_t peer_number, bool lossless, const uint8_t* data, size_t length) {
+	if (!connected(from, peer_number) || length == 0) {
+		return false;
+	}
+
+	std::lock_guard lock{_mutex};
+
+	_stats.packets++;
+	_stats.bytes += length;
+	countData(data, length);
+
+	const auto now = clock::now();
+	auto& link = _links[from * _nodes.size() + peer_number];
+	std::uniform_real_distribution<float> dist{0.f, 1.f};
+
+	if (!lossless && _params.loss > 0.f && dist(_rng) < _params.loss) {
+		_stats.dropped++;
+		return true; // lost on the way, the sender does not know
+	}
+
+	// the bottleneck, packets wait until the link is free
+	auto departure = std::max(now, link.busy_until);
+	if (_params.bandwidth > 0.f) {
+		if (!lossless && departure - now > std::chrono::duration<float>(_params.queue)) {
+			_stats.dropped++;
+			return true; // tail drop
+		}
+		departure += std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(length / _params.bandwidth));
+		link.busy_until = departure;
+	}
+
+	float delay = _params.delay + _params.jitter * dist(_rng);
+	if (!lossless && _params.reorder > 0.f && dist(_rng) < _params.reorder) {
+		delay += _params.delay;
+	}
+	auto due = departure + std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(delay));
+
+	if (lossless) {
+		// reliable and in order, like tox lossless packets
+		due = std::max(due, link.last_lossless);
+		link.last_lossless = due;
+	}
+
+	_queue.push(Packet{due, _next_order++, from, peer_number, {data, data+length}});
+
+	return true;
+}
+
+bool FakeNet::connected(size_t from, uint32_t peer_number) const {
+	return peer_number < _nodes.size() && peer_number != from;
+}
+
+void FakeNet::countData(const uint8_t* data, size_t length) {
+	// - 1 byte packet id
+	if (data[0] == NGC_EXT::FT1_DATA && length > 1+1+2) {
+		// - 1 byte transfer_id
+		// - 2 bytes sequence_id
+		_stats.data_bytes += length - (1+1+2);
+	} else if (data[0] == NGC_EXT::FT1_DATA2 && length > 1+2+4) {
+		// - 2 bytes transfer_id
+		// - 4 bytes sequence_id
+		_stats.data_bytes += length - (1+2+4);
+	} else if (data[0] == NGC_EXT::FT1_FRAME) {
+		// - array of records
+		//   - 1 byte packet id
+		//   - 2 byte size
+		//   - size bytes
+		size_t curser = 1;
+		while (curser + 3 <= length) {
+			const uint8_t pkg_id = data[curser];
+			const size_t record_size = size_t(data[curser+1]) | size_t(data[curser+2]) << 8;
+			if (pkg_id == NGC_EXT::FT1_DATA2 && record_size > 2+4) {
+				_stats.data_bytes += record_size - (2+4);
+			}
+			curser += 3 + record_size;
+		}
+	}
+}
+
+extern "C" {
+
+bool tox_group_send_custom_private_packet(const Tox* tox, uint32_t group_number, uint32_t peer_id, bool lossless, const uint8_t* data, size_t length, Tox_Err_Group_Send_Custom_Private_Packet* error) {
+	if (length > (lossless ? TOX_GROUP_MAX_CUSTOM_LOSSLESS_PACKET_LENGTH : TOX_GROUP_MAX_CUSTOM_LOSSY_PACKET_LENGTH)) {
+		if (error != nullptr) {
+			*error = TOX_ERR_GROUP_SEND_CUSTOM_PRIVATE_PACKET_TOO_LONG;
+		}
+		return false;
+	}
+
+	if (error != nullptr) {
+		*error = TOX_ERR_GROUP_SEND_CUSTOM_PRIVATE_PACKET_OK;
+	}
+
+	return group_number == 0 && tox->net->send(tox->node, peer_id, lossless, data, length);
+}
+
+TOX_CONNECTION tox_group_peer_get_connection_status(const Tox* tox, uint32_t group_number, uint32_t peer_id, Tox_Err_Group_Peer_Query* error) {
+	if (group_number != 0 || !tox->net->connected(tox->node, peer_id)) {
+		if (error != nullptr) {
+			*error = TOX_ERR_GROUP_PEER_QUERY_PEER_NOT_FOUND;
+		}
+		return TOX_CONNECTION_NONE;
+	}
+
+	if (error != nullptr) {
+		*error = TOX_ERR_GROUP_PEER_QUERY_OK;
+	}
+	return tox->net->relayed() ? TOX_CONNECTION_TCP : TOX_CONNECTION_UDP;
+}
+
+} // extern "C"
+
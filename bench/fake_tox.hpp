@@ -0,0 +1,105 @@
+#pragma once
+
+#include <tox/tox.h>
+
+#include "ngc_ext.hpp"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// in process stand in for the tox group custom packet api and the ngc_ext dispatch
+// defines tox_group_send_custom_private_packet() and tox_group_peer_get_connection_status(),
+// so ngc_ft1 can be linked without toxcore
+//
+// every node is in group 0, the peer_number of a node is its index
+// packets are delivered in real time (steady_clock), like the ledbat timestamps
+struct FakeNet {
+	public:
+		// same for every directed link
+		struct LinkParams {
+			float delay {0.02f}; // seconds one way
+			float jitter {0.f}; // seconds, uniform on top of the delay
+			float loss {0.f}; // 0-1, lossy packets only
+			float reorder {0.f}; // 0-1, lossy packets held back for another delay
+			float bandwidth {0.f}; // bytes per second, 0 is unlimited
+			float queue {0.2f}; // seconds of bandwidth queued, lossy packets are dropped beyond it
+			bool relayed {false}; // peers report a tcp connection
+		};
+
+		struct Stats {
+			size_t packets {0};
+			size_t bytes {0};
+			size_t dropped {0}; // loss + queue overflow
+
+			// payload of FT1_DATA and FT1_DATA2 packets (also in frames), resends included
+			size_t data_bytes {0};
+		};
+
+	public:
+		FakeNet(size_t node_count, const LinkParams& params, uint32_t seed = 42);
+		~FakeNet(void);
+		FakeNet(const FakeNet&) = delete;
+		FakeNet& operator=(const FakeNet&) = delete;
+
+		size_t size(void) const { return _nodes.size(); }
+		Tox* tox(size_t node);
+		NGC_EXT_CTX* ext(size_t node);
+
+		// hands every due packet to the ngc_ext callbacks of its node, returns the count
+		size_t deliver(void);
+
+		// seconds until the next packet is due, negative if none is queued
+		float nextDue(void);
+
+		bool idle(void);
+
+		Stats stats(void);
+
+		// called by the fake tox functions
+		bool send(size_t from, uint32_t peer_number, bool lossless, const uint8_t* data, size_t length);
+		bool connected(size_t from, uint32_t peer_number) const;
+		bool relayed(void) const { return _params.relayed; }
+
+	private:
+		using clock = std::chrono::steady_clock;
+
+		struct Packet {
+			clock::time_point due;
+			uint64_t order {0}; // ties in order of sending
+			size_t from {0};
+			size_t to {0};
+			std::vector<uint8_t> data;
+
+			bool operator>(const Packet& other) const {
+				return due > other.due || (due == other.due && order > other.order);
+			}
+		};
+
+		struct Link {
+			clock::time_point busy_until {}; // bandwidth
+			clock::time_point last_lossless {}; // lossless packets stay in order
+		};
+
+		struct Node;
+
+		void countData(const uint8_t* data, size_t length);
+
+	private:
+		const LinkParams _params;
+		std::mt19937 _rng;
+
+		std::vector<std::unique_ptr<Node>> _nodes;
+		std::vector<Link> _links; // from * size() + to
+
+		std::mutex _mutex;
+		std::priority_queue<Packet, std::vector<Packet>, std::greater<Packet>> _queue;
+		uint64_t _next_order {0};
+		Stats _stats;
+};
+
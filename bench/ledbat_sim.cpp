@@ -0,0 +1,385 @@
+// discrete event simulation of a LEDBAT sender behind a bottleneck, on a virtual clock
+// (see README.md for how to build it)
+//
+// the sender works like a ngc_ft1 send transfer: every tick it resends the timed out segments
+// (onLoss without discard) and sends what canSend() allows, the receiver acks everything
+// it got since its last tick in one packet (like v2 frames)
+//
+// usage: ledbat_sim [--scenario name|all] [--duration s] [--seeds n] [--tick s]
+//                   [--target s] [--target-max s] [--filter n] [--gain f] [--decrease c]
+//                   [--sweep] [--curve file.csv]
+//
+// --sweep runs a grid of the LEDBAT parameters over the scenarios
+// --curve writes cwnd, queueing delay and throughput over time of the (first) run as csv
+
+#include "../ledbat.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <queue>
+#include <random>
+#include <string>
+#include <variant>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+struct Scenario {
+	std::string name;
+	double bandwidth; // bytes per second
+	double delay; // seconds one way, both directions
+	double jitter; // seconds, uniform on top of the forward delay
+	double buffer; // seconds of bandwidth the bottleneck queues
+	double cross; // fraction of the bandwidth used by cross traffic in the middle third
+};
+
+static const std::vector<Scenario> _SCENARIOS {
+	{"dsl", 128*1024, 0.025, 0.0, 0.2, 0.0},
+	{"fast", 4*1024*1024, 0.010, 0.0, 0.1, 0.0},
+	{"cross", 1024*1024, 0.020, 0.0, 0.2, 0.5},
+	{"relayed", 512*1024, 0.080, 0.020, 0.5, 0.0},
+	{"tcp_relay", 256*1024, 0.150, 0.100, 1.0, 0.0},
+	{"bufferbloat", 256*1024, 0.020, 0.0, 2.0, 0.0},
+};
+
+struct Params {
+	float target_delay {LEDBAT{496}.target_delay};
+	float target_delay_max {LEDBAT{496}.target_delay_max};
+	size_t current_delay_filter_window {LEDBAT{496}.current_delay_filter_window};
+	float gain_factor {LEDBAT{496}.gain_factor};
+	float decrease_constant {LEDBAT{496}.decrease_constant};
+};
+
+struct Result {
+	double utilization {0.0}; // of the whole link
+	double share {0.0}; // of the link, by the ledbat flow
+	double queue_mean {0.0}; // seconds, seen by the ledbat packets
+	double queue_p95 {0.0};
+	double loss {0.0}; // dropped at the bottleneck / sent
+	double resend {0.0}; // resends / sent
+};
+
+struct Sim {
+	using clock = LEDBAT::clock;
+
+	struct SenderTick {};
+	struct ReceiverTick {};
+	struct DataArrive { uint32_t seq; };
+	struct AckArrive { std::vector<LEDBAT::SeqIDType> seqs; };
+	struct CrossSend {};
+
+	using EventData = std::variant<SenderTick, ReceiverTick, DataArrive, AckArrive, CrossSend>;
+
+	struct Event {
+		double time;
+		uint64_t order; // ties in order of scheduling
+		EventData data;
+
+		bool operator>(const Event& other) const {
+			return time > other.time || (time == other.time && order > other.order);
+		}
+	};
+
+	const Scenario scenario;
+	const double duration;
+	const double tick;
+
+	double now {0.0};
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+	uint64_t next_order {0};
+	std::mt19937 rng;
+
+	LEDBAT cca;
+
+	// bottleneck
+	double busy_until {0.0};
+	size_t link_bytes {0};
+	size_t flow_bytes {0};
+	std::vector<double> queue_delays;
+
+	// sender
+	uint32_t next_seq {0};
+	size_t sent {0};
+	size_t resent {0};
+	size_t dropped {0};
+
+	// receiver
+	std::vector<bool> received;
+	std::vector<LEDBAT::SeqIDType> pending_acks;
+
+	// curve
+	std::ofstream* curve {nullptr};
+	double next_sample {0.0};
+	size_t sample_flow_bytes {0};
+
+	Sim(const Scenario& scenario_, const Params& params, double duration_, double tick_, uint32_t seed) :
+		scenario(scenario_), duration(duration_), tick(tick_), rng(seed),
+		cca(496, [this]() { return clock::time_point{std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(now))}; })
+	{
+		cca.target_delay = params.target_delay;
+		cca.target_delay_max = params.target_delay_max;
+		cca.current_delay_filter_window = params.current_delay_filter_window;
+		cca.gain_factor = params.gain_factor;
+		cca.decrease_constant = params.decrease_constant;
+	}
+
+	void schedule(double time, EventData&& data) {
+		events.push(Event{time, next_order++, std::move(data)});
+	}
+
+	// returns false if the bottleneck queue is full
+	bool enqueue(size_t size, bool flow, uint32_t seq) {
+		const double departure_start = std::max(now, busy_until);
+		if (departure_start - now > scenario.buffer) {
+			return false; // tail drop
+		}
+		busy_until = departure_start + size / scenario.bandwidth;
+		link_bytes += size;
+
+		if (flow) {
+			queue_delays.push_back(departure_start - now);
+			const double jitter = std::uniform_real_distribution<double>{0.0, scenario.jitter}(rng);
+			schedule(busy_until + scenario.delay + jitter, DataArrive{seq});
+		}
+		return true;
+	}
+
+	void sendSegment(uint32_t seq) {
+		sent++;
+		if (!enqueue(cca.MAXIMUM_SEGMENT_SIZE, true, seq)) {
+			dropped++;
+		}
+	}
+
+	void onSenderTick(void) {
+		for (const auto& id : cca.getTimeouts()) {
+			resent++;
+			sendSegment(id.second);
+			cca.onLoss(id, false);
+		}
+
+		const size_t segments = cca.canSend() / cca.MAXIMUM_SEGMENT_DATA_SIZE;
+		for (size_t i = 0; i < segments; i++) {
+			const uint32_t seq = next_seq++;
+			cca.onSent({0, seq}, cca.MAXIMUM_SEGMENT_DATA_SIZE);
+			sendSegment(seq);
+		}
+
+		schedule(now + tick, SenderTick{});
+	}
+
+	void onReceiverTick(void) {
+		if (!pending_acks.empty()) {
+			// acks are small and the reverse path is not congested
+			schedule(now + scenario.delay, AckArrive{std::move(pending_acks)});
+			pending_acks.clear();
+		}
+		schedule(now + tick, ReceiverTick{});
+	}
+
+	void onDataArrive(uint32_t seq) {
+		if (received.size() <= seq) {
+			received.resize(seq + 1);
+		}
+		if (!received[seq]) {
+			received[seq] = true;
+			flow_bytes += cca.MAXIMUM_SEGMENT_SIZE;
+		}
+		pending_acks.push_back({0, seq});
+	}
+
+	void onCrossSend(void) {
+		const size_t size {1200};
+		enqueue(size, false, 0);
+		schedule(now + size / (scenario.bandwidth * scenario.cross), CrossSend{});
+	}
+
+	void sample(void) {
+		while (curve != nullptr && now >= next_sample) {
+			const double interval {0.1};
+			*curve << scenario.name << "," << next_sample << "," << cca.getCWnD() << ","
+				<< std::max(0.0, busy_until - now) << ","
+				<< (flow_bytes - sample_flow_bytes) / interval << "\n";
+			sample_flow_bytes = flow_bytes;
+			next_sample += interval;
+		}
+	}
+
+	Result run(void) {
+		schedule(0.0, SenderTick{});
+		schedule(tick / 2, ReceiverTick{});
+		if (scenario.cross > 0.0) {
+			schedule(duration / 3, CrossSend{});
+		}
+
+		while (!events.empty() && events.top().time < duration) {
+			Event event = events.top();
+			events.pop();
+			now = event.time;
+
+			if (std::holds_alternative<SenderTick>(event.data)) {
+				onSenderTick();
+			} else if (std::holds_alternative<ReceiverTick>(event.data)) {
+				onReceiverTick();
+			} else if (auto* data = std::get_if<DataArrive>(&event.data)) {
+				onDataArrive(data->seq);
+			} else if (auto* ack = std::get_if<AckArrive>(&event.data)) {
+				cca.onAck(std::move(ack->seqs));
+			} else if (std::holds_alternative<CrossSend>(event.data)) {
+				if (now < duration * 2 / 3) {
+					onCrossSend();
+				}
+			}
+
+			sample();
+		}
+
+		Result result;
+		const double capacity = scenario.bandwidth * duration;
+		result.utilization = std::min(link_bytes, size_t(capacity)) / capacity;
+		result.share = flow_bytes / capacity;
+		if (!queue_delays.empty()) {
+			double sum {0.0};
+			for (const double it : queue_delays) {
+				sum += it;
+			}
+			result.queue_mean = sum / queue_delays.size();
+			auto p95 = queue_delays.begin() + queue_delays.size() * 95 / 100;
+			std::nth_element(queue_delays.begin(), p95, queue_delays.end());
+			result.queue_p95 = *p95;
+		}
+		if (sent > 0) {
+			result.loss = double(dropped) / sent;
+			result.resend = double(resent) / sent;
+		}
+		return result;
+	}
+};
+
+static void print_result(const Scenario& scenario, const Params& params, const Result& result) {
+	printf("%-12s %7.3f %7.3f %6zu %6.2f %8.2f %7.3f %7.3f %10.1f %9.1f %7.4f %7.4f\n",
+		scenario.name.c_str(),
+		params.target_delay, params.target_delay_max, params.current_delay_filter_window, params.gain_factor, params.decrease_constant,
+		result.utilization, result.share,
+		result.queue_mean * 1000.0, result.queue_p95 * 1000.0,
+		result.loss, result.resend
+	);
+	fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+	std::string scenario_name {"all"};
+	double duration {60.0};
+	double tick {0.005};
+	size_t seeds {1};
+	bool sweep {false};
+	std::string curve_path;
+	Params params;
+
+	for (int i = 1; i < argc; i++) {
+		const std::string arg {argv[i]};
+		if (arg == "--sweep") {
+			sweep = true;
+			continue;
+		}
+
+		if (i+1 >= argc) {
+			fprintf(stderr, "missing value for %s\n", arg.c_str());
+			return 1;
+		}
+		const char* value = argv[++i];
+
+		if (arg == "--scenario") {
+			scenario_name = value;
+		} else if (arg == "--duration") {
+			duration = std::atof(value);
+		} else if (arg == "--tick") {
+			tick = std::atof(value);
+		} else if (arg == "--seeds") {
+			seeds = std::max<size_t>(1, std::strtoull(value, nullptr, 10));
+		} else if (arg == "--target") {
+			params.target_delay = std::atof(value);
+		} else if (arg == "--target-max") {
+			params.target_delay_max = std::atof(value);
+		} else if (arg == "--filter") {
+			params.current_delay_filter_window = std::strtoull(value, nullptr, 10);
+		} else if (arg == "--gain") {
+			params.gain_factor = std::atof(value);
+		} else if (arg == "--decrease") {
+			params.decrease_constant = std::atof(value);
+		} else if (arg == "--curve") {
+			curve_path = value;
+		} else {
+			fprintf(stderr, "unknown argument %s\n", arg.c_str());
+			return 1;
+		}
+	}
+
+	std::vector<Scenario> scenarios;
+	for (const auto& scenario : _SCENARIOS) {
+		if (scenario_name == "all" || scenario_name == scenario.name) {
+			scenarios.push_back(scenario);
+		}
+	}
+	if (scenarios.empty()) {
+		fprintf(stderr, "unknown scenario %s\n", scenario_name.c_str());
+		return 1;
+	}
+
+	std::vector<Params> grid;
+	if (sweep) {
+		for (const float target_delay : {0.015f, 0.030f, 0.060f, 0.100f}) {
+			for (const size_t filter : {size_t(16), size_t(64)}) {
+				for (const float gain : {0.1f, 0.2f, 0.4f}) {
+					for (const float decrease : {1.f, 2.f}) {
+						grid.push_back({target_delay, params.target_delay_max, filter, gain, decrease});
+					}
+				}
+			}
+		}
+	} else {
+		grid.push_back(params);
+	}
+
+	std::ofstream curve;
+	if (!curve_path.empty()) {
+		curve.open(curve_path);
+		curve << "scenario,time,cwnd,queue_delay,throughput\n";
+	}
+
+	printf("# duration %.1fs tick %.3fs seeds %zu, results are averaged over the seeds\n", duration, tick, seeds);
+	printf("%-12s %7s %7s %6s %6s %8s %7s %7s %10s %9s %7s %7s\n",
+		"scenario", "target", "t_max", "filter", "gain", "decrease", "util", "share", "queue_ms", "q95_ms", "loss", "resend"
+	);
+
+	const auto wall_start = std::chrono::steady_clock::now();
+	size_t runs {0};
+	for (const auto& scenario : scenarios) {
+		for (const auto& point : grid) {
+			Result avg;
+			for (size_t seed = 0; seed < seeds; seed++) {
+				Sim sim{scenario, point, duration, tick, uint32_t(seed + 1)};
+				if (curve.is_open() && runs == 0) {
+					sim.curve = &curve;
+				}
+				const Result result = sim.run();
+				runs++;
+
+				avg.utilization += result.utilization / seeds;
+				avg.share += result.share / seeds;
+				avg.queue_mean += result.queue_mean / seeds;
+				avg.queue_p95 += result.queue_p95 / seeds;
+				avg.loss += result.loss / seeds;
+				avg.resend += result.resend / seeds;
+			}
+			print_result(scenario, point, avg);
+		}
+	}
+
+	const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall_start).count();
+	fprintf(stderr, "%zu runs, %.0fs simulated in %.2fs\n", runs, runs * duration, wall);
+
+	return 0;
+}
+
@@ -0,0 +1,281 @@
+// end to end throughput benchmark, one seeder sending a file to every other peer over FakeNet
+// (see README.md for how to build it)
+//
+// usage: ngc_ft1_bench [--sizes 65536,1048576,...] [--peers 1,4,...]
+//                      [--delay s] [--jitter s] [--loss 0-1] [--reorder 0-1] [--bandwidth bytes/s] [--queue s] [--relayed]
+//                      [--threads n] [--fec] [--one-way-delay] [--reread] [--timeout s]
+
+#include "../ngc_ft1.h"
+
+#include "./fake_tox.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+struct Receiver {
+	std::vector<uint8_t> data;
+	std::atomic<size_t> received {0};
+	std::atomic<bool> done {false};
+	std::atomic<size_t>* done_count {nullptr};
+};
+
+struct Result {
+	bool complete {false};
+	bool match {false};
+	float time {0.f}; // seconds until the last receiver was done
+	float release {0.f}; // seconds until the seeder freed all its transfers
+	float cpu {0.f}; // seconds, all nodes and the fake network
+	FakeNet::Stats net;
+};
+
+static Result run(const FakeNet::LinkParams& params, const NGC_FT1_options& options, bool reread, size_t file_size, size_t peers, float timeout) {
+	using clock = std::chrono::steady_clock;
+
+	FakeNet net{peers+1, params};
+
+	std::vector<uint8_t> file(file_size);
+	std::mt19937 rng{1337};
+	std::generate(file.begin(), file.end(), [&rng]() { return uint8_t(rng()); });
+
+	std::vector<NGC_FT1*> ft;
+	for (size_t i = 0; i < net.size(); i++) {
+		ft.push_back(NGC_FT1_new(&options));
+		NGC_FT1_register_ext(ft.back(), net.ext(i));
+	}
+
+	NGC_FT1_register_callback_send_data(ft[0], NGC_FT1_file_kind::ID,
+		[](Tox*, uint32_t, uint32_t, uint16_t, size_t data_offset, uint8_t* data, size_t data_size, void* user_data) {
+			const auto& file = *static_cast<const std::vector<uint8_t>*>(user_data);
+			std::memcpy(data, file.data() + data_offset, data_size);
+		},
+		&file
+	);
+	NGC_FT1_set_send_reread_file_kind(ft[0], NGC_FT1_file_kind::ID, reread);
+
+	std::atomic<size_t> send_done_count {0};
+	NGC_FT1_register_callback_send_done(ft[0], NGC_FT1_file_kind::ID,
+		[](Tox*, uint32_t, uint32_t, uint16_t, bool, void* user_data) {
+			(*static_cast<std::atomic<size_t>*>(user_data))++;
+		},
+		&send_done_count
+	);
+
+	std::atomic<size_t> done_count {0};
+	std::vector<Receiver> receivers(net.size());
+	for (size_t i = 1; i < net.size(); i++) {
+		auto& receiver = receivers[i];
+		receiver.data.resize(file_size);
+		receiver.done_count = &done_count;
+
+		NGC_FT1_register_callback_recv_init(ft[i], NGC_FT1_file_kind::ID,
+			[](Tox*, uint32_t, uint32_t, const uint8_t*, size_t, const uint16_t, const size_t, void*) -> bool {
+				return true;
+			},
+			nullptr
+		);
+		NGC_FT1_register_callback_recv_data(ft[i], NGC_FT1_file_kind::ID,
+			[](Tox*, uint32_t, uint32_t, uint16_t, size_t data_offset, const uint8_t* data, size_t data_size, void* user_data) {
+				auto& receiver = *static_cast<Receiver*>(user_data);
+				if (data_offset + data_size <= receiver.data.size()) {
+					std::memcpy(receiver.data.data() + data_offset, data, data_size);
+				}
+				receiver.received += data_size;
+			},
+			&receiver
+		);
+		NGC_FT1_register_callback_recv_done(ft[i], NGC_FT1_file_kind::ID,
+			[](Tox*, uint32_t, uint32_t, uint16_t, bool, void* user_data) {
+				auto& receiver = *static_cast<Receiver*>(user_data);
+				if (!receiver.done.exchange(true)) {
+					(*receiver.done_count)++;
+				}
+			},
+			&receiver
+		);
+	}
+
+	const std::clock_t cpu_start = std::clock();
+	const auto time_start = clock::now();
+	auto time_last = time_start;
+
+	uint8_t file_id[TOX_FILE_ID_LENGTH] {};
+	for (size_t i = 1; i < net.size(); i++) {
+		NGC_FT1_send_init_private(net.tox(0), ft[0], 0, i, NGC_FT1_file_kind::ID, file_id, sizeof(file_id), file_size, nullptr);
+	}
+
+	Result result;
+	while (true) {
+		net.deliver();
+
+		const auto now = clock::now();
+		const float time_delta = std::chrono::duration<float>(now - time_last).count();
+		time_last = now;
+		for (size_t i = 0; i < net.size(); i++) {
+			NGC_FT1_iterate(net.tox(i), ft[i], time_delta);
+		}
+
+		const float time = std::chrono::duration<float>(now - time_start).count();
+		if (!result.complete && done_count == peers) {
+			result.complete = true;
+			result.time = time;
+		}
+		if (result.complete && send_done_count == peers) {
+			result.release = time;
+			break;
+		}
+		if (time > timeout) {
+			if (!result.complete) {
+				result.time = time;
+			}
+			result.release = time;
+			break;
+		}
+
+		// like a tox loop, but a lot more eager
+		const float next_due = net.nextDue();
+		if (next_due != 0.f) {
+			std::this_thread::sleep_for(std::chrono::duration<float>(next_due < 0.f ? 0.001f : std::min(next_due, 0.001f)));
+		}
+	}
+
+	result.cpu = float(std::clock() - cpu_start) / CLOCKS_PER_SEC;
+	result.net = net.stats();
+
+	for (auto* ctx : ft) {
+		NGC_FT1_kill(ctx);
+	}
+
+	result.match = result.complete;
+	for (size_t i = 1; i < net.size(); i++) {
+		result.match = result.match && receivers[i].received == file_size && receivers[i].data == file;
+	}
+
+	return result;
+}
+
+static std::vector<size_t> parse_list(const char* str) {
+	std::vector<size_t> list;
+	for (const char* it = str; *it != '\0';) {
+		char* end {nullptr};
+		list.push_back(std::strtoull(it, &end, 10));
+		it = *end == ',' ? end + 1 : end;
+		if (end == it && *end != '\0') {
+			break; // garbage
+		}
+	}
+	return list;
+}
+
+int main(int argc, char** argv) {
+	std::vector<size_t> sizes {64*1024, 1024*1024, 4*1024*1024};
+	std::vector<size_t> peer_counts {1, 4, 16};
+	FakeNet::LinkParams params;
+	NGC_FT1_options options {};
+	options.acks_per_packet = 3;
+	options.init_retry_timeout_after = 5.f;
+	options.sending_give_up_after = 30.f;
+	float timeout {120.f};
+	bool reread {false};
+
+	for (int i = 1; i < argc; i++) {
+		const std::string arg {argv[i]};
+		if (arg == "--fec") {
+			options.fec = true;
+			continue;
+		} else if (arg == "--relayed") {
+			params.relayed = true;
+			continue;
+		} else if (arg == "--one-way-delay") {
+			options.one_way_delay = true;
+			continue;
+		} else if (arg == "--reread") {
+			reread = true;
+			continue;
+		}
+
+		if (i+1 >= argc) {
+			fprintf(stderr, "missing value for %s\n", arg.c_str());
+			return 1;
+		}
+		const char* value = argv[++i];
+
+		if (arg == "--sizes") {
+			sizes = parse_list(value);
+		} else if (arg == "--peers") {
+			peer_counts = parse_list(value);
+		} else if (arg == "--delay") {
+			params.delay = std::atof(value);
+		} else if (arg == "--jitter") {
+			params.jitter = std::atof(value);
+		} else if (arg == "--loss") {
+			params.loss = std::atof(value);
+		} else if (arg == "--reorder") {
+			params.reorder = std::atof(value);
+		} else if (arg == "--bandwidth") {
+			params.bandwidth = std::atof(value);
+		} else if (arg == "--queue") {
+			params.queue = std::atof(value);
+		} else if (arg == "--threads") {
+			options.engine_threads = std::strtoull(value, nullptr, 10);
+			options.threaded = options.engine_threads > 0;
+		} else if (arg == "--timeout") {
+			timeout = std::atof(value);
+		} else {
+			fprintf(stderr, "unknown argument %s\n", arg.c_str());
+			return 1;
+		}
+	}
+
+	printf("# delay %.3fs jitter %.3fs loss %.3f reorder %.3f bandwidth %.0fB/s queue %.3fs relayed %d threads %zu fec %d one_way_delay %d reread %d\n",
+		params.delay, params.jitter, params.loss, params.reorder, params.bandwidth, params.queue, int(params.relayed),
+		options.engine_threads, int(options.fec), int(options.one_way_delay), int(reread)
+	);
+	// goodput: file bytes of all peers per second
+	// retransmit: share of the sent data payload that was a resend (timestamps count as payload)
+	// cpu: process cpu time (all nodes and the fake network) per MiB delivered
+	// release: until the seeder freed all its transfers (acked, confirmed or given up)
+	printf("%10s %5s %9s %9s %14s %10s %10s %9s %s\n", "size", "peers", "time_s", "release_s", "goodput_MiB/s", "retransmit", "cpu_ms/MiB", "packets", "result");
+
+	bool all_ok {true};
+	for (const size_t size : sizes) {
+		for (const size_t peers : peer_counts) {
+			if (size == 0 || peers == 0) {
+				continue;
+			}
+
+			const auto result = run(params, options, reread, size, peers, timeout);
+
+			const float total_mib = float(size * peers) / (1024.f*1024.f);
+			const float retransmit = result.net.data_bytes > 0
+				? std::max(0.f, 1.f - float(size * peers) / result.net.data_bytes)
+				: 0.f
+			;
+
+			printf("%10zu %5zu %9.3f %9.3f %14.3f %10.4f %10.2f %9zu %s\n",
+				size, peers,
+				result.time,
+				result.release,
+				total_mib / result.time,
+				retransmit,
+				result.cpu * 1000.f / total_mib,
+				result.net.packets,
+				result.match ? "ok" : (result.complete ? "MISMATCH" : "TIMEOUT")
+			);
+			fflush(stdout);
+
+			all_ok = all_ok && result.match;
+		}
+	}
+
+	return all_ok ? 0 : 1;
+}
+
@@ -0,0 +1,409 @@
+// microbenchmarks of the per packet data structures, LEDBAT and the sequence buffers
+// (see README.md for how to build it)
+//
+// usage: ngc_ft1_microbench [--filter substring] [--min-time s per run] [--save file] [--baseline file] [--threshold 0.2]
+//
+// --save writes the results as a baseline, --baseline compares against one
+// and fails if an op got slower than threshold, or allocates more
+
+#include "../ledbat.hpp"
+#include "../sequence_buffer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+// counts every allocation of the process, the benchmarks are single threaded
+static size_t g_allocations {0};
+
+void* operator new(size_t size) {
+	g_allocations++;
+	if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+	throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	std::free(ptr);
+}
+
+struct Result {
+	std::string name;
+	double ns_per_op {0.0};
+	double allocs_per_op {0.0};
+};
+
+static double g_min_time {0.1}; // per run
+static std::string g_filter;
+static std::vector<Result> g_results;
+
+// calls op in batches, until min time passed, the best of 3 runs is kept against noise
+// ops_per_call is for ops that work on a whole window per call
+template<typename FN>
+static void measure(const std::string& name, FN&& op, size_t ops_per_call = 1) {
+	using clock = std::chrono::steady_clock;
+
+	if (name.find(g_filter) == std::string::npos) {
+		return;
+	}
+
+	// warmup, fills caches and lets the structures reach their steady size
+	for (size_t i = 0; i < 64; i++) {
+		op();
+	}
+
+	Result result {name, std::numeric_limits<double>::infinity(), 0.0};
+	for (size_t run = 0; run < 3; run++) {
+		size_t calls {0};
+		const size_t allocations_start = g_allocations;
+		const auto start = clock::now();
+		double elapsed {0.0};
+		while (elapsed < g_min_time) {
+			for (size_t i = 0; i < 64; i++) {
+				op();
+			}
+			calls += 64;
+			elapsed = std::chrono::duration<double>(clock::now() - start).count();
+		}
+
+		const double ops = double(calls * ops_per_call);
+		if (elapsed * 1e9 / ops < result.ns_per_op) {
+			result.ns_per_op = elapsed * 1e9 / ops;
+			result.allocs_per_op = double(g_allocations - allocations_start) / ops;
+		}
+	}
+
+	printf("%-44s %12.1f %10.2f\n", result.name.c_str(), result.ns_per_op, result.allocs_per_op);
+	fflush(stdout);
+	g_results.push_back(std::move(result));
+}
+
+static const size_t _WINDOWS[] {10, 100, 1000, 10000};
+
+static void bench_ledbat(void) {
+	for (const size_t window : _WINDOWS) {
+		const std::string suffix = "/" + std::to_string(window);
+
+		{ // in order acks, one segment sent per ack
+			LEDBAT cca{496};
+			uint32_t next {0};
+			for (; next < window; next++) {
+				cca.onSent({0, next}, 496);
+			}
+			measure("ledbat_send_ack_in_order" + suffix, [&]() {
+				cca.onAck({{0, next - uint32_t(window)}});
+				cca.onSent({0, next++}, 496);
+			});
+		}
+
+		{ // same, keeping only the ranges
+			SendSequenceBuffer ssb;
+			ssb.seq_id_mask = 0xffffffff;
+			for (size_t i = 0; i < window; i++) {
+				ssb.addRange(i * 496, 496);
+			}
+			size_t offset {window * 496};
+			measure("ssb_add_range_erase_in_order" + suffix, [&]() {
+				ssb.erase(ssb.next_seq_id - uint32_t(window));
+				ssb.addRange(offset, 496);
+				offset += 496;
+			});
+		}
+
+		{ // acks for random segments of the window
+			LEDBAT cca{496};
+			std::mt19937 rng{42};
+			std::vector<uint32_t> in_flight;
+			uint32_t next {0};
+			for (; next < window; next++) {
+				cca.onSent({0, next}, 496);
+				in_flight.push_back(next);
+			}
+			measure("ledbat_send_ack_reordered" + suffix, [&]() {
+				auto& seq = in_flight[rng() % in_flight.size()];
+				cca.onAck({{0, seq}});
+				cca.onSent({0, next}, 496);
+				seq = next++;
+			});
+		}
+
+		{ // 1% of the segments are lost and acked after their resend
+			LEDBAT cca{496};
+			std::mt19937 rng{42};
+			std::deque<uint32_t> in_flight;
+			uint32_t next {0};
+			for (; next < window; next++) {
+				cca.onSent({0, next}, 496);
+				in_flight.push_back(next);
+			}
+			measure("ledbat_send_ack_lossy" + suffix, [&]() {
+				const uint32_t seq = in_flight.front();
+				in_flight.pop_front();
+				if (rng() % 100 == 0) {
+					cca.onLoss({0, seq}, false);
+					in_flight.push_back(seq);
+				} else {
+					cca.onAck({{0, seq}});
+					cca.onSent({0, next}, 496);
+					in_flight.push_back(next++);
+				}
+			});
+		}
+
+		{ // called every iterate per peer
+			LEDBAT cca{496};
+			for (uint32_t i = 0; i < window; i++) {
+				cca.onSent({0, i}, 496);
+			}
+			// without acks there is no delay estimate, so nothing times out
+			measure("ledbat_get_timeouts" + suffix, [&]() {
+				volatile size_t timeouts = cca.getTimeouts().size();
+				(void)timeouts;
+			});
+			measure("ledbat_can_send" + suffix, [&]() {
+				volatile size_t can_send = cca.canSend();
+				(void)can_send;
+			});
+		}
+	}
+
+	// many peers with a small window each, the state does not stay in cache
+	for (const size_t peers : {10, 100, 1000}) {
+		const size_t window {64};
+		std::vector<std::unique_ptr<LEDBAT>> ccas;
+		for (size_t i = 0; i < peers; i++) {
+			ccas.push_back(std::make_unique<LEDBAT>(496));
+			for (uint32_t seq = 0; seq < window; seq++) {
+				ccas.back()->onSent({0, seq}, 496);
+			}
+		}
+		std::vector<uint32_t> next(peers, window);
+		size_t peer {0};
+		measure("ledbat_send_ack_peers/" + std::to_string(peers), [&]() {
+			auto& cca = *ccas[peer];
+			cca.onAck({{0, next[peer] - uint32_t(window)}});
+			cca.onSent({0, next[peer]++}, 496);
+			peer = (peer + 1) % peers;
+		});
+	}
+}
+
+static void bench_ssb(void) {
+	for (const size_t window : _WINDOWS) {
+		const std::string suffix = "/" + std::to_string(window);
+
+		{ // add one, erase the oldest (acked)
+			SendSequenceBuffer ssb;
+			ssb.seq_id_mask = 0xffffffff;
+			for (size_t i = 0; i < window; i++) {
+				ssb.add(std::vector<uint8_t>(496));
+			}
+			measure("ssb_add_erase_in_order" + suffix, [&]() {
+				ssb.erase(ssb.next_seq_id - uint32_t(window));
+				ssb.add(std::vector<uint8_t>(496));
+			});
+		}
+
+		{ // same, keeping only the ranges
+			SendSequenceBuffer ssb;
+			ssb.seq_id_mask = 0xffffffff;
+			for (size_t i = 0; i < window; i++) {
+				ssb.addRange(i * 496, 496);
+			}
+			size_t offset {window * 496};
+			measure("ssb_add_range_erase_in_order" + suffix, [&]() {
+				ssb.erase(ssb.next_seq_id - uint32_t(window));
+				ssb.addRange(offset, 496);
+				offset += 496;
+			});
+		}
+
+		{ // acks for random segments of the window
+			SendSequenceBuffer ssb;
+			ssb.seq_id_mask = 0xffffffff;
+			std::mt19937 rng{42};
+			std::vector<uint32_t> in_flight;
+			for (size_t i = 0; i < window; i++) {
+				in_flight.push_back(ssb.add(std::vector<uint8_t>(496)));
+			}
+			measure("ssb_add_erase_reordered" + suffix, [&]() {
+				auto& seq = in_flight[rng() % in_flight.size()];
+				ssb.erase(seq);
+				seq = ssb.add(std::vector<uint8_t>(496));
+			});
+		}
+
+		{ // the timeout scan of every iterate, per segment
+			SendSequenceBuffer ssb;
+			ssb.seq_id_mask = 0xffffffff;
+			for (size_t i = 0; i < window; i++) {
+				ssb.add(std::vector<uint8_t>(496));
+			}
+			volatile size_t sum {0};
+			measure("ssb_for_each_per_segment" + suffix, [&]() {
+				ssb.for_each(0.001f, [&](uint32_t id, const SendSequenceBuffer::SSBEntry& entry) {
+					sum += id + entry.size;
+				});
+			}, window);
+		}
+	}
+}
+
+static void bench_rsb(void) {
+	for (const size_t window : _WINDOWS) {
+		const std::string suffix = "/" + std::to_string(window);
+
+		{ // every segment arrives in order and is popped right away
+			RecvSequenceBuffer rsb;
+			rsb.seq_id_mask = 0xffffffff;
+			uint32_t next {0};
+			measure("rsb_add_pop_in_order" + suffix, [&]() {
+				rsb.add(next++, std::vector<uint8_t>(496));
+				while (rsb.canPop()) {
+					rsb.pop();
+				}
+			});
+		}
+
+		{ // the segments of a window arrive shuffled
+			RecvSequenceBuffer rsb;
+			rsb.seq_id_mask = 0xffffffff;
+			std::mt19937 rng{42};
+			std::vector<uint32_t> order(window);
+			std::iota(order.begin(), order.end(), 0u);
+			std::shuffle(order.begin(), order.end(), rng);
+			uint32_t base {0};
+			size_t i {0};
+			measure("rsb_add_pop_reordered" + suffix, [&]() {
+				rsb.add(base + order[i++], std::vector<uint8_t>(496));
+				while (rsb.canPop()) {
+					rsb.pop();
+				}
+				if (i == window) {
+					i = 0;
+					base += window;
+				}
+			});
+		}
+
+		{ // 1% lost, the resend arrives a window later, everything after the hole is buffered
+			RecvSequenceBuffer rsb;
+			rsb.seq_id_mask = 0xffffffff;
+			std::mt19937 rng{42};
+			std::deque<std::pair<uint32_t, uint32_t>> resends; // due, seq
+			uint32_t next {0};
+			uint32_t sent {0};
+			measure("rsb_add_pop_lossy" + suffix, [&]() {
+				if (!resends.empty() && resends.front().first <= sent) {
+					rsb.add(resends.front().second, std::vector<uint8_t>(496));
+					resends.pop_front();
+				} else if (rng() % 100 == 0) {
+					resends.push_back({sent + uint32_t(window), next++});
+				} else {
+					rsb.add(next++, std::vector<uint8_t>(496));
+				}
+				sent++;
+				while (rsb.canPop()) {
+					rsb.pop();
+				}
+			});
+		}
+	}
+}
+
+static std::map<std::string, Result> load_baseline(const std::string& path) {
+	std::map<std::string, Result> baseline;
+	std::ifstream file{path};
+	Result result;
+	while (file >> result.name >> result.ns_per_op >> result.allocs_per_op) {
+		baseline[result.name] = result;
+	}
+	return baseline;
+}
+
+static bool save_baseline(const std::string& path) {
+	std::ofstream file{path};
+	for (const auto& result : g_results) {
+		file << result.name << " " << result.ns_per_op << " " << result.allocs_per_op << "\n";
+	}
+	return file.good();
+}
+
+int main(int argc, char** argv) {
+	std::string save_path;
+	std::string baseline_path;
+	double threshold {0.2};
+
+	for (int i = 1; i+1 < argc; i += 2) {
+		const std::string arg {argv[i]};
+		const char* value = argv[i+1];
+		if (arg == "--filter") {
+			g_filter = value;
+		} else if (arg == "--min-time") {
+			g_min_time = std::atof(value);
+		} else if (arg == "--save") {
+			save_path = value;
+		} else if (arg == "--baseline") {
+			baseline_path = value;
+		} else if (arg == "--threshold") {
+			threshold = std::atof(value);
+		} else {
+			fprintf(stderr, "unknown argument %s\n", arg.c_str());
+			return 1;
+		}
+	}
+
+	printf("%-44s %12s %10s\n", "benchmark", "ns/op", "allocs/op");
+	bench_ledbat();
+	bench_ssb();
+	bench_rsb();
+
+	if (!save_path.empty() && !save_baseline(save_path)) {
+		fprintf(stderr, "failed to write %s\n", save_path.c_str());
+		return 1;
+	}
+
+	if (baseline_path.empty()) {
+		return 0;
+	}
+
+	const auto baseline = load_baseline(baseline_path);
+	if (baseline.empty()) {
+		fprintf(stderr, "failed to read %s\n", baseline_path.c_str());
+		return 1;
+	}
+
+	size_t regressions {0};
+	printf("\n%-44s %12s %10s\n", "compared to baseline", "time", "allocs/op");
+	for (const auto& result : g_results) {
+		const auto it = baseline.find(result.name);
+		if (it == baseline.end()) {
+			continue;
+		}
+
+		const double time_change = result.ns_per_op / it->second.ns_per_op - 1.0;
+		const double allocs_change = result.allocs_per_op - it->second.allocs_per_op;
+		const bool regression = time_change > threshold || allocs_change > 0.01;
+		printf("%-44s %+11.1f%% %+10.2f%s\n", result.name.c_str(), time_change * 100.0, allocs_change, regression ? " REGRESSION" : "");
+		regressions += regression;
+	}
+
+	return regressions == 0 ? 0 : 1;
+}
+
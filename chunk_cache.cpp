@@ -0,0 +1,41 @@
+#include "./chunk_cache.hpp"
+
+ChunkCache::Data ChunkCache::get(const Key& key) {
+	auto it = _lookup.find(key);
+	if (it == _lookup.end()) {
+		misses++;
+		return nullptr;
+	}
+
+	hits++;
+	_lru.splice(_lru.begin(), _lru, it->second);
+	return it->second->second;
+}
+
+void ChunkCache::put(Key&& key, std::vector<uint8_t>&& data) {
+	if (data.size() > maxEntrySize()) {
+		return;
+	}
+
+	auto it = _lookup.find(key);
+	if (it != _lookup.end()) {
+		// same id, same content. just refresh
+		_lru.splice(_lru.begin(), _lru, it->second);
+		return;
+	}
+
+	_size += data.size();
+	_lru.emplace_front(key, std::make_shared<const std::vector<uint8_t>>(std::move(data)));
+	_lookup[std::move(key)] = _lru.begin();
+
+	evict();
+}
+
+void ChunkCache::evict(void) {
+	while (_size > _capacity && !_lru.empty()) {
+		_size -= _lru.back().second->size();
+		_lookup.erase(_lru.back().first);
+		_lru.pop_back();
+	}
+}
+
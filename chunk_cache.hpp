@@ -0,0 +1,48 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// size bounded LRU cache of whole files (chunks, messages ...), keyed by (file_kind, file_id)
+// entries are handed out as shared_ptrs, so a transfer can keep serving an entry after it got evicted
+struct ChunkCache {
+	public:
+		using Key = std::pair<uint32_t, std::vector<uint8_t>>; // file_kind, file_id
+		using Data = std::shared_ptr<const std::vector<uint8_t>>;
+
+	public:
+		explicit ChunkCache(size_t capacity = 0) : _capacity(capacity) {}
+
+		bool enabled(void) const { return _capacity > 0; }
+
+		// bigger files would push out too much else
+		size_t maxEntrySize(void) const { return _capacity / 8; }
+
+		// nullptr on miss, counts hits and misses
+		Data get(const Key& key);
+
+		void put(Key&& key, std::vector<uint8_t>&& data);
+
+	public: // stats
+		uint64_t hits {0};
+		uint64_t misses {0};
+
+		size_t entries(void) const { return _lru.size(); }
+		size_t bytes(void) const { return _size; }
+
+	private:
+		void evict(void);
+
+	private:
+		size_t _capacity {0};
+		size_t _size {0};
+
+		// front is the most recently used
+		std::list<std::pair<Key, Data>> _lru;
+		std::map<Key, std::list<std::pair<Key, Data>>::iterator> _lookup;
+};
+
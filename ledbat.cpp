@@ -16,8 +16,8 @@
 
 inline constexpr bool PLOTTING = false;
 
-LEDBAT::LEDBAT(size_t maximum_segment_data_size) : MAXIMUM_SEGMENT_DATA_SIZE(maximum_segment_data_size) {
-	_time_start_offset = clock::now();
+LEDBAT::LEDBAT(size_t maximum_segment_data_size, TimeSource time_source) : MAXIMUM_SEGMENT_DATA_SIZE(maximum_segment_data_size), _time_source(std::move(time_source)) {
+	_time_start_offset = _time_source();
 }
 
 size_t LEDBAT::canSend(void) const {
@@ -26,12 +26,12 @@ size_t LEDBAT::canSend(void) const {
 	}
 
 	const int64_t cspace = _cwnd - _in_flight_bytes;
-	if (cspace < MAXIMUM_SEGMENT_DATA_SIZE) {
+	if (cspace < int64_t(MAXIMUM_SEGMENT_DATA_SIZE)) { // signed, we might be over the window
 		return 0u;
 	}
 
 	const int64_t fspace = _fwnd - _in_flight_bytes;
-	if (fspace < MAXIMUM_SEGMENT_DATA_SIZE) {
+	if (fspace < int64_t(MAXIMUM_SEGMENT_DATA_SIZE)) { // signed, we might be over the window
 		return 0u;
 	}
 
@@ -43,10 +43,15 @@ size_t LEDBAT::canSend(void) const {
 std::vector<LEDBAT::SeqIDType> LEDBAT::getTimeouts(void) const {
 	std::vector<LEDBAT::SeqIDType> list;
 
+	const TimeType current_delay = getCurrentDelayTime();
+	if (current_delay < 0) {
+		return list; // no delay estimate yet
+	}
+
 	// after 2 delays we trigger timeout
-	const auto now_adjusted = getTimeNow() - getCurrentDelay()*2.f;
+	const TimeType now_adjusted = getTimeNow() - current_delay*2;
 
-	for (const auto& [seq, time_stamp, size] : _in_flight) {
+	for (const auto& [seq, time_stamp, size, resent] : _in_flight) {
 		if (now_adjusted > time_stamp) {
 			list.push_back(seq);
 		}
@@ -63,14 +68,26 @@ void LEDBAT::onSent(SeqIDType seq, size_t data_size) {
 		}
 	}
 
-	_in_flight.push_back({seq, getTimeNow(), data_size + SEGMENT_OVERHEAD});
+	_in_flight.push_back({seq, getTimeNow(), data_size + SEGMENT_OVERHEAD, false});
 	_in_flight_bytes += data_size + SEGMENT_OVERHEAD;
 	_recently_sent_bytes += data_size + SEGMENT_OVERHEAD;
 }
 
+void LEDBAT::onDeparted(SeqIDType seq) {
+	auto it = std::find_if(_in_flight.begin(), _in_flight.end(), [seq](const auto& v) -> bool {
+		return std::get<0>(v) == seq;
+	});
+
+	if (it == _in_flight.end()) {
+		return; // not found, ignore
+	}
+
+	std::get<1>(*it) = getTimeNow();
+}
+
 void LEDBAT::onAck(std::vector<SeqIDType> seqs) {
 	// only take the smallest value
-	float most_recent {-std::numeric_limits<float>::infinity()};
+	TimeType most_recent {std::numeric_limits<TimeType>::min()};
 
 	int64_t acked_data {0};
 
@@ -84,7 +101,9 @@ void LEDBAT::onAck(std::vector<SeqIDType> seqs) {
 		if (it == _in_flight.end()) {
 			continue; // not found, ignore
 		} else {
-			addRTT(now - std::get<1>(*it));
+			if (!std::get<3>(*it)) {
+				addRTT(now - std::get<1>(*it));
+			}
 
 			// TODO: remove
 			most_recent = std::max(most_recent, std::get<1>(*it));
@@ -95,7 +114,7 @@ void LEDBAT::onAck(std::vector<SeqIDType> seqs) {
 		}
 	}
 
-	if (most_recent == -std::numeric_limits<float>::infinity()) {
+	if (most_recent == std::numeric_limits<TimeType>::min()) {
 		return; // not found, ignore
 	}
 
@@ -104,7 +123,6 @@ void LEDBAT::onAck(std::vector<SeqIDType> seqs) {
 
 void LEDBAT::onLoss(SeqIDType seq, bool discard) {
 	auto it = std::find_if(_in_flight.begin(), _in_flight.end(), [seq](const auto& v) -> bool {
-		assert(!std::isnan(std::get<1>(v)));
 		return std::get<0>(v) == seq;
 	});
 
@@ -118,7 +136,7 @@ void LEDBAT::onLoss(SeqIDType seq, bool discard) {
 	// at most once per rtt?
 
 	if (PLOTTING) {
-		std::cerr << "CCA: onLoss: TIME: " << getTimeNow() << "\n";
+		std::cerr << "CCA: onLoss: TIME: " << toSeconds(getTimeNow()) << "\n";
 	}
 
 	// TODO: "if data lost is not to be retransmitted"
@@ -126,60 +144,124 @@ void LEDBAT::onLoss(SeqIDType seq, bool discard) {
 		_in_flight_bytes -= std::get<2>(*it);
 		assert(_in_flight_bytes >= 0);
 		_in_flight.erase(it);
+	} else {
+		// without this it would time out (and be resent) again on every check
+		std::get<1>(*it) = getTimeNow();
+		std::get<3>(*it) = true;
 	}
-	// TODO: reset timestamp?
 
 	updateWindows();
 }
 
-float LEDBAT::getCurrentDelay(void) const {
-	float sum {0.f};
-	size_t count {0};
-	for (size_t i = 0; i < _tmp_rtt_buffer.size(); i++) {
-		//sum += _tmp_rtt_buffer.at(_tmp_rtt_buffer.size()-(1+i));
-		sum += _tmp_rtt_buffer.at(i);
-		count++;
+void LEDBAT::onResend(SeqIDType seq) {
+	auto it = std::find_if(_in_flight.begin(), _in_flight.end(), [seq](const auto& v) -> bool {
+		return std::get<0>(v) == seq;
+	});
+
+	if (it == _in_flight.end()) {
+		return; // not found, ignore
 	}
 
-	if (count) {
-		return sum / count;
-	} else {
+	std::get<1>(*it) = getTimeNow();
+	std::get<3>(*it) = true;
+}
+
+void LEDBAT::onDelivered(std::vector<SeqIDType> seqs) {
+	// same as for resent segments, onAck then takes no delay sample
+	for (auto& v : _in_flight) {
+		if (std::find(seqs.cbegin(), seqs.cend(), std::get<0>(v)) != seqs.cend()) {
+			std::get<3>(v) = true;
+		}
+	}
+
+	onAck(std::move(seqs));
+}
+
+float LEDBAT::getCurrentDelay(void) const {
+	const TimeType current_delay = getCurrentDelayTime();
+	if (current_delay < 0) {
 		return std::numeric_limits<float>::infinity();
 	}
+	return toSeconds(current_delay);
 }
 
-void LEDBAT::addRTT(float new_delay) {
-	auto now = getTimeNow();
+float LEDBAT::getJitter(void) const {
+	return toSeconds(_one_way_delay.empty() ? _rtt.jitter : _one_way_delay.jitter);
+}
 
-	_base_delay = std::min(_base_delay, new_delay);
-	// TODO: use fixed size instead? allocations can ruin perf
-	_rtt_buffer.push_back({now, new_delay});
+float LEDBAT::getTargetDelay(void) const {
+	// the base is a minimum, so noise alone shows up as a few times the jitter of queuing delay
+	return std::clamp(
+		target_delay_jitter_factor * getJitter(),
+		target_delay,
+		std::max(target_delay, target_delay_max)
+	);
+}
 
-	_tmp_rtt_buffer.push_front(new_delay);
-	// HACKY
-	if (_tmp_rtt_buffer.size() > current_delay_filter_window) {
-		_tmp_rtt_buffer.resize(current_delay_filter_window);
+LEDBAT::TimeType LEDBAT::getCurrentDelayTime(void) const {
+	if (_rtt.empty()) {
+		return -1;
 	}
+	return _rtt.current();
+}
 
-	// is it 1 minute yet
-	if (now - _rtt_buffer.front().first >= 30.f) {
+void LEDBAT::addRTT(TimeType new_delay) {
+	_rtt.add(getTimeNow(), new_delay, current_delay_filter_window, toTime(base_delay_section_length), base_delay_sections);
+}
 
-		float new_section_minimum = new_delay;
-		for (const auto it : _rtt_buffer) {
-			new_section_minimum = std::min(it.second, new_section_minimum);
-		}
+void LEDBAT::onOneWayDelay(int64_t one_way_delay) {
+	_one_way_delay.add(getTimeNow(), one_way_delay, current_delay_filter_window, toTime(base_delay_section_length), base_delay_sections);
+}
 
-		_rtt_buffer_minutes.push_back(new_section_minimum);
+LEDBAT::TimeType LEDBAT::DelayFilter::current(void) const {
+	return current_delays_sum / TimeType(current_delays.size());
+}
+
+void LEDBAT::DelayFilter::add(TimeType now, TimeType new_delay, size_t window, TimeType section_length, size_t sections) {
+	base = std::min(base, new_delay);
 
-		_rtt_buffer.clear();
+	if (!empty()) {
+		const TimeType difference = new_delay > last_delay ? new_delay - last_delay : last_delay - new_delay;
+		jitter += (difference - jitter) / 16;
+	}
+	last_delay = new_delay;
 
-		if (_rtt_buffer_minutes.size() > 20) {
-			_rtt_buffer_minutes.pop_front();
+	window = std::max<size_t>(window, 1);
+
+	// the window is a config, it might have changed
+	if (current_delays.size() > window) {
+		current_delays.clear();
+		current_delays_next = 0;
+		current_delays_sum = 0;
+	}
+	if (current_delays.size() < window) {
+		current_delays.push_back(new_delay);
+	} else {
+		current_delays_sum -= current_delays[current_delays_next];
+		current_delays[current_delays_next] = new_delay;
+		current_delays_next = (current_delays_next + 1) % current_delays.size();
+	}
+	current_delays_sum += new_delay;
+
+	if (section_start < 0) {
+		section_start = now;
+		section_minimum = new_delay;
+	} else {
+		section_minimum = std::min(section_minimum, new_delay);
+	}
+
+	// is it 1 minute yet
+	if (now - section_start >= section_length) {
+		section_minimums.push_back(section_minimum);
+		section_start = -1;
+
+		if (section_minimums.size() > sections) {
+			section_minimums.pop_front();
 		}
 
-		_base_delay = std::numeric_limits<float>::infinity();
-		for (const float it : _rtt_buffer_minutes) {
-			_base_delay = std::min(_base_delay, it);
+		base = std::numeric_limits<TimeType>::max();
+		for (const TimeType it : section_minimums) {
+			base = std::min(base, it);
 		}
 	}
 }
@@ -187,17 +269,29 @@ void LEDBAT::addRTT(float new_delay) {
 void LEDBAT::updateWindows(void) {
 	const auto now {getTimeNow()};
 
-	const float current_delay {getCurrentDelay()};
+	const TimeType current_delay_time {getCurrentDelayTime()};
+	if (current_delay_time < 0) {
+		return; // no samples yet
+	}
 
-	if (now - _last_cwnd >= current_delay) {
-		const float queuing_delay {current_delay - _base_delay};
+	if (now - _last_cwnd >= current_delay_time) {
+		// the differences are small, so seconds as float are precise enough from here
+		const float current_delay {toSeconds(current_delay_time)};
+		const float base_delay {toSeconds(_rtt.base)};
+		const float queuing_delay {toSeconds(
+			_one_way_delay.empty()
+				? current_delay_time - _rtt.base
+				: _one_way_delay.current() - _one_way_delay.base
+		)};
 
 		_fwnd = max_byterate_allowed * current_delay;
 		_fwnd *= 1.3f; // try do balance conservative algo a bit, current_delay
 
-		float gain {1.f / std::min(16.f, std::ceil(2.f*target_delay/_base_delay))};
+		const float target {getTargetDelay()};
+
+		float gain {1.f / std::min(16.f, std::ceil(2.f*target/base_delay))};
 		//gain *= 400.f; // from packets to bytes ~
-		gain *= _recently_acked_data/5.f; // from packets to bytes ~
+		gain *= _recently_acked_data * gain_factor; // from packets to bytes ~
 		//gain *= 0.1f;
 
 		if (_recently_lost_data) {
@@ -210,16 +304,16 @@ void LEDBAT::updateWindows(void) {
 		} else {
 			// LEDBAT++ (the Rethinking the LEDBAT Protocol paper)
 			// "Multiplicative decrease"
-			const float constant {2.f}; // spec recs 1
-			if (queuing_delay < target_delay) {
+			const float constant {decrease_constant};
+			if (queuing_delay < target) {
 				_cwnd = std::min(
 					_cwnd + gain,
 					_fwnd
 				);
-			} else if (queuing_delay > target_delay) {
+			} else if (queuing_delay > target) {
 				_cwnd = std::clamp(
 					_cwnd + std::max(
-						gain - constant * _cwnd * (queuing_delay / target_delay - 1.f),
+						gain - constant * _cwnd * (queuing_delay / target - 1.f),
 						-_cwnd/2.f // at most halve
 					),
 
@@ -233,13 +327,15 @@ void LEDBAT::updateWindows(void) {
 		}
 
 		if (PLOTTING) { // plotting
-			std::cerr << std::fixed << "CCA: onAck: TIME: " << now << " cwnd: " << _cwnd << "\n";
-			std::cerr << std::fixed << "CCA: onAck: TIME: " << now << " fwnd: " << _fwnd << "\n";
-			std::cerr << std::fixed << "CCA: onAck: TIME: " << now << " current_delay: " << current_delay << "\n";
-			std::cerr << std::fixed << "CCA: onAck: TIME: " << now << " base_delay: " << _base_delay << "\n";
-			std::cerr << std::fixed << "CCA: onAck: TIME: " << now << " gain: " << gain << "\n";
-			std::cerr << std::fixed << "CCA: onAck: TIME: " << now << " speed: " << (_recently_sent_bytes / (now - _last_cwnd)) / (1024*1024) << "\n";
-			std::cerr << std::fixed << "CCA: onAck: TIME: " << now << " in_flight_bytes: " << _in_flight_bytes << "\n";
+			const float time {toSeconds(now)};
+			std::cerr << std::fixed << "CCA: onAck: TIME: " << time << " cwnd: " << _cwnd << "\n";
+			std::cerr << std::fixed << "CCA: onAck: TIME: " << time << " fwnd: " << _fwnd << "\n";
+			std::cerr << std::fixed << "CCA: onAck: TIME: " << time << " current_delay: " << current_delay << "\n";
+			std::cerr << std::fixed << "CCA: onAck: TIME: " << time << " base_delay: " << base_delay << "\n";
+			std::cerr << std::fixed << "CCA: onAck: TIME: " << time << " target_delay: " << target << "\n";
+			std::cerr << std::fixed << "CCA: onAck: TIME: " << time << " gain: " << gain << "\n";
+			std::cerr << std::fixed << "CCA: onAck: TIME: " << time << " speed: " << (_recently_sent_bytes / toSeconds(now - _last_cwnd)) / (1024*1024) << "\n";
+			std::cerr << std::fixed << "CCA: onAck: TIME: " << time << " in_flight_bytes: " << _in_flight_bytes << "\n";
 		}
 
 		_last_cwnd = now;
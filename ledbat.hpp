@@ -2,6 +2,8 @@
 
 #include <chrono>
 #include <deque>
+#include <functional>
+#include <limits>
 #include <vector>
 #include <cstdint>
 
@@ -11,7 +13,7 @@
 // LEDBAT++ implementation
 struct LEDBAT {
 	public: // config
-		using SeqIDType = std::pair<uint8_t, uint16_t>; // tf_id, seq_id
+		using SeqIDType = std::pair<uint16_t, uint32_t>; // tf_id, seq_id (v1 transfers use 8bit tf_ids and 16bit seq_ids)
 
 		static constexpr size_t IPV4_HEADER_SIZE {20};
 		static constexpr size_t IPV6_HEADER_SIZE {40}; // bru
@@ -34,19 +36,39 @@ struct LEDBAT {
 		//static_assert(maximum_segment_size == 574); // mesured in wireshark
 
 		// ledbat++ says 60ms, we might need other values if relayed
-		//const float target_delay {0.060f};
-		const float target_delay {0.030f};
-		//const float target_delay {0.120f}; // 2x if relayed?
+		//float target_delay {0.060f};
+		float target_delay {0.030f};
+		//float target_delay {0.120f}; // 2x if relayed?
+
+		// the target grows with the jitter of the path, up to this
+		// otherwise noise alone looks like queuing delay and keeps the window at the minimum
+		float target_delay_max {0.300f};
+		float target_delay_jitter_factor {4.f};
 
 		// TODO: use a factor for multiple of rtt
-		static constexpr size_t current_delay_filter_window {16*4};
+		size_t current_delay_filter_window {16*4};
 
 		//static constexpr size_t rtt_buffer_size_max {2000};
 
+		// the base delay is the minimum over the last base_delay_sections sections of base_delay_section_length seconds
+		float base_delay_section_length {30.f};
+		size_t base_delay_sections {20};
+
+		// cwnd gain per cwnd update, as a fraction of the bytes acked since the last update
+		float gain_factor {1.f/5.f};
+
+		// LEDBAT++ multiplicative decrease, spec recs 1
+		float decrease_constant {2.f};
+
 		float max_byterate_allowed {10*1024*1024}; // 10MiB/s
 
+		using clock = std::chrono::steady_clock;
+
+		// where the time comes from, simulations drive it themselves
+		using TimeSource = std::function<clock::time_point(void)>;
+
 	public:
-		LEDBAT(size_t maximum_segment_data_size);
+		LEDBAT(size_t maximum_segment_data_size, TimeSource time_source = clock::now);
 
 		// return the current believed window in bytes of how much data can be inflight,
 		// without overstepping the delay requirement
@@ -62,29 +84,95 @@ struct LEDBAT {
 		// get the list of timed out seq_ids
 		std::vector<SeqIDType> getTimeouts(void) const;
 
+		// moving avg over the last few delay samples
+		// VERY sensitive to bundling acks
+		float getCurrentDelay(void) const;
+
+		// mean difference between consecutive delay samples (rfc3550 interarrival jitter), in seconds
+		// of the one way delay if there are samples, of the rtt otherwise
+		float getJitter(void) const;
+
+		// target_delay, raised by the jitter up to target_delay_max
+		float getTargetDelay(void) const;
+
 	public: // callbacks
 		// data size is without overhead
 		void onSent(SeqIDType seq, size_t data_size);
 
+		// it was queued when onSent was called, but only left now (eg. sent by another thread)
+		// its timeout and delay sample start from now
+		void onDeparted(SeqIDType seq);
+
 		void onAck(std::vector<SeqIDType> seqs);
 
 		// if discard, not resent, not inflight
+		// otherwise it was resent just now, it times out again from now on
 		void onLoss(SeqIDType seq, bool discard);
 
+		// resent without being lost (a probe), it times out again from now on
+		// and its ack is no delay sample
+		void onResend(SeqIDType seq);
+
+		// acked by other means (eg. the peer confirmed it has everything, or rebuilt it from fec parity)
+		// counts as acked, but it is unknown when it arrived, so it is no delay sample
+		void onDelivered(std::vector<SeqIDType> seqs);
+
+		// one way delay sample in microseconds, measured with the clocks of both sides
+		// the clocks are not synchronized, the offset cancels out against the base (minimum) delay
+		// once there are samples, they are used for the queuing delay instead of the rtt,
+		// so queuing on the return path (and delayed acks) do not slow us down
+		void onOneWayDelay(int64_t one_way_delay);
+
 	private:
-		using clock = std::chrono::steady_clock;
+		// timestamps and delays are integer microseconds,
+		// a float of seconds since start gets too coarse for the target delay after about a day
+		using TimeType = int64_t;
 
-		// make values relative to algo start for readability (and precision)
-		// get timestamp in seconds
-		float getTimeNow(void) const {
-			return std::chrono::duration<float>{clock::now() - _time_start_offset}.count();
+		static constexpr TimeType toTime(float seconds) {
+			return TimeType(seconds * 1'000'000.f);
 		}
 
-		// moving avg over the last few delay samples
-		// VERY sensitive to bundling acks
-		float getCurrentDelay(void) const;
+		static constexpr float toSeconds(TimeType time) {
+			return float(time) / 1'000'000.f;
+		}
+
+		// make values relative to algo start for readability
+		TimeType getTimeNow(void) const {
+			return std::chrono::duration_cast<std::chrono::microseconds>(_time_source() - _time_start_offset).count();
+		}
+
+		// a moving average of the recent delays and a base (minimum) delay over a long time
+		struct DelayFilter {
+			// the last window delays, as a ring and their sum
+			std::vector<TimeType> current_delays;
+			size_t current_delays_next {0};
+			TimeType current_delays_sum {0};
+
+			// spec recomends 10min, devided into sections
+			TimeType section_start {-1}; // timepoint of the first delay of the current section
+			TimeType section_minimum {0};
+			std::deque<TimeType> section_minimums;
+
+			TimeType base;
+
+			TimeType jitter {0};
+			TimeType last_delay {0};
+
+			explicit DelayFilter(TimeType initial_base) : base(initial_base) {}
+
+			bool empty(void) const {
+				return current_delays.empty();
+			}
+
+			TimeType current(void) const;
+
+			void add(TimeType now, TimeType new_delay, size_t window, TimeType section_length, size_t sections);
+		};
+
+		// -1 without samples
+		TimeType getCurrentDelayTime(void) const;
 
-		void addRTT(float new_delay);
+		void addRTT(TimeType new_delay);
 
 		void updateWindows(void);
 
@@ -92,9 +180,8 @@ struct LEDBAT {
 		//float _cto {2.f}; // congestion timeout value in seconds
 
 		float _cwnd {2.f * MAXIMUM_SEGMENT_SIZE}; // in bytes
-		float _base_delay {2.f}; // lowest mesured delay in _rtt_buffer in seconds
 
-		float _last_cwnd {0.f}; // timepoint of last cwnd correction
+		TimeType _last_cwnd {0}; // timepoint of last cwnd correction
 		int64_t _recently_acked_data {0}; // reset on _last_cwnd
 		bool _recently_lost_data {false};
 		int64_t _recently_sent_bytes {0};
@@ -105,18 +192,17 @@ struct LEDBAT {
 
 		// ssthresh
 
-		// spec recomends 10min
-		// TODO: optimize and devide into spans of 1min (spec recom)
-		std::deque<float> _tmp_rtt_buffer;
-		std::deque<std::pair<float, float>> _rtt_buffer; // timepoint, delay
-		std::deque<float> _rtt_buffer_minutes;
+		DelayFilter _rtt {toTime(2.f)};
+		DelayFilter _one_way_delay {std::numeric_limits<TimeType>::max()}; // arbitrary offset
 
-		// list of sequence ids and timestamps of when they where sent
-		std::deque<std::tuple<SeqIDType, float, size_t>> _in_flight;
+		// list of sequence ids and timestamps of when they where sent, their size and if they were resent
+		// the ack of a resent segment might be for either send, so it is no delay sample (karn)
+		std::deque<std::tuple<SeqIDType, TimeType, size_t, bool>> _in_flight;
 
 		int64_t _in_flight_bytes {0};
 
 	private: // helper
+		TimeSource _time_source;
 		clock::time_point _time_start_offset;
 };
 
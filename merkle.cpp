@@ -0,0 +1,111 @@
+#include "./merkle.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+static constexpr size_t _DIGEST_SIZE {SHA256::DIGEST_SIZE};
+
+MerkleRootBuilder::MerkleRootBuilder(void) {
+	_batch.reserve(BATCH_LEAVES*_DIGEST_SIZE);
+	_zero_hashes.push_back({}); // leaf padding is all zeros
+}
+
+void MerkleRootBuilder::update(const uint8_t* data, size_t data_size) {
+	while (data_size > 0) {
+		if (_partial_size > 0 || data_size < _DIGEST_SIZE) {
+			const size_t fill = std::min(data_size, _DIGEST_SIZE - _partial_size);
+			std::copy(data, data + fill, _partial.begin() + _partial_size);
+			_partial_size += fill;
+			data += fill;
+			data_size -= fill;
+
+			if (_partial_size == _DIGEST_SIZE) {
+				_batch.insert(_batch.end(), _partial.cbegin(), _partial.cend());
+				_partial_size = 0;
+				_leaf_count++;
+			}
+		} else {
+			// whole leaves directly from the input
+			const size_t leaves = std::min(data_size / _DIGEST_SIZE, BATCH_LEAVES - _batch.size()/_DIGEST_SIZE);
+			_batch.insert(_batch.end(), data, data + leaves*_DIGEST_SIZE);
+			data += leaves*_DIGEST_SIZE;
+			data_size -= leaves*_DIGEST_SIZE;
+			_leaf_count += leaves;
+		}
+
+		if (_batch.size() == BATCH_LEAVES*_DIGEST_SIZE) {
+			flushBatch();
+		}
+	}
+}
+
+bool MerkleRootBuilder::finish(Digest& root_out) {
+	if (_partial_size != 0 || _leaf_count == 0) {
+		return false;
+	}
+
+	// the remaining leaves do not form a full batch, push them one by one
+	for (size_t i = 0; i < _batch.size(); i += _DIGEST_SIZE) {
+		Digest leaf;
+		std::copy(_batch.cbegin() + i, _batch.cbegin() + i + _DIGEST_SIZE, leaf.begin());
+		pushSubtree(0, leaf);
+	}
+	_batch.clear();
+
+	// pad the right edge up to a single tree
+	while (_stack.size() > 1 || (size_t(1) << _stack.back().first) < _leaf_count) {
+		const auto [level, hash] = _stack.back();
+		_stack.pop_back();
+		pushSubtree(level+1, combine(hash, zeroHash(level)));
+	}
+
+	root_out = _stack.back().second;
+	return true;
+}
+
+void MerkleRootBuilder::pushSubtree(size_t level, const Digest& hash) {
+	Digest current = hash;
+	while (!_stack.empty() && _stack.back().first == level) {
+		current = combine(_stack.back().second, current);
+		_stack.pop_back();
+		level++;
+	}
+	_stack.push_back({level, current});
+}
+
+void MerkleRootBuilder::flushBatch(void) {
+	// BATCH_LEAVES is a power of 2 and batches start at multiples of it, so this is a full subtree
+	static_assert((BATCH_LEAVES & (BATCH_LEAVES-1)) == 0);
+
+	std::vector<uint8_t> next(_batch.size()/2);
+	size_t level = 0;
+	while (_batch.size() > _DIGEST_SIZE) {
+		// adjacent pairs are exactly the 64 byte messages
+		const size_t count = _batch.size() / (2*_DIGEST_SIZE);
+		next.resize(count*_DIGEST_SIZE);
+		SHA256::hashMany(_batch.data(), 2*_DIGEST_SIZE, count, next.data());
+		_batch.swap(next);
+		level++;
+	}
+
+	Digest root;
+	std::copy(_batch.cbegin(), _batch.cend(), root.begin());
+	_batch.clear();
+
+	pushSubtree(level, root);
+}
+
+MerkleRootBuilder::Digest MerkleRootBuilder::combine(const Digest& left, const Digest& right) {
+	SHA256 sha256;
+	sha256.update(left.data(), left.size());
+	sha256.update(right.data(), right.size());
+	return sha256.finish();
+}
+
+const MerkleRootBuilder::Digest& MerkleRootBuilder::zeroHash(size_t level) {
+	while (_zero_hashes.size() <= level) {
+		_zero_hashes.push_back(combine(_zero_hashes.back(), _zero_hashes.back()));
+	}
+	return _zero_hashes.at(level);
+}
+
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "./sha256.hpp"
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+// bittorrent v2 (bep 52) merkle root over sha256 leaf hashes
+// leaves are the hashes of the 16KiB blocks of a file, the last block might be shorter
+// the leaf layer is padded with zero hashes to the next power of 2
+// interior nodes are sha256(left | right)
+//
+// leaf hashes can be fed in pieces of any size (as they come out of recv_data)
+// memory is O(log n), only the left edges of the completed subtrees are kept
+struct MerkleRootBuilder {
+	public:
+		using Digest = SHA256::Digest;
+		static constexpr size_t LEAF_SIZE {16*1024};
+
+		// full subtrees of BATCH_LEAVES leaves are reduced layer by layer with SHA256::hashMany()
+		static constexpr size_t BATCH_LEAVES {64};
+
+	public:
+		MerkleRootBuilder(void);
+
+		// leaf hashes, back to back
+		void update(const uint8_t* data, size_t data_size);
+
+		size_t leafCount(void) const { return _leaf_count; }
+
+		// false if no leaves or a partial leaf hash was fed
+		bool finish(Digest& root_out);
+
+	private:
+		void pushSubtree(size_t level, const Digest& hash);
+		void flushBatch(void);
+
+		static Digest combine(const Digest& left, const Digest& right);
+
+		// hash of a subtree of only padding
+		const Digest& zeroHash(size_t level);
+
+	private:
+		// (level, hash) of completed subtrees, levels strictly decreasing
+		std::vector<std::pair<size_t, Digest>> _stack;
+
+		// leaves not yet part of a subtree on the stack
+		std::vector<uint8_t> _batch;
+
+		// a leaf hash split over 2 update() calls
+		Digest _partial;
+		size_t _partial_size {0};
+
+		size_t _leaf_count {0};
+
+		std::vector<Digest> _zero_hashes;
+};
+
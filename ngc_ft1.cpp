@@ -3,124 +3,165 @@
 #include "ngc_ext.hpp"
 
 #include "./ledbat.hpp"
+#include "./sha256.hpp"
+#include "./merkle.hpp"
+#include "./chunk_cache.hpp"
+#include "./segment_compression.hpp"
+#include "./recv_queue.hpp"
+#include "./send_read_queue.hpp"
+#include "./spsc_ring.hpp"
+#include "./sequence_buffer.hpp"
 
 #include <algorithm>
 #include <vector>
-#include <array>
 #include <deque>
 // TODO: should i really use both?
 #include <unordered_map>
 #include <map>
 #include <set>
-#include <optional>
+#include <variant>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+#include <thread>
 #include <cassert>
 #include <cstdio>
 #include <iostream>
 
-struct SendSequenceBuffer {
-	struct SSBEntry {
-		std::vector<uint8_t> data; // the data (variable size, but smaller than 500)
-		float time_since_activity {0.f};
-	};
-
-	// sequence_id -> entry
-	std::map<uint16_t, SSBEntry> entries;
-
-	uint16_t next_seq_id {0};
-
-	void erase(uint16_t seq) {
-		entries.erase(seq);
-	}
-
-	// inflight chunks
-	size_t size(void) const {
-		return entries.size();
-	}
+// forward error correction, one xor parity segment per group of data segments (v2 only)
+static constexpr float _FEC_INITIAL_GROUP_SIZE {16.f};
+static constexpr float _FEC_MIN_GROUP_SIZE {4.f};
+static constexpr float _FEC_MAX_GROUP_SIZE {64.f}; // no parity
+static constexpr float _FEC_TARGET_LOSS {0.002f}; // losses fec did not repair, the group size converges to this
+static constexpr size_t _FEC_HEADER_SIZE {1 + 2 + 4 + 1 + 2}; // FT1_FEC without the parity
+static constexpr size_t _FEC_MAX_SEGMENTS_KEPT {4 * size_t(_FEC_MAX_GROUP_SIZE)}; // by the receiver
+static constexpr float _FEC_MAX_GROUP_AGE {0.5f}; // in current delays, segments time out after 2
 
-	uint16_t add(std::vector<uint8_t>&& data) {
-		entries[next_seq_id] = {data, 0.f};
-		return next_seq_id++;
-	}
+// FINISHING transfers resend their last segment after this many current delays without an ack,
+// doubled with each probe
+static constexpr float _TAIL_PROBE_DELAYS {1.5f};
+static constexpr size_t _TAIL_PROBE_MAX_BACKOFF {4}; // doublings
 
-	template<typename FN>
-	void for_each(float time_delta, FN&& fn) {
-		for (auto& [id, entry] : entries) {
-			entry.time_since_activity += time_delta;
-			fn(id, entry.data, entry.time_since_activity);
-		}
-	}
-};
+// threaded mode
+static constexpr size_t _ENGINE_RING_SIZE {8192}; // packets, each way
+static constexpr std::chrono::milliseconds _ENGINE_INTERVAL {1}; // the engine iterates at least this often
+static constexpr float _ENGINE_REBALANCE_INTERVAL {1.f}; // seconds, at most one peer is moved
+static constexpr size_t _ENGINE_REBALANCE_MIN_LOAD {256}; // packets difference between shards, before moving a peer
 
-struct RecvSequenceBuffer {
-	struct RSBEntry {
-		std::vector<uint8_t> data;
-	};
+using _handle_pkg_fn = void(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
 
-	// sequence_id -> entry
-	std::map<uint16_t, RSBEntry> entries;
+struct NGC_FT1 {
+	NGC_FT1_options options;
 
-	uint16_t next_seq_id {0};
+	std::unordered_map<uint32_t, NGC_FT1_recv_request_cb*> cb_recv_request;
+	std::unordered_map<uint32_t, NGC_FT1_recv_request_batch_cb*> cb_recv_request_batch;
+	std::unordered_map<uint32_t, NGC_FT1_recv_init_cb*> cb_recv_init;
+	std::unordered_map<uint32_t, NGC_FT1_recv_data_cb*> cb_recv_data;
+	std::unordered_map<uint32_t, NGC_FT1_send_data_cb*> cb_send_data;
+	std::unordered_map<uint32_t, NGC_FT1_recv_done_cb*> cb_recv_done;
+	std::unordered_map<uint32_t, NGC_FT1_send_done_cb*> cb_send_done;
+	std::unordered_map<uint32_t, void*> ud_recv_request;
+	std::unordered_map<uint32_t, void*> ud_recv_request_batch;
+	std::unordered_map<uint32_t, void*> ud_recv_init;
+	std::unordered_map<uint32_t, void*> ud_recv_data;
+	std::unordered_map<uint32_t, void*> ud_send_data;
+	std::unordered_map<uint32_t, void*> ud_recv_done;
+	std::unordered_map<uint32_t, void*> ud_send_done;
 
-	// list of seq_ids to ack, this is seperate bc rsbentries are deleted once processed
-	std::deque<uint16_t> ack_seq_ids;
+	ChunkCache cache;
+	mutable std::mutex cache_mutex; // shards use it concurrently
+	std::set<uint32_t> cache_file_kinds;
 
-	void erase(uint16_t seq) {
-		entries.erase(seq);
+	bool cacheEnabled(uint32_t file_kind) const {
+		return cache.enabled() && cache_file_kinds.count(file_kind);
 	}
 
-	// inflight chunks
-	size_t size(void) const {
-		return entries.size();
+	ChunkCache::Data cacheGet(const ChunkCache::Key& key) {
+		std::lock_guard lock(cache_mutex);
+		return cache.get(key);
 	}
 
-	void add(uint16_t seq_id, std::vector<uint8_t>&& data) {
-		entries[seq_id] = {data};
-		ack_seq_ids.push_back(seq_id);
-		if (ack_seq_ids.size() > 3) { // TODO: magic
-			ack_seq_ids.pop_front();
-		}
+	void cachePut(ChunkCache::Key&& key, std::vector<uint8_t>&& data) {
+		std::lock_guard lock(cache_mutex);
+		cache.put(std::move(key), std::move(data));
 	}
 
-	bool canPop(void) const {
-		return entries.count(next_seq_id);
+	// data of these kinds goes into the recv_queue instead of recv_data
+	RecvQueue recv_queue;
+	std::set<uint32_t> recv_async_file_kinds;
+
+	bool recvAsync(uint32_t file_kind) const {
+		return recv_async_file_kinds.count(file_kind);
 	}
 
-	std::vector<uint8_t> pop(void) {
-		assert(canPop());
-		auto tmp_data = entries.at(next_seq_id).data;
-		erase(next_seq_id);
-		next_seq_id++;
-		return tmp_data;
+	// data of these kinds is read ahead by app threads instead of send_data
+	SendReadQueue send_read_queue;
+	std::set<uint32_t> send_async_file_kinds;
+
+	bool sendAsync(uint32_t file_kind) const {
+		return send_async_file_kinds.count(file_kind);
 	}
 
-	// for acking, might be bad since its front
-	std::vector<uint16_t> frontSeqIDs(size_t count = 5) const {
-		std::vector<uint16_t> seq_ids;
-		auto it = entries.cbegin();
-		for (size_t i = 0; i < 5 && it != entries.cend(); i++, it++) {
-			seq_ids.push_back(it->first);
-		}
+	// in flight segments of these kinds are read again with send_data when resent, instead of being kept
+	std::set<uint32_t> send_reread_file_kinds;
 
-		return seq_ids;
+	bool sendReread(uint32_t file_kind) const {
+		return send_reread_file_kinds.count(file_kind);
 	}
-};
 
-struct NGC_FT1 {
-	NGC_FT1_options options;
+	// threaded mode, the tox thread only moves packets, everything else happens on the engine threads
+	struct EnginePacket {
+		uint8_t pkg_id {0}; // incoming
+		uint32_t group_number {0};
+		uint32_t peer_number {0};
+		bool lossless {false}; // outgoing
+		std::vector<uint8_t> data;
+	};
+	// user_data of the ngc_ext callbacks, so a single callback can queue every packet type
+	struct EngineHandler {
+		NGC_FT1* ngc_ft1_ctx {nullptr};
+		uint8_t pkg_id {0};
+		_handle_pkg_fn* fn {nullptr};
+	};
+	std::array<EngineHandler, 256> engine_handlers;
 
-	std::unordered_map<uint32_t, NGC_FT1_recv_request_cb*> cb_recv_request;
-	std::unordered_map<uint32_t, NGC_FT1_recv_init_cb*> cb_recv_init;
-	std::unordered_map<uint32_t, NGC_FT1_recv_data_cb*> cb_recv_data;
-	std::unordered_map<uint32_t, NGC_FT1_send_data_cb*> cb_send_data;
-	std::unordered_map<uint32_t, void*> ud_recv_request;
-	std::unordered_map<uint32_t, void*> ud_recv_init;
-	std::unordered_map<uint32_t, void*> ud_recv_data;
-	std::unordered_map<uint32_t, void*> ud_send_data;
+	std::atomic<Tox*> engine_tox {nullptr};
+	std::atomic<bool> engine_stop {false};
+
+	bool compressionOffered(void) const {
+		return options.compression_level != 0 && SegmentCompressor::available();
+	}
 
 	struct Group {
 		struct Peer {
 			LEDBAT cca{500-4}; // TODO: replace with tox_group_max_custom_lossy_packet_length()-4
 
+			// v2 packets (FT1_INIT2 ...) use 16bit transfer ids and 32bit sequence ids
+			// we dont know if the peer understands them, until it sends us one
+			enum class V2Support {
+				UNKNOWN, // try v2, fall back to v1 on init timeout
+				YES,
+				NO, // an init2 timed out, back to UNKNOWN after _V2_RETRY_INTERVAL
+			} v2_support {V2Support::UNKNOWN};
+			// a silent reject or a lost init2 look the same as a v1 peer, so NO is not final
+			float time_since_v2_fallback {0.f};
+
+			// data segments per FT1_FEC parity segment, shrinks on loss and grows while there is none
+			// at _FEC_MAX_GROUP_SIZE no parity is sent
+			float fec_group_size {_FEC_INITIAL_GROUP_SIZE};
+
+			// connected over a tcp relay, updated every _CONNECTION_CHECK_INTERVAL by the tox thread
+			bool relayed {false};
+
+			// first one way delay measured to the peer, the samples are made relative to it,
+			// so they do not wrap around with the timestamps
+			bool one_way_delay_reference_set {false};
+			uint32_t one_way_delay_reference {0};
+
 			struct RecvTransfer {
 				uint32_t file_kind;
 				std::vector<uint8_t> file_id;
@@ -128,17 +169,57 @@ struct NGC_FT1 {
 				enum class State {
 					INITED, //init acked, but no data received yet (might be dropped)
 					RECV, // receiving data
+					DONE, // all data received, kept around to ack resends
 				} state;
 
-				// float time_since_last_activity ?
+				float time_since_activity {0.f};
 				size_t file_size {0};
 				size_t file_size_current {0};
 
+				bool v2 {false};
+
+				// negotiated in the init2, every segment carries a SegmentCompressor marker
+				bool compressed {false};
+
+				// negotiated in the init2, acks carry rsb.window()
+				bool advertise_window {false};
+				size_t advertised_window {0}; // in the last ack, a reopened window is announced
+				// the announcement might be lost and the sender waits for it, so it is repeated until data arrives
+				// negative if none is pending
+				float time_since_window_update {-1.f};
+
+				// negotiated in the init2, recent segments are kept to rebuild a lost one from FT1_FEC
+				bool fec {false};
+				std::map<uint32_t, std::vector<uint8_t>> fec_segments;
+				// seq_ids rebuilt from parity, they are acked separately, the sender did not see them arrive
+				std::set<uint32_t> fec_rebuilt;
+
+				// negotiated in the init2, FT1_DONE is sent once all data is received
+				bool confirm_done {false};
+
+				// negotiated in the init2, the timestamp of the newest segment and when it arrived go into the next ack
+				bool one_way_delay {false};
+				uint32_t timestamp_sent {0};
+				uint32_t timestamp_arrived {0}; // 0 if there is no new segment
+
 				// sequence id based reassembly
 				RecvSequenceBuffer rsb;
+
+				// content addressed file kinds are hashed while the data is popped in order
+				// TORRENT_V2_PIECE -> SHA256, TORRENT_V2_FILE_HASHES -> MerkleRootBuilder
+				std::variant<std::monostate, SHA256, MerkleRootBuilder> verifier;
+
+				// collects the data for the cache, if the file_kind is cached and verifiable
+				std::vector<uint8_t> cache_fill;
+				bool cache_filling {false};
+
+				// seq_ids to ack in the next FT1_FRAME flush
+				// the previous flush is repeated once, so a lost frame does not cause resends
+				std::vector<uint32_t> frame_acks;
+				std::vector<uint32_t> frame_acks_prev;
 			};
-			std::array<std::optional<RecvTransfer>, 256> recv_transfers;
-			size_t next_recv_transfer_idx {0}; // next id will be 0
+			// transfer_id -> transfer, only allocated while in use
+			std::map<uint16_t, RecvTransfer> recv_transfers;
 
 			struct SendTransfer {
 				uint32_t file_kind;
@@ -160,24 +241,265 @@ struct NGC_FT1 {
 				size_t file_size {0};
 				size_t file_size_current {0};
 
+				bool v2 {false};
+
+				bool compression_offered {false}; // in the init2
+				bool compressed {false}; // accepted by the peer
+				float compression_ratio {2.f}; // estimate, sizes the next block read from the app
+				size_t compression_skip {0}; // segments to send raw, the data did not compress
+
+				// negotiated in the init2, the unacked data is kept below what the receiver advertised
+				size_t recv_window {SIZE_MAX};
+
+				bool one_way_delay_offered {false}; // in the init2
+				bool one_way_delay {false}; // accepted by the peer, segments carry a timestamp
+
+				// FINISHING, the last segment is resent if the acks stop coming
+				float time_since_tail_probe {0.f}; // or the last ack
+				size_t tail_probes {0}; // since the last ack
+
+				bool fec_offered {false}; // in the init2
+				bool fec {false}; // accepted by the peer
+				// parity of the current group, xor of all segments (zero padded) and their sizes
+				uint32_t fec_first_seq_id {0};
+				size_t fec_count {0};
+				uint16_t fec_size_xor {0};
+				std::vector<uint8_t> fec_parity;
+				float fec_time_since_first {0.f}; // a group is cut short, so the parity arrives before the timeout
+				// timed out at least once, each loss is only counted once
+				std::set<uint32_t> fec_lost_seq_ids;
+
 				// sequence array
 				// list of sent but not acked seq_ids
 				SendSequenceBuffer ssb;
+
+				// served from the cache instead of send_data
+				ChunkCache::Data cache_data;
+
+				// the ssb only keeps the file ranges, resends read the data again (from the cache or send_data)
+				bool reread {false};
+
+				// read ahead by app threads instead of send_data, only what is ready gets sent
+				bool read_async {false};
+				size_t read_ahead_offset {0}; // file offset of read_ahead[0]
+				std::vector<uint8_t> read_ahead; // ready, in order
+				size_t read_ahead_requested {0}; // reads are requested up to this file offset
+				std::set<uint64_t> read_ahead_pending; // ids of outstanding reads
+				std::map<size_t, std::vector<uint8_t>> read_ahead_done; // completed out of order, by file offset
+
+				// collects what send_data returned, if the file_kind is cached
+				std::vector<uint8_t> cache_fill;
+				bool cache_filling {false};
 			};
-			std::array<std::optional<SendTransfer>, 256> send_transfers;
+			// transfer_id -> transfer, only allocated while in use
+			// v1 peers only understand ids < 256
+			std::map<uint16_t, SendTransfer> send_transfers;
 			size_t next_send_transfer_idx {0}; // next id will be 0
+
+			// transfer_id -> seconds since its send transfer was deleted
+			// the peer might still have a recv transfer with that id, which would take (and ack) optimistic data of a new one
+			std::map<uint16_t, float> send_transfer_ids_released;
+
+			// FT1_DATA2 for transfers we dont know (yet), the init might still be on its way
+			struct EarlyData {
+				uint16_t transfer_id;
+				uint32_t sequence_id;
+				std::vector<uint8_t> pkg;
+				float time_since_recv {0.f};
+			};
+			std::deque<EarlyData> early_data;
+
+			// v2 peers get small data and acks packed into FT1_FRAMEs, flushed at the end of iterate
+			std::vector<std::vector<uint8_t>> frame_records; // complete records
+			std::set<uint16_t> frame_ack_transfers; // recv transfers with new frame_acks
 		};
 		std::map<uint32_t, Peer> peers;
 	};
-	std::map<uint32_t, Group> groups;
+
+	// the peers are spread over the shards, each with its own engine thread in threaded mode
+	// there is a single shard otherwise
+	struct Shard {
+		std::map<uint32_t, Group> groups;
+
+		SegmentCompressor compressor;
+
+		// held by the engine thread while it works and by the public api
+		std::recursive_mutex engine_mutex;
+		SPSCRing<EnginePacket> engine_in {_ENGINE_RING_SIZE}; // tox thread -> engine thread
+		SPSCRing<EnginePacket> engine_out {_ENGINE_RING_SIZE}; // engine thread (or api callers) -> tox thread, pushed holding the engine_mutex
+		std::mutex engine_wake_mutex;
+		std::condition_variable engine_wake;
+		std::thread engine_thread;
+
+		// packets received per peer, since the last rebalance
+		std::map<std::pair<uint32_t, uint32_t>, size_t> engine_load;
+	};
+	std::vector<std::unique_ptr<Shard>> shards;
+
+	// peers moved away from their hashed shard, by the tox thread
+	mutable std::shared_mutex shard_routes_mutex;
+	std::map<std::pair<uint32_t, uint32_t>, size_t> shard_routes;
+	float time_since_rebalance {0.f};
+
+	float time_since_connection_check {0.f};
+
+	size_t shardIndexOf(uint32_t group_number, uint32_t peer_number) const {
+		if (shards.size() == 1) {
+			return 0;
+		}
+
+		{
+			std::shared_lock lock(shard_routes_mutex);
+			const auto it = shard_routes.find({group_number, peer_number});
+			if (it != shard_routes.end()) {
+				return it->second;
+			}
+		}
+
+		return (size_t(group_number) * 0x9e3779b1u + peer_number) % shards.size();
+	}
+
+	Shard& shardOf(uint32_t group_number, uint32_t peer_number) {
+		return *shards[shardIndexOf(group_number, peer_number)];
+	}
+
+	// locks the shard the peer belongs to, if threaded
+	// fails if called from a callback of another shard, that could deadlock
+	bool engineLock(uint32_t group_number, uint32_t peer_number, std::unique_lock<std::recursive_mutex>& lock_out);
+
+	// locks all shards, for changes to the callbacks and settings
+	// fails if called from a callback, while there is more than one shard
+	bool engineLockAll(std::vector<std::unique_lock<std::recursive_mutex>>& locks_out);
 };
 
+// the shard of the engine thread we are on, if any
+static thread_local const NGC_FT1::Shard* _engine_shard {nullptr};
+
+bool NGC_FT1::engineLock(uint32_t group_number, uint32_t peer_number, std::unique_lock<std::recursive_mutex>& lock_out) {
+	if (!options.threaded) {
+		return true;
+	}
+
+	for (;;) {
+		Shard& shard = shardOf(group_number, peer_number);
+		if (_engine_shard != nullptr && _engine_shard != &shard) {
+			fprintf(stderr, "FT: error, callbacks can only call for peers of the same engine shard\n");
+			return false;
+		}
+
+		lock_out = std::unique_lock{shard.engine_mutex};
+
+		// peers are only moved holding the lock of their shard
+		if (&shardOf(group_number, peer_number) == &shard) {
+			return true;
+		}
+		lock_out.unlock();
+	}
+}
+
+bool NGC_FT1::engineLockAll(std::vector<std::unique_lock<std::recursive_mutex>>& locks_out) {
+	if (!options.threaded) {
+		return true;
+	}
+
+	if (_engine_shard != nullptr && shards.size() > 1) {
+		fprintf(stderr, "FT: error, cant change settings from callbacks with more than one engine shard\n");
+		return false;
+	}
+
+	// always in the same order
+	for (auto& shard : shards) {
+		locks_out.emplace_back(shard->engine_mutex);
+	}
+	return true;
+}
+
+// seconds a peer gets v1 inits after an init2 timed out, before v2 is tried again
+static constexpr float _V2_RETRY_INTERVAL {120.f};
+
+// optimistic data before the init_ack (v2 only)
+static constexpr size_t _EARLY_DATA_MAX_SEGMENTS {16}; // sent per transfer
+static constexpr uint32_t _EARLY_DATA_MAX_SEQ_ID {2 * _EARLY_DATA_MAX_SEGMENTS}; // by the receiver, segments can be a bit smaller than the maximum
+static constexpr size_t _EARLY_DATA_MAX_PACKETS {64}; // buffered per peer
+static constexpr float _EARLY_DATA_TIMEOUT {2.f};
+static constexpr float _EARLY_DATA_RELEASED_ID_MARGIN {5.f}; // on top of sending_give_up_after, for packets of the old transfer still underway
+
+// FT1_INIT2 / FT1_INIT_ACK2 feature flags
+static constexpr uint8_t _INIT2_FLAG_COMPRESSION {1u << 0}; // segments compressed with SegmentCompressor
+static constexpr uint8_t _INIT2_FLAG_FEC {1u << 1}; // FT1_FEC parity segments
+static constexpr uint8_t _INIT2_FLAG_RECV_WINDOW {1u << 2}; // FT1_DATA_ACK2 carries the receive window
+static constexpr uint8_t _INIT2_FLAG_ONE_WAY_DELAY {1u << 3}; // FT1_DATA2 carries a timestamp, FT1_DATA_ACK2 echoes it with the time it arrived
+static constexpr uint8_t _INIT2_FLAG_DONE {1u << 4}; // the receiver sends FT1_DONE once it has all data
+
+// FT1_DATA_ACK2 only flags, next to the init2 flags of what follows
+static constexpr uint8_t _DATA_ACK2_FLAG_REBUILT {1u << 7}; // the seq_ids were rebuilt from FT1_FEC parity, no delay sample
+
+// one way delay timestamps, microseconds that wrap around after about 71 minutes
+// only differences between them are used, the clocks of the peers are not synchronized
+// 0 is never a timestamp, it means "no sample"
+static uint32_t _timestamp_now(void) {
+	const uint32_t now = uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	return now == 0 ? 1 : now;
+}
+
+static constexpr size_t _RECV_WINDOW_SIZE_DEFAULT {256*1024};
+static constexpr float _RECV_WINDOW_UPDATE_REPEAT {0.5f}; // seconds between repeats of a reopened window
+static constexpr size_t _RECV_QUEUE_SIZE_DEFAULT {4*1024*1024};
+
+// congestion control target delay per peer
+static constexpr float _TARGET_DELAY_MIN_DEFAULT {0.030f};
+static constexpr float _TARGET_DELAY_MAX_DEFAULT {0.300f};
+static constexpr float _TARGET_DELAY_RELAYED_FACTOR {4.f}; // tcp relays add delay and jitter of their own
+static constexpr float _CONNECTION_CHECK_INTERVAL {2.f}; // seconds between connection type queries
+
+// async send_data
+static constexpr size_t _SEND_READ_AHEAD_SIZE_DEFAULT {256*1024};
+static constexpr size_t _SEND_READ_BLOCK_SIZE {16*1024}; // bytes per read
+
+// compressed transfers
+static constexpr size_t _COMPRESSION_SKIP_SEGMENTS {64}; // raw segments sent before trying again
+static constexpr size_t _COMPRESSION_MAX_TRIES {4}; // per segment
+static constexpr float _COMPRESSION_MAX_RATIO {32.f};
+
+// FT1_FRAME packs small FT1_DATA2 and FT1_DATA_ACK2 into one lossy packet
+// record: 1 byte packet id + 2 byte size + the packet without packet id
+static constexpr size_t _FRAME_RECORD_HEADER_SIZE {1 + 2};
+static constexpr size_t _FRAME_MAX_RECORDS_SIZE {TOX_GROUP_MAX_CUSTOM_LOSSY_PACKET_LENGTH - 1};
+static constexpr size_t _FRAME_MAX_ACKS_PER_TRANSFER {1024}; // acks are coalesced between flushes, only a memory bound
+
+// packet id + file_kind + file_id_size
+static constexpr size_t _REQUEST_BATCH_MAX_IDS_SIZE {TOX_GROUP_MAX_CUSTOM_LOSSLESS_PACKET_LENGTH - 1 - 4 - 1};
+// packet id + file_kind + file_id_size, file_id and data share the rest
+static constexpr size_t _INIT_DATA_MAX_PAYLOAD_SIZE {TOX_GROUP_MAX_CUSTOM_LOSSLESS_PACKET_LENGTH - 1 - 4 - 1};
+
 // send pkgs
-static bool _send_pkg_FT1_REQUEST(const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, const uint8_t* file_id, size_t file_id_size);
-static bool _send_pkg_FT1_INIT(const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, uint64_t file_size, uint8_t transfer_id, const uint8_t* file_id, size_t file_id_size);
-static bool _send_pkg_FT1_INIT_ACK(const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id);
-static bool _send_pkg_FT1_DATA(const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id, uint16_t sequence_id, const uint8_t* data, size_t data_size);
-static bool _send_pkg_FT1_DATA_ACK(const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id, const uint16_t* seq_ids, size_t seq_ids_size);
+// all packets leave through here
+static bool _send_pkg(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, bool lossless, std::vector<uint8_t>&& pkg);
+static bool _send_pkg_FT1_REQUEST(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, const uint8_t* file_id, size_t file_id_size);
+static bool _send_pkg_FT1_INIT(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, uint64_t file_size, uint8_t transfer_id, const uint8_t* file_id, size_t file_id_size);
+static bool _send_pkg_FT1_INIT_ACK(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id);
+static bool _send_pkg_FT1_DATA(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id, uint16_t sequence_id, const uint8_t* data, size_t data_size);
+static bool _send_pkg_FT1_DATA_ACK(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id, const uint32_t* seq_ids, size_t seq_ids_size);
+static bool _send_pkg_FT1_INIT2(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, uint64_t file_size, uint16_t transfer_id, uint8_t flags, const uint8_t* file_id, size_t file_id_size);
+static bool _send_pkg_FT1_INIT_ACK2(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id, uint8_t flags);
+static bool _send_pkg_FT1_DATA2(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id, uint32_t sequence_id, bool has_timestamp, uint32_t timestamp, const uint8_t* data, size_t data_size);
+static bool _send_pkg_FT1_DATA_ACK2(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id, bool has_window, size_t window, bool has_timestamps, uint32_t timestamp_sent, uint32_t timestamp_arrived, const uint32_t* seq_ids, size_t seq_ids_size);
+static bool _send_pkg_FT1_REQUEST_BATCH(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, const uint8_t* file_ids, size_t file_id_size, size_t count);
+static bool _send_pkg_FT1_INIT_DATA(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, const uint8_t* file_id, size_t file_id_size, const uint8_t* data, size_t data_size);
+static bool _send_pkg_FT1_FEC(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id, uint32_t first_seq_id, uint8_t count, uint16_t size_xor, const uint8_t* parity, size_t parity_size);
+static bool _send_pkg_FT1_DONE(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id);
+
+// picks v1 or v2 depending on what the transfer negotiated
+static bool _send_transfer_data(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, NGC_FT1::Group::Peer& peer, uint16_t transfer_id, bool v2, bool timestamp, uint32_t sequence_id, const uint8_t* data, size_t data_size);
+
+// sends the queued frame records and pending acks of a peer
+static void _flush_frames(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, NGC_FT1::Group::Peer& peer);
+
+// tells the app a send transfer ended, after it was deleted
+static void _send_transfer_done(Tox* tox, NGC_FT1* ngc_ft1_ctx, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id, uint32_t file_kind, bool complete);
+
+// hands the in order data of a recv transfer to the app
+static void _recv_transfer_pop(Tox* tox, NGC_FT1* ngc_ft1_ctx, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id, NGC_FT1::Group::Peer::RecvTransfer& transfer);
 
 // handle pkgs
 static void _handle_FT1_REQUEST(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
@@ -185,529 +507,2966 @@ static void _handle_FT1_INIT(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_
 static void _handle_FT1_INIT_ACK(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
 static void _handle_FT1_DATA(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
 static void _handle_FT1_DATA_ACK(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
+static void _handle_FT1_INIT2(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
+static void _handle_FT1_INIT_ACK2(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
+static void _handle_FT1_DATA2(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
+static void _handle_FT1_DATA_ACK2(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
+static void _handle_FT1_REQUEST_BATCH(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
+static void _handle_FT1_INIT_DATA(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
+static void _handle_FT1_FRAME(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
+static void _handle_FT1_FEC(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
+static void _handle_FT1_DONE(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
+
+// threaded mode
+static void _handle_FT1_threaded(Tox* tox, NGC_EXT_CTX* ngc_ext_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, void* user_data);
+static void _engine_run(NGC_FT1* ngc_ft1_ctx, NGC_FT1::Shard* shard);
+static void _engine_out_departed(NGC_FT1::Shard& shard, NGC_FT1::EnginePacket& pkg);
+static void _engine_rebalance(Tox* tox, NGC_FT1* ngc_ft1_ctx);
+static void _check_connections(const Tox* tox, NGC_FT1* ngc_ft1_ctx);
+static void _iterate(Tox *tox, NGC_FT1* ngc_ft1_ctx, NGC_FT1::Shard& shard, float time_delta);
 
 NGC_FT1* NGC_FT1_new(const struct NGC_FT1_options* options) {
 	NGC_FT1* ngc_ft1_ctx = new NGC_FT1;
 	ngc_ft1_ctx->options = *options;
+	ngc_ft1_ctx->cache = ChunkCache{options->chunk_cache_size};
+	ngc_ft1_ctx->recv_queue.setCapacity(options->recv_queue_size > 0 ? options->recv_queue_size : _RECV_QUEUE_SIZE_DEFAULT);
+
+	const size_t shard_count = options->threaded ? std::max<size_t>(options->engine_threads, 1) : 1;
+	for (size_t i = 0; i < shard_count; i++) {
+		ngc_ft1_ctx->shards.push_back(std::make_unique<NGC_FT1::Shard>());
+	}
+
+	if (options->threaded) {
+		for (auto& shard : ngc_ft1_ctx->shards) {
+			shard->engine_thread = std::thread(_engine_run, ngc_ft1_ctx, shard.get());
+		}
+	}
+
 	return ngc_ft1_ctx;
 }
 
 bool NGC_FT1_register_ext(NGC_FT1* ngc_ft1_ctx, NGC_EXT_CTX* ngc_ext_ctx) {
-	ngc_ext_ctx->callbacks[NGC_EXT::FT1_REQUEST] = _handle_FT1_REQUEST;
-	ngc_ext_ctx->callbacks[NGC_EXT::FT1_INIT] = _handle_FT1_INIT;
-	ngc_ext_ctx->callbacks[NGC_EXT::FT1_INIT_ACK] = _handle_FT1_INIT_ACK;
-	ngc_ext_ctx->callbacks[NGC_EXT::FT1_DATA] = _handle_FT1_DATA;
-	ngc_ext_ctx->callbacks[NGC_EXT::FT1_DATA_ACK] = _handle_FT1_DATA_ACK;
-
-	ngc_ext_ctx->user_data[NGC_EXT::FT1_REQUEST] = ngc_ft1_ctx;
-	ngc_ext_ctx->user_data[NGC_EXT::FT1_INIT] = ngc_ft1_ctx;
-	ngc_ext_ctx->user_data[NGC_EXT::FT1_INIT_ACK] = ngc_ft1_ctx;
-	ngc_ext_ctx->user_data[NGC_EXT::FT1_DATA] = ngc_ft1_ctx;
-	ngc_ext_ctx->user_data[NGC_EXT::FT1_DATA_ACK] = ngc_ft1_ctx;
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return false;
+	}
+
+	const std::pair<uint8_t, _handle_pkg_fn*> handlers[] {
+		{NGC_EXT::FT1_REQUEST, _handle_FT1_REQUEST},
+		{NGC_EXT::FT1_INIT, _handle_FT1_INIT},
+		{NGC_EXT::FT1_INIT_ACK, _handle_FT1_INIT_ACK},
+		{NGC_EXT::FT1_DATA, _handle_FT1_DATA},
+		{NGC_EXT::FT1_DATA_ACK, _handle_FT1_DATA_ACK},
+		{NGC_EXT::FT1_INIT2, _handle_FT1_INIT2},
+		{NGC_EXT::FT1_INIT_ACK2, _handle_FT1_INIT_ACK2},
+		{NGC_EXT::FT1_DATA2, _handle_FT1_DATA2},
+		{NGC_EXT::FT1_DATA_ACK2, _handle_FT1_DATA_ACK2},
+		{NGC_EXT::FT1_REQUEST_BATCH, _handle_FT1_REQUEST_BATCH},
+		{NGC_EXT::FT1_INIT_DATA, _handle_FT1_INIT_DATA},
+		{NGC_EXT::FT1_FRAME, _handle_FT1_FRAME},
+		{NGC_EXT::FT1_FEC, _handle_FT1_FEC},
+		{NGC_EXT::FT1_DONE, _handle_FT1_DONE},
+	};
+
+	for (const auto& [pkg_id, fn] : handlers) {
+		if (ngc_ft1_ctx->options.threaded) {
+			// only queued on the tox thread, handled on the engine thread
+			ngc_ft1_ctx->engine_handlers[pkg_id] = {ngc_ft1_ctx, pkg_id, fn};
+			ngc_ext_ctx->callbacks[pkg_id] = _handle_FT1_threaded;
+			ngc_ext_ctx->user_data[pkg_id] = &ngc_ft1_ctx->engine_handlers[pkg_id];
+		} else {
+			ngc_ext_ctx->callbacks[pkg_id] = fn;
+			ngc_ext_ctx->user_data[pkg_id] = ngc_ft1_ctx;
+		}
+	}
 
 	return true;
 }
 
 void NGC_FT1_kill(NGC_FT1* ngc_ft1_ctx) {
+	ngc_ft1_ctx->engine_stop = true;
+	for (auto& shard : ngc_ft1_ctx->shards) {
+		if (shard->engine_thread.joinable()) {
+			shard->engine_wake.notify_one();
+			shard->engine_thread.join();
+		}
+	}
+
 	delete ngc_ft1_ctx;
 }
 
-void NGC_FT1_iterate(Tox *tox, NGC_FT1* ngc_ft1_ctx, float time_delta) {
-	assert(ngc_ft1_ctx);
-
-	for (auto& [group_number, group] : ngc_ft1_ctx->groups) {
-		for (auto& [peer_number, peer] : group.peers) {
-			auto timeouts = peer.cca.getTimeouts();
-			std::set<LEDBAT::SeqIDType> timeouts_set{timeouts.cbegin(), timeouts.cend()};
+// data sent before the init_ack, that was not acked
+static void _discard_early_data(NGC_FT1::Group::Peer& peer, uint16_t idx, NGC_FT1::Group::Peer::SendTransfer& tf) {
+	if (tf.file_size_current == 0) {
+		return;
+	}
 
-			for (size_t idx = 0; idx < peer.send_transfers.size(); idx++) {
-				auto& tf_opt = peer.send_transfers[idx];
-				if (tf_opt.has_value()) {
-					auto& tf = tf_opt.value();
+	for (const auto& [id, entry] : tf.ssb.entries) {
+		peer.cca.onLoss({idx, id}, true);
+	}
 
-					tf.time_since_activity += time_delta;
+	// start over once acked
+	const uint32_t seq_id_mask = tf.ssb.seq_id_mask;
+	tf.ssb = SendSequenceBuffer{};
+	tf.ssb.seq_id_mask = seq_id_mask;
+	tf.file_size_current = 0;
+	tf.cache_fill.clear();
+}
 
-					switch (tf.state) {
-						using State = NGC_FT1::Group::Peer::SendTransfer::State;
-						case State::INIT_SENT:
-							if (tf.time_since_activity >= ngc_ft1_ctx->options.init_retry_timeout_after) {
-								if (tf.inits_sent >= 3) {
-									// delete, timed out 3 times
-									fprintf(stderr, "FT: warning, ft init timed out, deleting\n");
-									tf_opt.reset();
-									continue; // dangerous control flow
-								} else {
-									// timed out, resend
-									fprintf(stderr, "FT: warning, ft init timed out, resending\n");
-									_send_pkg_FT1_INIT(tox, group_number, peer_number, tf.file_kind, tf.file_size, idx, tf.file_id.data(), tf.file_id.size());
-									tf.inits_sent++;
-									tf.time_since_activity = 0.f;
-								}
-							}
-							break;
-						case State::SENDING: {
-								tf.ssb.for_each(time_delta, [&](uint16_t id, const std::vector<uint8_t>& data, float& time_since_activity) {
-									// no ack after 5 sec -> resend
-									//if (time_since_activity >= ngc_ft1_ctx->options.sending_resend_without_ack_after) {
-									if (timeouts_set.count({idx, id})) {
-										// TODO: can fail
-										_send_pkg_FT1_DATA(tox, group_number, peer_number, idx, id, data.data(), data.size());
-										peer.cca.onLoss({idx, id}, false);
-										time_since_activity = 0.f;
-										timeouts_set.erase({idx, id});
-									}
-								});
+static uint8_t _send_transfer_init2_flags(const NGC_FT1::Group::Peer::SendTransfer& tf) {
+	uint8_t flags {_INIT2_FLAG_RECV_WINDOW | _INIT2_FLAG_DONE};
+	if (tf.compression_offered) {
+		flags |= _INIT2_FLAG_COMPRESSION;
+	}
+	if (tf.fec_offered) {
+		flags |= _INIT2_FLAG_FEC;
+	}
+	if (tf.one_way_delay_offered) {
+		flags |= _INIT2_FLAG_ONE_WAY_DELAY;
+	}
+	return flags;
+}
 
-								if (tf.time_since_activity >= ngc_ft1_ctx->options.sending_give_up_after) {
-									// no ack after 30sec, close ft
-									// TODO: notify app
-									fprintf(stderr, "FT: warning, sending ft in progress timed out, deleting\n");
+// reads file data from the cache or the app
+static void _send_transfer_read(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
 
-									// clean up cca
-									tf.ssb.for_each(time_delta, [&](uint16_t id, const std::vector<uint8_t>& data, float& time_since_activity) {
-										peer.cca.onLoss({idx, id}, true);
-										timeouts_set.erase({idx, id});
-									});
+	uint32_t group_number,
+	uint32_t peer_number,
 
-									tf_opt.reset();
-									continue; // dangerous control flow
-								}
+	uint16_t idx,
+	NGC_FT1::Group::Peer::SendTransfer& tf,
 
-								assert(ngc_ft1_ctx->cb_send_data.count(tf.file_kind));
-
-								// if chunks in flight < window size (2)
-								//while (tf.ssb.size() < ngc_ft1_ctx->options.packet_window_size) {
-								int64_t can_packet_size {static_cast<int64_t>(peer.cca.canSend())};
-								//if (can_packet_size) {
-									//std::cerr << "FT: can_packet_size: " << can_packet_size;
-								//}
-								size_t count {0};
-								while (can_packet_size > 0 && tf.file_size > 0) {
-									std::vector<uint8_t> new_data;
-
-									// TODO: parameterize packet size? -> only if JF increases lossy packet size >:)
-									//size_t chunk_size = std::min<size_t>(496u, tf.file_size - tf.file_size_current);
-									//size_t chunk_size = std::min<size_t>(can_packet_size, tf.file_size - tf.file_size_current);
-									size_t chunk_size = std::min<size_t>({
-										//496u,
-										//996u,
-										peer.cca.MAXIMUM_SEGMENT_DATA_SIZE,
-										static_cast<size_t>(can_packet_size),
-										tf.file_size - tf.file_size_current
-									});
-									if (chunk_size == 0) {
-										tf.state = State::FINISHING;
-										break; // we done
-									}
+	size_t offset,
+	std::vector<uint8_t>& data_out
+) {
+	if (tf.cache_data) {
+		std::copy_n(tf.cache_data->cbegin() + offset, data_out.size(), data_out.begin());
+	} else if (tf.read_async) {
+		assert(offset >= tf.read_ahead_offset);
+		assert(offset + data_out.size() <= tf.read_ahead_offset + tf.read_ahead.size());
+		std::copy_n(tf.read_ahead.cbegin() + (offset - tf.read_ahead_offset), data_out.size(), data_out.begin());
+	} else {
+		ngc_ft1_ctx->cb_send_data[tf.file_kind](
+			tox,
+			group_number, peer_number,
+			idx,
+			offset,
+			data_out.data(), data_out.size(),
+			ngc_ft1_ctx->ud_send_data.count(tf.file_kind) ? ngc_ft1_ctx->ud_send_data.at(tf.file_kind) : nullptr
+		);
+	}
+}
 
-									new_data.resize(chunk_size);
+// the data of an in flight segment, read again into scratch if the ssb only kept the range
+static const std::vector<uint8_t>& _send_transfer_segment(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
 
-									ngc_ft1_ctx->cb_send_data[tf.file_kind](
-										tox,
-										group_number, peer_number,
-										idx,
-										tf.file_size_current,
-										new_data.data(), new_data.size(),
-										ngc_ft1_ctx->ud_send_data.count(tf.file_kind) ? ngc_ft1_ctx->ud_send_data.at(tf.file_kind) : nullptr
-									);
-									uint16_t seq_id = tf.ssb.add(std::move(new_data));
-									_send_pkg_FT1_DATA(tox, group_number, peer_number, idx, seq_id, tf.ssb.entries.at(seq_id).data.data(), tf.ssb.entries.at(seq_id).data.size());
-									peer.cca.onSent({idx, seq_id}, chunk_size);
+	uint32_t group_number,
+	uint32_t peer_number,
 
-#if defined(EXTRA_LOGGING) && EXTRA_LOGGING == 1
-									fprintf(stderr, "FT: sent data size: %ld (seq %d)\n", chunk_size, seq_id);
-#endif
+	uint16_t idx,
+	NGC_FT1::Group::Peer::SendTransfer& tf,
 
-									tf.file_size_current += chunk_size;
-									can_packet_size -= chunk_size;
-									count++;
-								}
-								//if (count) {
-									//std::cerr << " split over " << count << "\n";
-								//}
-							}
-							break;
-						case State::FINISHING: // we still have unacked packets
-							tf.ssb.for_each(time_delta, [&](uint16_t id, const std::vector<uint8_t>& data, float& time_since_activity) {
-								// no ack after 5 sec -> resend
-								//if (time_since_activity >= ngc_ft1_ctx->options.sending_resend_without_ack_after) {
-								if (timeouts_set.count({idx, id})) {
-									_send_pkg_FT1_DATA(tox, group_number, peer_number, idx, id, data.data(), data.size());
-									peer.cca.onLoss({idx, id}, false);
-									time_since_activity = 0.f;
-									timeouts_set.erase({idx, id});
-								}
-							});
-							if (tf.time_since_activity >= ngc_ft1_ctx->options.sending_give_up_after) {
-								// no ack after 30sec, close ft
-								// TODO: notify app
-								fprintf(stderr, "FT: warning, sending ft finishing timed out, deleting\n");
+	const SendSequenceBuffer::SSBEntry& entry,
+	std::vector<uint8_t>& scratch
+) {
+	if (!tf.reread) {
+		return entry.data;
+	}
 
-								// clean up cca
-								tf.ssb.for_each(time_delta, [&](uint16_t id, const std::vector<uint8_t>& data, float& time_since_activity) {
-									peer.cca.onLoss({idx, id}, true);
-									timeouts_set.erase({idx, id});
-								});
+	scratch.resize(entry.size);
+	_send_transfer_read(tox, ngc_ft1_ctx, group_number, peer_number, idx, tf, entry.offset, scratch);
+	return scratch;
+}
 
-								tf_opt.reset();
-							}
-							break;
-						default: // invalid state, delete
-							fprintf(stderr, "FT: error, ft in invalid state, deleting\n");
-							tf_opt.reset();
-							continue;
-					}
-				}
-			}
-		}
+// bytes after file_size_current that can be read without waiting
+static size_t _send_transfer_ready(const NGC_FT1::Group::Peer::SendTransfer& tf) {
+	if (!tf.read_async) {
+		return tf.file_size - tf.file_size_current;
 	}
+
+	return tf.read_ahead_offset + tf.read_ahead.size() - tf.file_size_current;
 }
 
-void NGC_FT1_register_callback_recv_request(
+// requests reads from the app threads, to keep send_read_ahead_size bytes ahead of what was sent
+static void _send_transfer_read_ahead(
 	NGC_FT1* ngc_ft1_ctx,
-	uint32_t file_kind,
-	NGC_FT1_recv_request_cb* callback,
-	void* user_data
-) {
-	assert(ngc_ft1_ctx);
 
-	ngc_ft1_ctx->cb_recv_request[file_kind] = callback;
-	ngc_ft1_ctx->ud_recv_request[file_kind] = user_data;
-}
+	uint32_t group_number,
+	uint32_t peer_number,
 
-void NGC_FT1_register_callback_recv_init(
-	NGC_FT1* ngc_ft1_ctx,
-	uint32_t file_kind,
-	NGC_FT1_recv_init_cb* callback,
-	void* user_data
+	uint16_t idx,
+	NGC_FT1::Group::Peer::SendTransfer& tf
 ) {
-	assert(ngc_ft1_ctx);
+	const size_t read_ahead_size = ngc_ft1_ctx->options.send_read_ahead_size > 0 ? ngc_ft1_ctx->options.send_read_ahead_size : _SEND_READ_AHEAD_SIZE_DEFAULT;
+
+	while (tf.read_ahead_requested < tf.file_size && tf.read_ahead_requested - tf.file_size_current < read_ahead_size) {
+		SendReadQueue::Read read;
+		read.file_kind = tf.file_kind;
+		read.group_number = group_number;
+		read.peer_number = peer_number;
+		read.transfer_id = idx;
+		read.data_offset = tf.read_ahead_requested;
+		read.data.resize(std::min({_SEND_READ_BLOCK_SIZE, read_ahead_size, tf.file_size - tf.read_ahead_requested}));
+
+		tf.read_ahead_requested += read.data.size();
+		tf.read_ahead_pending.insert(ngc_ft1_ctx->send_read_queue.push(std::move(read)));
+	}
+}
 
-	ngc_ft1_ctx->cb_recv_init[file_kind] = callback;
-	ngc_ft1_ctx->ud_recv_init[file_kind] = user_data;
+// drops the read ahead data that was sent, once it is at least half of the buffer
+static void _send_transfer_read_ahead_consume(NGC_FT1::Group::Peer::SendTransfer& tf) {
+	if (!tf.read_async) {
+		return;
+	}
+
+	const size_t consumed = tf.file_size_current - tf.read_ahead_offset;
+	if (consumed > 0 && consumed*2 >= tf.read_ahead.size()) {
+		tf.read_ahead.erase(tf.read_ahead.begin(), tf.read_ahead.begin() + consumed);
+		tf.read_ahead_offset += consumed;
+	}
 }
 
-void NGC_FT1_register_callback_recv_data(
-	NGC_FT1* ngc_ft1_ctx,
-	uint32_t file_kind,
-	NGC_FT1_recv_data_cb* callback,
-	void* user_data
+// hands the reads the app threads completed to the transfers of the shard
+static void _send_read_completed(NGC_FT1* ngc_ft1_ctx, NGC_FT1::Shard& shard) {
+	std::vector<SendReadQueue::Read> reads;
+	ngc_ft1_ctx->send_read_queue.takeCompleted(reads, [ngc_ft1_ctx, &shard](const SendReadQueue::Read& read) {
+		// the peer might have moved here, after the read was requested
+		return &ngc_ft1_ctx->shardOf(read.group_number, read.peer_number) == &shard;
+	});
+
+	for (auto& read : reads) {
+		auto g_it = shard.groups.find(read.group_number);
+		if (g_it == shard.groups.end()) {
+			continue;
+		}
+		auto p_it = g_it->second.peers.find(read.peer_number);
+		if (p_it == g_it->second.peers.end()) {
+			continue;
+		}
+		auto tf_it = p_it->second.send_transfers.find(read.transfer_id);
+		if (tf_it == p_it->second.send_transfers.end()) {
+			continue;
+		}
+		auto& tf = tf_it->second;
+
+		// the transfer might have been deleted and the id reused
+		if (!tf.read_ahead_pending.erase(read.id)) {
+			continue;
+		}
+
+		tf.read_ahead_done[read.data_offset] = std::move(read.data);
+		while (!tf.read_ahead_done.empty() && tf.read_ahead_done.begin()->first == tf.read_ahead_offset + tf.read_ahead.size()) {
+			const auto& data = tf.read_ahead_done.begin()->second;
+			tf.read_ahead.insert(tf.read_ahead.end(), data.cbegin(), data.cend());
+			tf.read_ahead_done.erase(tf.read_ahead_done.begin());
+		}
+	}
+}
+
+// reads the next block of a compressed transfer and packs it into one segment of at most segment_size_max
+// the block is sized by the compression ratio seen so far, so a segment carries as much file data as fits
+// returns the file data in data_out
+static void _send_transfer_compressed_segment(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	uint16_t idx,
+	NGC_FT1::Group::Peer::SendTransfer& tf,
+
+	size_t segment_size_max,
+	std::vector<uint8_t>& segment_out,
+	std::vector<uint8_t>& data_out
 ) {
-	assert(ngc_ft1_ctx);
+	assert(segment_size_max > 1);
 
-	ngc_ft1_ctx->cb_recv_data[file_kind] = callback;
-	ngc_ft1_ctx->ud_recv_data[file_kind] = user_data;
+	const size_t remaining = _send_transfer_ready(tf);
+	assert(remaining > 0);
+	const size_t raw_size = std::min(segment_size_max - 1, remaining);
+
+	if (tf.compression_skip > 0) {
+		tf.compression_skip--;
+	} else {
+		size_t block_size = std::min<size_t>(remaining, std::max<size_t>(raw_size, raw_size * tf.compression_ratio));
+		data_out.resize(block_size);
+		_send_transfer_read(tox, ngc_ft1_ctx, group_number, peer_number, idx, tf, tf.file_size_current, data_out);
+
+		for (size_t i = 0; i < _COMPRESSION_MAX_TRIES; i++) {
+			if (!ngc_ft1_ctx->shardOf(group_number, peer_number).compressor.compress(data_out.data(), block_size, ngc_ft1_ctx->options.compression_level, segment_out)) {
+				break;
+			}
+			const size_t compressed_size = segment_out.size() - 1;
+
+			if (compressed_size >= block_size) {
+				// incompressible, dont waste cpu on the next segments
+				tf.compression_skip = _COMPRESSION_SKIP_SEGMENTS;
+				break;
+			}
+
+			if (segment_out.size() <= segment_size_max) {
+				// the end of the file is not representative
+				if (block_size < remaining) {
+					tf.compression_ratio = std::clamp(float(block_size) / float(compressed_size), 1.f, _COMPRESSION_MAX_RATIO);
+				}
+				data_out.resize(block_size);
+				return;
+			}
+
+			// too big, retry with what should fit
+			const float ratio = float(block_size) / float(compressed_size);
+			tf.compression_ratio = std::clamp(ratio, 1.f, _COMPRESSION_MAX_RATIO);
+			const size_t new_block_size = (segment_size_max - 1) * ratio * 0.95f;
+			if (new_block_size >= block_size || new_block_size <= raw_size) {
+				break;
+			}
+			block_size = new_block_size;
+		}
+	}
+
+	data_out.resize(raw_size);
+	_send_transfer_read(tox, ngc_ft1_ctx, group_number, peer_number, idx, tf, tf.file_size_current, data_out);
+
+	segment_out.clear();
+	segment_out.push_back(SegmentCompressor::RAW);
+	segment_out.insert(segment_out.end(), data_out.cbegin(), data_out.cend());
 }
 
-void NGC_FT1_register_callback_send_data(
+// sends the parity of the current fec group, if any
+// returns the parity size
+static size_t _send_transfer_fec_flush(
+	Tox* tox,
 	NGC_FT1* ngc_ft1_ctx,
-	uint32_t file_kind,
-	NGC_FT1_send_data_cb* callback,
-	void* user_data
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	uint16_t idx,
+	NGC_FT1::Group::Peer::SendTransfer& tf
 ) {
-	assert(ngc_ft1_ctx);
+	if (tf.fec_count == 0) {
+		return 0;
+	}
 
-	ngc_ft1_ctx->cb_send_data[file_kind] = callback;
-	ngc_ft1_ctx->ud_send_data[file_kind] = user_data;
+	_send_pkg_FT1_FEC(ngc_ft1_ctx, tox, group_number, peer_number, idx, tf.fec_first_seq_id, tf.fec_count, tf.fec_size_xor, tf.fec_parity.data(), tf.fec_parity.size());
+	const size_t parity_size = tf.fec_parity.size();
+
+	tf.fec_count = 0;
+	tf.fec_size_xor = 0;
+	tf.fec_parity.clear();
+	tf.fec_time_since_first = 0.f;
+
+	return parity_size;
 }
 
-void NGC_FT1_send_request_private(
-	Tox *tox, NGC_FT1* ngc_ft1_ctx,
+// adds a newly sent segment to the current fec group and sends the parity once the group is full
+// returns the parity size, if it was sent
+static size_t _send_transfer_fec_add(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
 
 	uint32_t group_number,
 	uint32_t peer_number,
 
-	uint32_t file_kind,
+	NGC_FT1::Group::Peer& peer,
+	uint16_t idx,
+	NGC_FT1::Group::Peer::SendTransfer& tf,
 
-	const uint8_t* file_id,
-	size_t file_id_size
+	uint32_t seq_id,
+	const std::vector<uint8_t>& data
 ) {
-	assert(tox);
-	assert(ngc_ft1_ctx);
+	// no loss, no parity
+	peer.fec_group_size = std::min(peer.fec_group_size * (1.f + 0.25f * _FEC_TARGET_LOSS), _FEC_MAX_GROUP_SIZE);
 
-	// record locally that we sent(or want to send) the request?
+	if (tf.fec_count == 0) {
+		if (peer.fec_group_size >= _FEC_MAX_GROUP_SIZE) {
+			return 0;
+		}
+		tf.fec_first_seq_id = seq_id;
+	}
+
+	if (tf.fec_parity.size() < data.size()) {
+		tf.fec_parity.resize(data.size(), 0);
+	}
+	for (size_t i = 0; i < data.size(); i++) {
+		tf.fec_parity[i] ^= data[i];
+	}
+	tf.fec_size_xor ^= data.size();
+	tf.fec_count++;
+
+	if (tf.fec_count >= peer.fec_group_size || tf.file_size_current == tf.file_size) {
+		return _send_transfer_fec_flush(tox, ngc_ft1_ctx, group_number, peer_number, idx, tf);
+	}
 
-	_send_pkg_FT1_REQUEST(tox, group_number, peer_number, file_kind, file_id, file_id_size);
+	return 0;
 }
 
-bool NGC_FT1_send_init_private(
-	Tox *tox, NGC_FT1* ngc_ft1_ctx,
-	uint32_t group_number, uint32_t peer_number,
-	uint32_t file_kind,
-	const uint8_t* file_id, size_t file_id_size,
-	size_t file_size,
-	uint8_t* transfer_id
+// a segment timed out, fec could not repair it
+static void _send_transfer_fec_on_loss(NGC_FT1::Group::Peer& peer, NGC_FT1::Group::Peer::SendTransfer& tf, uint32_t seq_id) {
+	if (!tf.fec || !tf.fec_lost_seq_ids.insert(seq_id).second) {
+		return;
+	}
+
+	peer.fec_group_size = std::max(peer.fec_group_size * 0.75f, _FEC_MIN_GROUP_SIZE);
+}
+
+// reads new data from the app (or cache) and sends it, up to can_send bytes
+static void _send_transfer_new_data(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	NGC_FT1::Group::Peer& peer,
+	uint16_t idx,
+	NGC_FT1::Group::Peer::SendTransfer& tf,
+
+	size_t can_send
 ) {
-	//fprintf(stderr, "TODO: init ft for %08X\n", msg_id);
-	//fprintf(stderr, "FT: init ft\n");
+	using State = NGC_FT1::Group::Peer::SendTransfer::State;
 
-	if (tox_group_peer_get_connection_status(tox, group_number, peer_number, nullptr) == TOX_CONNECTION_NONE) {
-		fprintf(stderr, "FT: error: cant init ft, peer offline\n");
-		return false;
+	assert(tf.cache_data || tf.read_async || ngc_ft1_ctx->cb_send_data.count(tf.file_kind));
+
+	// the receiver has to be able to buffer everything unacked, in case the first segment is lost
+	if (tf.recv_window != SIZE_MAX) {
+		can_send = std::min(can_send, tf.recv_window > tf.ssb.bytes ? tf.recv_window - tf.ssb.bytes : 0);
 	}
 
-	auto& peer = ngc_ft1_ctx->groups[group_number].peers[peer_number];
+	// if chunks in flight < window size (2)
+	//while (tf.ssb.size() < ngc_ft1_ctx->options.packet_window_size) {
+	int64_t can_packet_size {static_cast<int64_t>(can_send)};
+	//if (can_packet_size) {
+		//std::cerr << "FT: can_packet_size: " << can_packet_size;
+	//}
+	size_t count {0};
+	while (can_packet_size > 0 && tf.file_size > 0 && tf.ssb.canAdd()) {
+		if (tf.file_size_current == tf.file_size) {
+			if (tf.state == State::SENDING) {
+				tf.state = State::FINISHING;
+				tf.time_since_tail_probe = 0.f;
+			}
+			break; // we done
+		}
 
-	// allocate transfer_id
-	size_t idx = peer.next_send_transfer_idx;
-	peer.next_send_transfer_idx = (peer.next_send_transfer_idx + 1) % 256;
-	{ // TODO: extract
-		size_t i = idx;
-		bool found = false;
-		do {
-			if (!peer.send_transfers[i].has_value()) {
-				// free slot
-				idx = i;
-				found = true;
-				break;
+		const size_t ready = _send_transfer_ready(tf);
+		if (ready == 0) {
+			break; // waiting for the app threads
+		}
+
+		// TODO: parameterize packet size? -> only if JF increases lossy packet size >:)
+		const size_t segment_size_max = std::min<size_t>({
+			// FT1_DATA2 has 3 more bytes of header for the 16bit transfer_id and 32bit seq_id
+			// and FT1_FEC needs 3 more than that, to carry the parity of a full segment
+			// a timestamp makes FT1_DATA2 4 bytes bigger, which covers FT1_FEC too
+			peer.cca.MAXIMUM_SEGMENT_DATA_SIZE - (tf.v2 ? 3 : 0) - std::max<size_t>(
+				tf.one_way_delay ? sizeof(uint32_t) : 0,
+				tf.fec ? _FEC_HEADER_SIZE - 7 : 0
+			),
+			static_cast<size_t>(can_packet_size),
+		});
+
+		std::vector<uint8_t> new_data;
+		std::vector<uint8_t> segment;
+		if (tf.compressed) {
+			if (segment_size_max <= 1) {
+				break; // no room for the marker
 			}
+			_send_transfer_compressed_segment(tox, ngc_ft1_ctx, group_number, peer_number, idx, tf, segment_size_max, segment, new_data);
+		} else {
+			new_data.resize(std::min(segment_size_max, ready));
+			_send_transfer_read(tox, ngc_ft1_ctx, group_number, peer_number, idx, tf, tf.file_size_current, new_data);
+		}
+		const size_t chunk_size = new_data.size();
 
-			i = (i + 1) % 256;
-		} while (i != idx);
+		if (tf.cache_filling) {
+			tf.cache_fill.insert(tf.cache_fill.end(), new_data.cbegin(), new_data.cend());
+		}
+		uint32_t seq_id {0};
+		if (tf.reread) {
+			seq_id = tf.ssb.addRange(tf.file_size_current, chunk_size);
+		} else {
+			seq_id = tf.ssb.add(tf.compressed ? std::move(segment) : std::move(new_data));
+		}
+		const auto& seq_data = tf.reread ? new_data : tf.ssb.entries.at(seq_id).data;
+		_send_transfer_data(ngc_ft1_ctx, tox, group_number, peer_number, peer, idx, tf.v2, tf.one_way_delay, seq_id, seq_data.data(), seq_data.size());
+		peer.cca.onSent({idx, seq_id}, seq_data.size());
 
-		if (!found) {
-			fprintf(stderr, "FT: error: cant init ft, no free transfer slot\n");
-			return false;
+#if defined(EXTRA_LOGGING) && EXTRA_LOGGING == 1
+		fprintf(stderr, "FT: sent data size: %ld (seq %u)\n", seq_data.size(), seq_id);
+#endif
+
+		tf.file_size_current += chunk_size;
+		_send_transfer_read_ahead_consume(tf);
+		can_packet_size -= seq_data.size();
+		count++;
+
+		if (tf.fec) {
+			// parity is not tracked by the cca, but takes from the same budget
+			can_packet_size -= _send_transfer_fec_add(tox, ngc_ft1_ctx, group_number, peer_number, peer, idx, tf, seq_id, seq_data);
+		}
+
+		if (tf.cache_filling && tf.file_size_current == tf.file_size) {
+			tf.cache_filling = false;
+			ngc_ft1_ctx->cachePut({tf.file_kind, tf.file_id}, std::move(tf.cache_fill));
 		}
 	}
+	//if (count) {
+		//std::cerr << " split over " << count << "\n";
+	//}
+}
 
-	_send_pkg_FT1_INIT(tox, group_number, peer_number, file_kind, file_size, idx, file_id, file_id_size);
+void NGC_FT1_iterate(Tox *tox, NGC_FT1* ngc_ft1_ctx, float time_delta) {
+	assert(ngc_ft1_ctx);
 
-	peer.send_transfers[idx] = NGC_FT1::Group::Peer::SendTransfer{
-		file_kind,
-		std::vector(file_id, file_id+file_id_size),
-		NGC_FT1::Group::Peer::SendTransfer::State::INIT_SENT,
-		1,
-		0.f,
-		file_size,
-		0,
-	};
+	// tox is only called from here, the engine threads might not be on the tox thread
+	ngc_ft1_ctx->time_since_connection_check += time_delta;
+	if (ngc_ft1_ctx->time_since_connection_check >= _CONNECTION_CHECK_INTERVAL) {
+		ngc_ft1_ctx->time_since_connection_check = 0.f;
+		_check_connections(tox, ngc_ft1_ctx);
+	}
 
-	if (transfer_id != nullptr) {
-		*transfer_id = idx;
+	if (!ngc_ft1_ctx->options.threaded) {
+		_iterate(tox, ngc_ft1_ctx, *ngc_ft1_ctx->shards.front(), time_delta);
+		return;
 	}
 
-	return true;
+	ngc_ft1_ctx->engine_tox = tox;
+
+	// the engine threads iterate on their own
+	NGC_FT1::EnginePacket pkg;
+	std::vector<NGC_FT1::EnginePacket> pkgs;
+	for (auto& shard : ngc_ft1_ctx->shards) {
+		while (shard->engine_out.pop(pkg)) {
+			pkgs.push_back(std::move(pkg));
+		}
+		if (pkgs.empty()) {
+			continue;
+		}
+
+		// if the engine is busy, the packets keep the timestamps of when they were queued
+		std::unique_lock lock(shard->engine_mutex, std::try_to_lock);
+		if (lock.owns_lock()) {
+			for (auto& p : pkgs) {
+				_engine_out_departed(*shard, p);
+			}
+			lock.unlock();
+		}
+
+		for (const auto& p : pkgs) {
+			tox_group_send_custom_private_packet(tox, p.group_number, p.peer_number, p.lossless, p.data.data(), p.data.size(), nullptr);
+		}
+		pkgs.clear();
+	}
+
+	if (ngc_ft1_ctx->shards.size() > 1) {
+		ngc_ft1_ctx->time_since_rebalance += time_delta;
+		if (ngc_ft1_ctx->time_since_rebalance >= _ENGINE_REBALANCE_INTERVAL) {
+			ngc_ft1_ctx->time_since_rebalance = 0.f;
+			_engine_rebalance(tox, ngc_ft1_ctx);
+		}
+	}
 }
 
-static bool _send_pkg_FT1_REQUEST(const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, const uint8_t* file_id, size_t file_id_size) {
-	// - 1 byte packet id
-	// - 4 byte file_kind
-	// - X bytes file_id
-	std::vector<uint8_t> pkg;
-	pkg.push_back(NGC_EXT::FT1_REQUEST);
-	for (size_t i = 0; i < sizeof(file_kind); i++) {
-		pkg.push_back((file_kind>>(i*8)) & 0xff);
+// the engine timestamped the data segments when it queued them, the tox thread only sends them now
+// called holding the engine_mutex
+static void _engine_out_departed(NGC_FT1::Shard& shard, NGC_FT1::EnginePacket& pkg) {
+	auto g_it = shard.groups.find(pkg.group_number);
+	if (g_it == shard.groups.end()) {
+		return;
 	}
-	for (size_t i = 0; i < file_id_size; i++) {
-		pkg.push_back(file_id[i]);
+	auto p_it = g_it->second.peers.find(pkg.peer_number);
+	if (p_it == g_it->second.peers.end()) {
+		return;
 	}
+	auto& peer = p_it->second;
+	auto& data = pkg.data;
+
+	// FT1_DATA or FT1_DATA2 without the packet id, at curser
+	auto departed = [&](size_t curser, size_t length, bool v2) {
+		// - 1 or 2 bytes (transfer_id)
+		// - 2 or 4 bytes (sequence_id)
+		// - 4 bytes (timestamp) (v2 only, if negotiated)
+		const size_t transfer_id_size = v2 ? sizeof(uint16_t) : sizeof(uint8_t);
+		const size_t seq_id_size = v2 ? sizeof(uint32_t) : sizeof(uint16_t);
+		if (length < transfer_id_size + seq_id_size) {
+			return;
+		}
 
-	// lossless
-	return tox_group_send_custom_private_packet(tox, group_number, peer_number, true, pkg.data(), pkg.size(), nullptr);
-}
+		uint16_t transfer_id {0u};
+		for (size_t i = 0; i < transfer_id_size; i++, curser++) {
+			transfer_id |= uint16_t(data[curser]) << (i*8);
+		}
+		uint32_t seq_id {0u};
+		for (size_t i = 0; i < seq_id_size; i++, curser++) {
+			seq_id |= uint32_t(data[curser]) << (i*8);
+		}
 
-static bool _send_pkg_FT1_INIT(const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, uint64_t file_size, uint8_t transfer_id, const uint8_t* file_id, size_t file_id_size) {
-	// - 1 byte packet id
-	// - 4 byte (file_kind)
-	// - 8 bytes (data size)
-	// - 1 byte (temporary_file_tf_id, for this peer only, technically just a prefix to distinguish between simultainious fts)
-	// - X bytes (file_kind dependent id, differnt sizes)
+		auto t_it = peer.send_transfers.find(transfer_id);
+		if (t_it == peer.send_transfers.end()) {
+			return; // allready gone, sent anyway
+		}
 
-	std::vector<uint8_t> pkg;
-	pkg.push_back(NGC_EXT::FT1_INIT);
-	for (size_t i = 0; i < sizeof(file_kind); i++) {
-		pkg.push_back((file_kind>>(i*8)) & 0xff);
+		if (v2 && t_it->second.one_way_delay && length >= transfer_id_size + seq_id_size + sizeof(uint32_t)) {
+			const uint32_t now = _timestamp_now();
+			for (size_t i = 0; i < sizeof(now); i++) {
+				data[curser + i] = (now>>(i*8)) & 0xff;
+			}
+		}
+
+		peer.cca.onDeparted({transfer_id, seq_id});
+	};
+
+	if (data.empty()) {
+		return;
+	} else if (data.front() == NGC_EXT::FT1_DATA) {
+		departed(1, data.size() - 1, false);
+	} else if (data.front() == NGC_EXT::FT1_DATA2) {
+		departed(1, data.size() - 1, true);
+	} else if (data.front() == NGC_EXT::FT1_FRAME) {
+		size_t curser = 1;
+		while (curser + _FRAME_RECORD_HEADER_SIZE <= data.size()) {
+			const uint8_t record_pkg_id = data[curser];
+			const size_t record_size = data[curser+1] | (size_t(data[curser+2]) << 8);
+			curser += _FRAME_RECORD_HEADER_SIZE;
+			if (curser + record_size > data.size()) {
+				break;
+			}
+			if (record_pkg_id == NGC_EXT::FT1_DATA2) {
+				departed(curser, record_size, true);
+			}
+			curser += record_size;
+		}
 	}
-	for (size_t i = 0; i < sizeof(file_size); i++) {
-		pkg.push_back((file_size>>(i*8)) & 0xff);
+}
+
+static void _handle_FT1_threaded(
+	Tox* tox,
+	NGC_EXT_CTX* ngc_ext_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	const uint8_t *data,
+	size_t length,
+	void* user_data
+) {
+	const auto* handler = static_cast<const NGC_FT1::EngineHandler*>(user_data);
+	NGC_FT1* ngc_ft1_ctx = handler->ngc_ft1_ctx;
+
+	ngc_ft1_ctx->engine_tox = tox;
+
+	// only the tox thread pushes, and moves peers
+	auto& shard = ngc_ft1_ctx->shardOf(group_number, peer_number);
+	if (!shard.engine_in.push({handler->pkg_id, group_number, peer_number, false, std::vector(data, data+length)})) {
+		fprintf(stderr, "FT: warning, engine queue full, dropped packet\n");
+		return;
 	}
-	pkg.push_back(transfer_id);
-	for (size_t i = 0; i < file_id_size; i++) {
-		pkg.push_back(file_id[i]);
+	shard.engine_wake.notify_one();
+}
+
+static void _engine_run(NGC_FT1* ngc_ft1_ctx, NGC_FT1::Shard* shard) {
+	_engine_shard = shard;
+
+	auto last_iterate = std::chrono::steady_clock::now();
+
+	NGC_FT1::EnginePacket pkg;
+	while (!ngc_ft1_ctx->engine_stop) {
+		{
+			// a missed wakeup costs one interval
+			std::unique_lock lock(shard->engine_wake_mutex);
+			shard->engine_wake.wait_for(lock, _ENGINE_INTERVAL, [ngc_ft1_ctx, shard]() {
+				return ngc_ft1_ctx->engine_stop || !shard->engine_in.empty();
+			});
+		}
+
+		// callbacks get it, but may not call into tox from here
+		Tox* tox = ngc_ft1_ctx->engine_tox;
+		if (tox == nullptr) {
+			continue; // never iterated
+		}
+
+		std::lock_guard lock(shard->engine_mutex);
+
+		while (shard->engine_in.pop(pkg)) {
+			shard->engine_load[{pkg.group_number, pkg.peer_number}]++;
+			ngc_ft1_ctx->engine_handlers[pkg.pkg_id].fn(tox, nullptr, pkg.group_number, pkg.peer_number, pkg.data.data(), pkg.data.size(), ngc_ft1_ctx);
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		_iterate(tox, ngc_ft1_ctx, *shard, std::chrono::duration<float>(now - last_iterate).count());
+		last_iterate = now;
 	}
 
-	// lossless
-	return tox_group_send_custom_private_packet(tox, group_number, peer_number, true, pkg.data(), pkg.size(), nullptr);
+	_engine_shard = nullptr;
 }
 
-static bool _send_pkg_FT1_INIT_ACK(const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id) {
-	// send ack
-	// - 1 byte packet id
-	// - 1 byte transfer_id
-	std::vector<uint8_t> pkg;
-	pkg.push_back(NGC_EXT::FT1_INIT_ACK);
-	pkg.push_back(transfer_id);
+// moves a busy peer from the busiest shard to the least busy one, on the tox thread
+// load is the number of packets received, which follows the data sent and received
+static void _engine_rebalance(Tox* tox, NGC_FT1* ngc_ft1_ctx) {
+	auto& shards = ngc_ft1_ctx->shards;
+
+	std::vector<size_t> shard_loads(shards.size(), 0);
+	std::vector<std::map<std::pair<uint32_t, uint32_t>, size_t>> peer_loads(shards.size());
+	for (size_t i = 0; i < shards.size(); i++) {
+		std::lock_guard lock(shards[i]->engine_mutex);
+		peer_loads[i] = std::move(shards[i]->engine_load);
+		shards[i]->engine_load.clear();
+		for (const auto& [key, load] : peer_loads[i]) {
+			shard_loads[i] += load;
+		}
+	}
 
-	// lossless
-	return tox_group_send_custom_private_packet(tox, group_number, peer_number, true, pkg.data(), pkg.size(), nullptr);
-}
+	const size_t from = std::max_element(shard_loads.cbegin(), shard_loads.cend()) - shard_loads.cbegin();
+	const size_t to = std::min_element(shard_loads.cbegin(), shard_loads.cend()) - shard_loads.cbegin();
+	const size_t diff = shard_loads[from] - shard_loads[to];
+	if (diff < _ENGINE_REBALANCE_MIN_LOAD || peer_loads[from].size() < 2) {
+		return;
+	}
 
-static bool _send_pkg_FT1_DATA(const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id, uint16_t sequence_id, const uint8_t* data, size_t data_size) {
-	assert(data_size > 0);
+	// the peer closest to half the difference, moving more than the difference makes it worse
+	std::pair<uint32_t, uint32_t> best_key;
+	size_t best_dist {SIZE_MAX};
+	for (const auto& [key, load] : peer_loads[from]) {
+		if (load >= diff) {
+			continue;
+		}
+		const size_t dist = load > diff/2 ? load - diff/2 : diff/2 - load;
+		if (dist < best_dist) {
+			best_dist = dist;
+			best_key = key;
+		}
+	}
+	if (best_dist == SIZE_MAX) {
+		return; // a single peer keeps the shard busy
+	}
 
-	// TODO
-	// check header_size+data_size <= max pkg size
+	auto& shard_from = *shards[from];
+	auto& shard_to = *shards[to];
+	std::scoped_lock lock(shard_from.engine_mutex, shard_to.engine_mutex);
 
-	std::vector<uint8_t> pkg;
-	pkg.push_back(NGC_EXT::FT1_DATA);
-	pkg.push_back(transfer_id);
-	pkg.push_back(sequence_id & 0xff);
-	pkg.push_back((sequence_id >> (1*8)) & 0xff);
+	// packets still queued would end up in the old shard
+	if (!shard_from.engine_in.empty()) {
+		return;
+	}
 
-	// TODO: optimize
-	for (size_t i = 0; i < data_size; i++) {
-		pkg.push_back(data[i]);
+	// keep the order of what was sent so far
+	NGC_FT1::EnginePacket pkg;
+	while (shard_from.engine_out.pop(pkg)) {
+		tox_group_send_custom_private_packet(tox, pkg.group_number, pkg.peer_number, pkg.lossless, pkg.data.data(), pkg.data.size(), nullptr);
 	}
 
-	// lossy
-	return tox_group_send_custom_private_packet(tox, group_number, peer_number, false, pkg.data(), pkg.size(), nullptr);
-}
+	const auto [group_number, peer_number] = best_key;
+	auto g_it = shard_from.groups.find(group_number);
+	if (g_it == shard_from.groups.end() || !g_it->second.peers.count(peer_number)) {
+		return;
+	}
+	if (shard_to.groups.count(group_number) && shard_to.groups.at(group_number).peers.count(peer_number)) {
+		return; // should not happen
+	}
+	shard_to.groups[group_number].peers.insert(g_it->second.peers.extract(peer_number));
 
-static bool _send_pkg_FT1_DATA_ACK(const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id, const uint16_t* seq_ids, size_t seq_ids_size) {
-	std::vector<uint8_t> pkg;
-	pkg.push_back(NGC_EXT::FT1_DATA_ACK);
+	std::unique_lock routes_lock(ngc_ft1_ctx->shard_routes_mutex);
+	ngc_ft1_ctx->shard_routes[best_key] = to;
+
+#if defined(EXTRA_LOGGING) && EXTRA_LOGGING == 1
+	fprintf(stderr, "FT: moved peer %u:%u from shard %zu to %zu (load %zu/%zu)\n", group_number, peer_number, from, to, shard_loads[from], shard_loads[to]);
+#endif
+}
+
+// which peers are relayed, on the tox thread
+static void _check_connections(const Tox* tox, NGC_FT1* ngc_ft1_ctx) {
+	for (auto& shard : ngc_ft1_ctx->shards) {
+		std::unique_lock<std::recursive_mutex> lock;
+		if (ngc_ft1_ctx->options.threaded) {
+			lock = std::unique_lock{shard->engine_mutex};
+		}
+
+		for (auto& [group_number, group] : shard->groups) {
+			for (auto& [peer_number, peer] : group.peers) {
+				const TOX_CONNECTION connection = tox_group_peer_get_connection_status(tox, group_number, peer_number, nullptr);
+				if (connection == TOX_CONNECTION_NONE) {
+					continue; // keep what we had, it might be back soon
+				}
+#if defined(EXTRA_LOGGING) && EXTRA_LOGGING == 1
+				if (peer.relayed != (connection == TOX_CONNECTION_TCP)) {
+					fprintf(stderr, "FT: peer %u:%u is now %s\n", group_number, peer_number, connection == TOX_CONNECTION_TCP ? "relayed" : "direct");
+				}
+#endif
+				peer.relayed = connection == TOX_CONNECTION_TCP;
+			}
+		}
+	}
+}
+
+static void _send_transfer_done(Tox* tox, NGC_FT1* ngc_ft1_ctx, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id, uint32_t file_kind, bool complete) {
+	// even if complete, the peer might not have popped all data yet and keeps the recv transfer around
+	ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number].send_transfer_ids_released[transfer_id] = 0.f;
+
+	NGC_FT1_send_done_cb* fn_ptr = nullptr;
+	if (ngc_ft1_ctx->cb_send_done.count(file_kind)) {
+		fn_ptr = ngc_ft1_ctx->cb_send_done.at(file_kind);
+	}
+	void* ud_ptr = nullptr;
+	if (ngc_ft1_ctx->ud_send_done.count(file_kind)) {
+		ud_ptr = ngc_ft1_ctx->ud_send_done.at(file_kind);
+	}
+	if (fn_ptr) {
+		fn_ptr(tox, group_number, peer_number, transfer_id, complete, ud_ptr);
+	}
+}
+
+// the target delay of the cca, the cca raises it further with the jitter it sees
+static void _update_target_delay(const NGC_FT1_options& options, NGC_FT1::Group::Peer& peer) {
+	const float target_min = options.target_delay_min > 0.f ? options.target_delay_min : _TARGET_DELAY_MIN_DEFAULT;
+	const float target_max = std::max(target_min, options.target_delay_max > 0.f ? options.target_delay_max : _TARGET_DELAY_MAX_DEFAULT);
+
+	peer.cca.target_delay = std::min(peer.relayed ? target_min * _TARGET_DELAY_RELAYED_FACTOR : target_min, target_max);
+	peer.cca.target_delay_max = target_max;
+}
+
+static void _iterate(Tox *tox, NGC_FT1* ngc_ft1_ctx, NGC_FT1::Shard& shard, float time_delta) {
+	_send_read_completed(ngc_ft1_ctx, shard);
+
+	// resends of transfers that only keep the ranges are read into here
+	std::vector<uint8_t> reread_scratch;
+
+	for (auto& [group_number, group] : shard.groups) {
+		for (auto& [peer_number, peer] : group.peers) {
+			_update_target_delay(ngc_ft1_ctx->options, peer);
+
+			if (peer.v2_support == NGC_FT1::Group::Peer::V2Support::NO) {
+				peer.time_since_v2_fallback += time_delta;
+				if (peer.time_since_v2_fallback >= _V2_RETRY_INTERVAL) {
+					peer.v2_support = NGC_FT1::Group::Peer::V2Support::UNKNOWN;
+				}
+			}
+
+			for (auto it = peer.send_transfer_ids_released.begin(); it != peer.send_transfer_ids_released.end();) {
+				it->second += time_delta;
+				if (it->second >= ngc_ft1_ctx->options.sending_give_up_after + _EARLY_DATA_RELEASED_ID_MARGIN) {
+					it = peer.send_transfer_ids_released.erase(it);
+				} else {
+					it++;
+				}
+			}
+
+			auto timeouts = peer.cca.getTimeouts();
+			std::set<LEDBAT::SeqIDType> timeouts_set{timeouts.cbegin(), timeouts.cend()};
+
+			for (auto it = peer.send_transfers.begin(); it != peer.send_transfers.end();) {
+				const uint16_t idx = it->first;
+				{
+					auto& tf = it->second;
+
+					tf.time_since_activity += time_delta;
+
+					if (tf.read_async) {
+						_send_transfer_read_ahead(ngc_ft1_ctx, group_number, peer_number, idx, tf);
+					}
+
+					switch (tf.state) {
+						using State = NGC_FT1::Group::Peer::SendTransfer::State;
+						case State::INIT_SENT:
+							if (tf.time_since_activity >= ngc_ft1_ctx->options.init_retry_timeout_after) {
+								// early data was dropped by the peer by now
+								_discard_early_data(peer, idx, tf);
+
+								if (tf.inits_sent >= 3) {
+									// delete, timed out 3 times
+									fprintf(stderr, "FT: warning, ft init timed out, deleting\n");
+									const uint32_t file_kind = tf.file_kind;
+									it = peer.send_transfers.erase(it);
+									_send_transfer_done(tox, ngc_ft1_ctx, group_number, peer_number, idx, file_kind, false);
+									continue; // dangerous control flow
+								} else {
+									// timed out, resend
+									fprintf(stderr, "FT: warning, ft init timed out, resending\n");
+
+									using V2Support = NGC_FT1::Group::Peer::V2Support;
+									if (tf.v2 && peer.v2_support != V2Support::YES && idx < 256) {
+										// peer never sent us a v2 packet, assume it does not understand FT1_INIT2
+										fprintf(stderr, "FT: warning, falling back to v1 init\n");
+										peer.v2_support = V2Support::NO;
+										peer.time_since_v2_fallback = 0.f;
+										tf.v2 = false;
+										tf.ssb.seq_id_mask = 0xffff;
+										tf.compression_offered = false;
+										tf.fec_offered = false;
+										tf.one_way_delay_offered = false;
+									}
+
+									if (tf.v2) {
+										_send_pkg_FT1_INIT2(ngc_ft1_ctx, tox, group_number, peer_number, tf.file_kind, tf.file_size, idx, _send_transfer_init2_flags(tf), tf.file_id.data(), tf.file_id.size());
+									} else {
+										_send_pkg_FT1_INIT(ngc_ft1_ctx, tox, group_number, peer_number, tf.file_kind, tf.file_size, idx, tf.file_id.data(), tf.file_id.size());
+									}
+									tf.inits_sent++;
+									tf.time_since_activity = 0.f;
+								}
+							} else if (
+								ngc_ft1_ctx->options.optimistic_init_data &&
+								tf.v2 && peer.v2_support == NGC_FT1::Group::Peer::V2Support::YES &&
+								tf.inits_sent == 1 &&
+								!tf.compression_offered && !tf.one_way_delay_offered && // the segment format depends on the ack
+								!peer.send_transfer_ids_released.count(idx) // the id might still be in use on the peer
+							) {
+								// dont wait a rtt for the ack, the receiver buffers a few packets
+								const size_t early_max = _EARLY_DATA_MAX_SEGMENTS * (peer.cca.MAXIMUM_SEGMENT_DATA_SIZE - 3);
+								if (tf.file_size_current < early_max) {
+									_send_transfer_new_data(tox, ngc_ft1_ctx, group_number, peer_number, peer, idx, tf, std::min(peer.cca.canSend(), early_max - tf.file_size_current));
+								}
+							}
+							break;
+						case State::SENDING: {
+								tf.ssb.for_each(time_delta, [&](uint32_t id, SendSequenceBuffer::SSBEntry& entry) {
+									// no ack after 5 sec -> resend
+									//if (entry.time_since_activity >= ngc_ft1_ctx->options.sending_resend_without_ack_after) {
+									if (timeouts_set.count({idx, id})) {
+										// TODO: can fail
+										const auto& data = _send_transfer_segment(tox, ngc_ft1_ctx, group_number, peer_number, idx, tf, entry, reread_scratch);
+										_send_transfer_data(ngc_ft1_ctx, tox, group_number, peer_number, peer, idx, tf.v2, tf.one_way_delay, id, data.data(), data.size());
+										peer.cca.onLoss({idx, id}, false);
+										_send_transfer_fec_on_loss(peer, tf, id);
+										entry.time_since_activity = 0.f;
+										timeouts_set.erase({idx, id});
+									}
+								});
+
+								if (tf.time_since_activity >= ngc_ft1_ctx->options.sending_give_up_after) {
+									// no ack after 30sec, close ft
+									fprintf(stderr, "FT: warning, sending ft in progress timed out, deleting\n");
+
+									// clean up cca
+									tf.ssb.for_each(time_delta, [&](uint32_t id, SendSequenceBuffer::SSBEntry&) {
+										peer.cca.onLoss({idx, id}, true);
+										timeouts_set.erase({idx, id});
+									});
+
+									const uint32_t file_kind = tf.file_kind;
+									it = peer.send_transfers.erase(it);
+									_send_transfer_done(tox, ngc_ft1_ctx, group_number, peer_number, idx, file_kind, false);
+									continue; // dangerous control flow
+								}
+
+								_send_transfer_new_data(tox, ngc_ft1_ctx, group_number, peer_number, peer, idx, tf, peer.cca.canSend());
+
+								if (tf.fec_count > 0) {
+									tf.fec_time_since_first += time_delta;
+									if (tf.fec_time_since_first >= _FEC_MAX_GROUP_AGE * peer.cca.getCurrentDelay()) {
+										_send_transfer_fec_flush(tox, ngc_ft1_ctx, group_number, peer_number, idx, tf);
+									}
+								}
+							}
+							break;
+						case State::FINISHING: // we still have unacked packets
+							tf.ssb.for_each(time_delta, [&](uint32_t id, SendSequenceBuffer::SSBEntry& entry) {
+								// no ack after 5 sec -> resend
+								//if (entry.time_since_activity >= ngc_ft1_ctx->options.sending_resend_without_ack_after) {
+								if (timeouts_set.count({idx, id})) {
+									const auto& data = _send_transfer_segment(tox, ngc_ft1_ctx, group_number, peer_number, idx, tf, entry, reread_scratch);
+									_send_transfer_data(ngc_ft1_ctx, tox, group_number, peer_number, peer, idx, tf.v2, tf.one_way_delay, id, data.data(), data.size());
+									peer.cca.onLoss({idx, id}, false);
+									_send_transfer_fec_on_loss(peer, tf, id);
+									entry.time_since_activity = 0.f;
+									timeouts_set.erase({idx, id});
+								}
+							});
+
+							// tail loss probe, a lost last segment (or its ack) would wait for the timeouts,
+							// which need fresh delay samples. the ack of the probe (or FT1_DONE) ends the transfer
+							tf.time_since_tail_probe += time_delta;
+							if (
+								tf.ssb.size() > 0 &&
+								tf.time_since_tail_probe >= _TAIL_PROBE_DELAYS * peer.cca.getCurrentDelay() * float(1u << std::min(tf.tail_probes, _TAIL_PROBE_MAX_BACKOFF))
+							) {
+								// the newest segment, acks for it show up as soon as anything arrives
+								auto last = tf.ssb.entries.cbegin();
+								for (auto e_it = tf.ssb.entries.cbegin(); e_it != tf.ssb.entries.cend(); e_it++) {
+									if (_seq_id_before(last->first, e_it->first, tf.ssb.seq_id_mask)) {
+										last = e_it;
+									}
+								}
+#if defined(EXTRA_LOGGING) && EXTRA_LOGGING == 1
+								fprintf(stderr, "FT: tail probe %zu for seq %u of tf %u\n", tf.tail_probes, last->first, idx);
+#endif
+								const auto& data = _send_transfer_segment(tox, ngc_ft1_ctx, group_number, peer_number, idx, tf, last->second, reread_scratch);
+								_send_transfer_data(ngc_ft1_ctx, tox, group_number, peer_number, peer, idx, tf.v2, tf.one_way_delay, last->first, data.data(), data.size());
+								peer.cca.onResend({idx, last->first});
+								tf.tail_probes++;
+								tf.time_since_tail_probe = 0.f;
+							}
+
+							if (tf.time_since_activity >= ngc_ft1_ctx->options.sending_give_up_after) {
+								// no ack after 30sec, close ft
+								fprintf(stderr, "FT: warning, sending ft finishing timed out, deleting\n");
+
+								// clean up cca
+								tf.ssb.for_each(time_delta, [&](uint32_t id, SendSequenceBuffer::SSBEntry&) {
+									peer.cca.onLoss({idx, id}, true);
+									timeouts_set.erase({idx, id});
+								});
+
+								const uint32_t file_kind = tf.file_kind;
+								it = peer.send_transfers.erase(it);
+								_send_transfer_done(tox, ngc_ft1_ctx, group_number, peer_number, idx, file_kind, false);
+								continue; // dangerous control flow
+							}
+							break;
+						default: // invalid state, delete
+							fprintf(stderr, "FT: error, ft in invalid state, deleting\n");
+							it = peer.send_transfers.erase(it);
+							continue;
+					}
+				}
+				it++;
+			}
+
+			for (auto& early : peer.early_data) {
+				early.time_since_recv += time_delta;
+			}
+			while (!peer.early_data.empty() && peer.early_data.front().time_since_recv >= _EARLY_DATA_TIMEOUT) {
+				peer.early_data.pop_front();
+			}
+
+			for (auto it = peer.recv_transfers.begin(); it != peer.recv_transfers.end();) {
+				auto& tf = it->second;
+				tf.time_since_activity += time_delta;
+
+				if (tf.state == NGC_FT1::Group::Peer::RecvTransfer::State::RECV && ngc_ft1_ctx->recvAsync(tf.file_kind)) {
+					// the app might have made room
+					_recv_transfer_pop(tox, ngc_ft1_ctx, group_number, peer_number, it->first, tf);
+
+					// the sender stops at a closed window, tell it, once it is open again
+					if (
+						tf.advertise_window && !tf.rsb.ack_seq_ids.empty() &&
+						tf.rsb.window() >= tf.advertised_window + tf.rsb.max_bytes/4
+					) {
+						tf.frame_acks.push_back(tf.rsb.ack_seq_ids.back());
+						peer.frame_ack_transfers.insert(it->first);
+						tf.advertised_window = tf.rsb.window(); // not to send it again before the flush
+						tf.time_since_window_update = 0.f;
+					} else if (tf.time_since_window_update >= 0.f) {
+						tf.time_since_window_update += time_delta;
+						if (tf.time_since_window_update >= _RECV_WINDOW_UPDATE_REPEAT) {
+							tf.frame_acks.push_back(tf.rsb.ack_seq_ids.back());
+							peer.frame_ack_transfers.insert(it->first);
+							tf.time_since_window_update = 0.f;
+						}
+					}
+				}
+
+				// the sender gives up after the same time, and done transfers are kept around to ack resends
+				if (tf.time_since_activity >= ngc_ft1_ctx->options.sending_give_up_after) {
+					if (tf.file_size_current != tf.file_size) {
+						fprintf(stderr, "FT: warning, receiving ft timed out, deleting\n");
+					}
+					it = peer.recv_transfers.erase(it);
+				} else {
+					it++;
+				}
+			}
+
+			_flush_frames(ngc_ft1_ctx, tox, group_number, peer_number, peer);
+		}
+	}
+}
+
+void NGC_FT1_set_recv_async_file_kind(NGC_FT1* ngc_ft1_ctx, uint32_t file_kind, bool enabled) {
+	assert(ngc_ft1_ctx);
+
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return;
+	}
+
+	if (enabled) {
+		ngc_ft1_ctx->recv_async_file_kinds.insert(file_kind);
+	} else {
+		ngc_ft1_ctx->recv_async_file_kinds.erase(file_kind);
+	}
+}
+
+bool NGC_FT1_recv_async_pop(NGC_FT1* ngc_ft1_ctx, uint32_t timeout_ms, struct NGC_FT1_recv_span* span_out) {
+	assert(ngc_ft1_ctx);
+	assert(span_out);
+
+	RecvQueue::Span span;
+	const uint8_t* data {nullptr};
+	size_t data_size {0};
+	if (!ngc_ft1_ctx->recv_queue.pop(std::chrono::milliseconds(timeout_ms), span, data, data_size)) {
+		return false;
+	}
+
+	span_out->file_kind = span.file_kind;
+	span_out->group_number = span.group_number;
+	span_out->peer_number = span.peer_number;
+	span_out->transfer_id = span.transfer_id;
+	span_out->data_offset = span.data_offset;
+	span_out->data = data;
+	span_out->data_size = data_size;
+	span_out->done = span.done;
+	span_out->verified = span.verified;
+
+	return true;
+}
+
+void NGC_FT1_recv_async_release(NGC_FT1* ngc_ft1_ctx, const struct NGC_FT1_recv_span* span) {
+	assert(ngc_ft1_ctx);
+	assert(span);
+
+	ngc_ft1_ctx->recv_queue.release(span->data);
+}
+
+void NGC_FT1_set_send_async_file_kind(NGC_FT1* ngc_ft1_ctx, uint32_t file_kind, bool enabled) {
+	assert(ngc_ft1_ctx);
+
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return;
+	}
+
+	if (enabled) {
+		ngc_ft1_ctx->send_async_file_kinds.insert(file_kind);
+	} else {
+		ngc_ft1_ctx->send_async_file_kinds.erase(file_kind);
+	}
+}
+
+void NGC_FT1_set_send_reread_file_kind(NGC_FT1* ngc_ft1_ctx, uint32_t file_kind, bool enabled) {
+	assert(ngc_ft1_ctx);
+
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return;
+	}
+
+	if (enabled) {
+		ngc_ft1_ctx->send_reread_file_kinds.insert(file_kind);
+	} else {
+		ngc_ft1_ctx->send_reread_file_kinds.erase(file_kind);
+	}
+}
+
+bool NGC_FT1_send_async_pop(NGC_FT1* ngc_ft1_ctx, uint32_t timeout_ms, struct NGC_FT1_send_read* read_out) {
+	assert(ngc_ft1_ctx);
+	assert(read_out);
+
+	SendReadQueue::Read read;
+	uint8_t* data {nullptr};
+	size_t data_size {0};
+	if (!ngc_ft1_ctx->send_read_queue.pop(std::chrono::milliseconds(timeout_ms), read, data, data_size)) {
+		return false;
+	}
+
+	read_out->file_kind = read.file_kind;
+	read_out->group_number = read.group_number;
+	read_out->peer_number = read.peer_number;
+	read_out->transfer_id = read.transfer_id;
+	read_out->data_offset = read.data_offset;
+	read_out->data = data;
+	read_out->data_size = data_size;
+
+	return true;
+}
+
+void NGC_FT1_send_async_complete(NGC_FT1* ngc_ft1_ctx, const struct NGC_FT1_send_read* read) {
+	assert(ngc_ft1_ctx);
+	assert(read);
+
+	ngc_ft1_ctx->send_read_queue.complete(read->data);
+}
+
+void NGC_FT1_set_cache_file_kind(NGC_FT1* ngc_ft1_ctx, uint32_t file_kind, bool enabled) {
+	assert(ngc_ft1_ctx);
+
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return;
+	}
+
+	if (enabled) {
+		ngc_ft1_ctx->cache_file_kinds.insert(file_kind);
+	} else {
+		ngc_ft1_ctx->cache_file_kinds.erase(file_kind);
+	}
+}
+
+void NGC_FT1_get_cache_stats(const NGC_FT1* ngc_ft1_ctx, NGC_FT1_cache_stats* stats_out) {
+	assert(ngc_ft1_ctx);
+	assert(stats_out);
+
+	std::lock_guard lock(ngc_ft1_ctx->cache_mutex);
+
+	stats_out->hits = ngc_ft1_ctx->cache.hits;
+	stats_out->misses = ngc_ft1_ctx->cache.misses;
+	stats_out->entries = ngc_ft1_ctx->cache.entries();
+	stats_out->bytes = ngc_ft1_ctx->cache.bytes();
+}
+
+void NGC_FT1_register_callback_recv_request(
+	NGC_FT1* ngc_ft1_ctx,
+	uint32_t file_kind,
+	NGC_FT1_recv_request_cb* callback,
+	void* user_data
+) {
+	assert(ngc_ft1_ctx);
+
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return;
+	}
+
+	ngc_ft1_ctx->cb_recv_request[file_kind] = callback;
+	ngc_ft1_ctx->ud_recv_request[file_kind] = user_data;
+}
+
+void NGC_FT1_register_callback_recv_request_batch(
+	NGC_FT1* ngc_ft1_ctx,
+	uint32_t file_kind,
+	NGC_FT1_recv_request_batch_cb* callback,
+	void* user_data
+) {
+	assert(ngc_ft1_ctx);
+
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return;
+	}
+
+	ngc_ft1_ctx->cb_recv_request_batch[file_kind] = callback;
+	ngc_ft1_ctx->ud_recv_request_batch[file_kind] = user_data;
+}
+
+void NGC_FT1_register_callback_recv_init(
+	NGC_FT1* ngc_ft1_ctx,
+	uint32_t file_kind,
+	NGC_FT1_recv_init_cb* callback,
+	void* user_data
+) {
+	assert(ngc_ft1_ctx);
+
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return;
+	}
+
+	ngc_ft1_ctx->cb_recv_init[file_kind] = callback;
+	ngc_ft1_ctx->ud_recv_init[file_kind] = user_data;
+}
+
+void NGC_FT1_register_callback_recv_data(
+	NGC_FT1* ngc_ft1_ctx,
+	uint32_t file_kind,
+	NGC_FT1_recv_data_cb* callback,
+	void* user_data
+) {
+	assert(ngc_ft1_ctx);
+
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return;
+	}
+
+	ngc_ft1_ctx->cb_recv_data[file_kind] = callback;
+	ngc_ft1_ctx->ud_recv_data[file_kind] = user_data;
+}
+
+void NGC_FT1_register_callback_send_data(
+	NGC_FT1* ngc_ft1_ctx,
+	uint32_t file_kind,
+	NGC_FT1_send_data_cb* callback,
+	void* user_data
+) {
+	assert(ngc_ft1_ctx);
+
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return;
+	}
+
+	ngc_ft1_ctx->cb_send_data[file_kind] = callback;
+	ngc_ft1_ctx->ud_send_data[file_kind] = user_data;
+}
+
+void NGC_FT1_register_callback_send_done(
+	NGC_FT1* ngc_ft1_ctx,
+	uint32_t file_kind,
+	NGC_FT1_send_done_cb* callback,
+	void* user_data
+) {
+	assert(ngc_ft1_ctx);
+
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return;
+	}
+
+	ngc_ft1_ctx->cb_send_done[file_kind] = callback;
+	ngc_ft1_ctx->ud_send_done[file_kind] = user_data;
+}
+
+void NGC_FT1_register_callback_recv_done(
+	NGC_FT1* ngc_ft1_ctx,
+	uint32_t file_kind,
+	NGC_FT1_recv_done_cb* callback,
+	void* user_data
+) {
+	assert(ngc_ft1_ctx);
+
+	std::vector<std::unique_lock<std::recursive_mutex>> locks;
+	if (!ngc_ft1_ctx->engineLockAll(locks)) {
+		return;
+	}
+
+	ngc_ft1_ctx->cb_recv_done[file_kind] = callback;
+	ngc_ft1_ctx->ud_recv_done[file_kind] = user_data;
+}
+
+void NGC_FT1_send_request_private(
+	Tox *tox, NGC_FT1* ngc_ft1_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	uint32_t file_kind,
+
+	const uint8_t* file_id,
+	size_t file_id_size
+) {
+	assert(tox);
+	assert(ngc_ft1_ctx);
+
+	std::unique_lock<std::recursive_mutex> lock;
+	if (!ngc_ft1_ctx->engineLock(group_number, peer_number, lock)) {
+		return;
+	}
+
+	// record locally that we sent(or want to send) the request?
+
+	_send_pkg_FT1_REQUEST(ngc_ft1_ctx, tox, group_number, peer_number, file_kind, file_id, file_id_size);
+}
+
+void NGC_FT1_send_request_batch_private(
+	Tox *tox, NGC_FT1* ngc_ft1_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	uint32_t file_kind,
+
+	const uint8_t* file_ids,
+	size_t file_id_size,
+	size_t count
+) {
+	assert(tox);
+	assert(ngc_ft1_ctx);
+
+	std::unique_lock<std::recursive_mutex> lock;
+	if (!ngc_ft1_ctx->engineLock(group_number, peer_number, lock)) {
+		return;
+	}
+
+	if (count == 0) {
+		return;
+	}
+
+	// peers that dont know the batch packet would drop it
+	// and the file_id_size has to fit into a byte
+	const auto& peer = ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number];
+	if (peer.v2_support != NGC_FT1::Group::Peer::V2Support::YES || file_id_size == 0 || file_id_size > 0xff) {
+		for (size_t i = 0; i < count; i++) {
+			_send_pkg_FT1_REQUEST(ngc_ft1_ctx, tox, group_number, peer_number, file_kind, file_ids + i*file_id_size, file_id_size);
+		}
+		return;
+	}
+
+	const size_t ids_per_packet = _REQUEST_BATCH_MAX_IDS_SIZE / file_id_size;
+	for (size_t i = 0; i < count; i += ids_per_packet) {
+		_send_pkg_FT1_REQUEST_BATCH(ngc_ft1_ctx, tox, group_number, peer_number, file_kind, file_ids + i*file_id_size, file_id_size, std::min(ids_per_packet, count - i));
+	}
+}
+
+bool NGC_FT1_send_init_private(
+	Tox *tox, NGC_FT1* ngc_ft1_ctx,
+	uint32_t group_number, uint32_t peer_number,
+	uint32_t file_kind,
+	const uint8_t* file_id, size_t file_id_size,
+	size_t file_size,
+	uint16_t* transfer_id
+) {
+	//fprintf(stderr, "TODO: init ft for %08X\n", msg_id);
+	//fprintf(stderr, "FT: init ft\n");
+
+	std::unique_lock<std::recursive_mutex> lock;
+	if (!ngc_ft1_ctx->engineLock(group_number, peer_number, lock)) {
+		return false;
+	}
+
+	// in threaded mode this might not be the tox thread, the init times out instead
+	if (!ngc_ft1_ctx->options.threaded && tox_group_peer_get_connection_status(tox, group_number, peer_number, nullptr) == TOX_CONNECTION_NONE) {
+		fprintf(stderr, "FT: error: cant init ft, peer offline\n");
+		return false;
+	}
+
+	auto& peer = ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number];
+
+	const bool v2 = peer.v2_support != NGC_FT1::Group::Peer::V2Support::NO;
+
+	// allocate transfer_id
+	// while we dont know if the peer speaks v2, stay in the v1 range, so we can fall back
+	const size_t transfer_id_count = peer.v2_support == NGC_FT1::Group::Peer::V2Support::YES ? 0x10000 : 0x100;
+	size_t idx = peer.next_send_transfer_idx % transfer_id_count;
+	peer.next_send_transfer_idx = (idx + 1) % transfer_id_count;
+	{ // TODO: extract
+		size_t i = idx;
+		bool found = false;
+		do {
+			if (!peer.send_transfers.count(i)) {
+				// free slot
+				idx = i;
+				found = true;
+				break;
+			}
+
+			i = (i + 1) % transfer_id_count;
+		} while (i != idx);
+
+		if (!found) {
+			fprintf(stderr, "FT: error: cant init ft, no free transfer slot\n");
+			return false;
+		}
+	}
+
+
+	peer.send_transfers[idx] = NGC_FT1::Group::Peer::SendTransfer{
+		file_kind,
+		std::vector(file_id, file_id+file_id_size),
+		NGC_FT1::Group::Peer::SendTransfer::State::INIT_SENT,
+		1,
+		0.f,
+		file_size,
+		0,
+		v2,
+	};
+	auto& transfer = peer.send_transfers.at(idx);
+	transfer.read_async = ngc_ft1_ctx->sendAsync(file_kind);
+	// the read ahead is dropped once sent, so async transfers keep their segments
+	transfer.reread = ngc_ft1_ctx->sendReread(file_kind) && !transfer.read_async;
+	if (v2) {
+		transfer.ssb.seq_id_mask = 0xffffffff;
+		// compressed segments are not a plain file range
+		transfer.compression_offered = ngc_ft1_ctx->compressionOffered() && !transfer.reread;
+		transfer.fec_offered = ngc_ft1_ctx->options.fec;
+		transfer.one_way_delay_offered = ngc_ft1_ctx->options.one_way_delay;
+
+		_send_pkg_FT1_INIT2(ngc_ft1_ctx, tox, group_number, peer_number, file_kind, file_size, idx, _send_transfer_init2_flags(transfer), file_id, file_id_size);
+	} else {
+		_send_pkg_FT1_INIT(ngc_ft1_ctx, tox, group_number, peer_number, file_kind, file_size, idx, file_id, file_id_size);
+	}
+
+	if (ngc_ft1_ctx->cacheEnabled(file_kind) && file_size > 0 && file_size <= ngc_ft1_ctx->cache.maxEntrySize()) {
+		transfer.cache_filling = true;
+		transfer.cache_fill.reserve(file_size);
+	}
+
+	if (transfer_id != nullptr) {
+		*transfer_id = idx;
+	}
+
+	return true;
+}
+
+bool NGC_FT1_send_inline_private(
+	Tox *tox, NGC_FT1* ngc_ft1_ctx,
+	uint32_t group_number, uint32_t peer_number,
+	uint32_t file_kind,
+	const uint8_t* file_id, size_t file_id_size,
+	const uint8_t* data, size_t data_size
+) {
+	assert(tox);
+	assert(ngc_ft1_ctx);
+
+	std::unique_lock<std::recursive_mutex> lock;
+	if (!ngc_ft1_ctx->engineLock(group_number, peer_number, lock)) {
+		return false;
+	}
+
+	if (file_id_size > 0xff || file_id_size + data_size > _INIT_DATA_MAX_PAYLOAD_SIZE) {
+		return false;
+	}
+
+	// peers that dont know the packet would drop it
+	const auto& peer = ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number];
+	if (peer.v2_support != NGC_FT1::Group::Peer::V2Support::YES) {
+		return false;
+	}
+
+	// in threaded mode this might not be the tox thread
+	if (!ngc_ft1_ctx->options.threaded && tox_group_peer_get_connection_status(tox, group_number, peer_number, nullptr) == TOX_CONNECTION_NONE) {
+		fprintf(stderr, "FT: error: cant send inline, peer offline\n");
+		return false;
+	}
+
+	if (!_send_pkg_FT1_INIT_DATA(ngc_ft1_ctx, tox, group_number, peer_number, file_kind, file_id, file_id_size, data, data_size)) {
+		return false;
+	}
+
+	if (ngc_ft1_ctx->cacheEnabled(file_kind)) {
+		ngc_ft1_ctx->cachePut({file_kind, std::vector(file_id, file_id+file_id_size)}, std::vector(data, data+data_size));
+	}
+
+	return true;
+}
+
+static bool _send_pkg(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, bool lossless, std::vector<uint8_t>&& pkg) {
+	if (ngc_ft1_ctx->options.threaded) {
+		// sent by the tox thread in NGC_FT1_iterate, fails like a full send queue
+		return ngc_ft1_ctx->shardOf(group_number, peer_number).engine_out.push({0, group_number, peer_number, lossless, std::move(pkg)});
+	}
+
+	return tox_group_send_custom_private_packet(tox, group_number, peer_number, lossless, pkg.data(), pkg.size(), nullptr);
+}
+
+static bool _send_pkg_FT1_REQUEST(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, const uint8_t* file_id, size_t file_id_size) {
+	// - 1 byte packet id
+	// - 4 byte file_kind
+	// - X bytes file_id
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_REQUEST);
+	for (size_t i = 0; i < sizeof(file_kind); i++) {
+		pkg.push_back((file_kind>>(i*8)) & 0xff);
+	}
+	for (size_t i = 0; i < file_id_size; i++) {
+		pkg.push_back(file_id[i]);
+	}
+
+	// lossless
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, true, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_INIT(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, uint64_t file_size, uint8_t transfer_id, const uint8_t* file_id, size_t file_id_size) {
+	// - 1 byte packet id
+	// - 4 byte (file_kind)
+	// - 8 bytes (data size)
+	// - 1 byte (temporary_file_tf_id, for this peer only, technically just a prefix to distinguish between simultainious fts)
+	// - X bytes (file_kind dependent id, differnt sizes)
+
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_INIT);
+	for (size_t i = 0; i < sizeof(file_kind); i++) {
+		pkg.push_back((file_kind>>(i*8)) & 0xff);
+	}
+	for (size_t i = 0; i < sizeof(file_size); i++) {
+		pkg.push_back((file_size>>(i*8)) & 0xff);
+	}
+	pkg.push_back(transfer_id);
+	for (size_t i = 0; i < file_id_size; i++) {
+		pkg.push_back(file_id[i]);
+	}
+
+	// lossless
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, true, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_INIT_ACK(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id) {
+	// send ack
+	// - 1 byte packet id
+	// - 1 byte transfer_id
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_INIT_ACK);
+	pkg.push_back(transfer_id);
+
+	// lossless
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, true, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_DATA(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id, uint16_t sequence_id, const uint8_t* data, size_t data_size) {
+	assert(data_size > 0);
+
+	// TODO
+	// check header_size+data_size <= max pkg size
+
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_DATA);
+	pkg.push_back(transfer_id);
+	pkg.push_back(sequence_id & 0xff);
+	pkg.push_back((sequence_id >> (1*8)) & 0xff);
+
+	// TODO: optimize
+	for (size_t i = 0; i < data_size; i++) {
+		pkg.push_back(data[i]);
+	}
+
+	// lossy
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, false, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_DATA_ACK(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint8_t transfer_id, const uint32_t* seq_ids, size_t seq_ids_size) {
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_DATA_ACK);
 	pkg.push_back(transfer_id);
 
-	// TODO: optimize
-	for (size_t i = 0; i < seq_ids_size; i++) {
-		pkg.push_back(seq_ids[i] & 0xff);
-		pkg.push_back((seq_ids[i] >> (1*8)) & 0xff);
-	}
+	// TODO: optimize
+	for (size_t i = 0; i < seq_ids_size; i++) {
+		pkg.push_back(seq_ids[i] & 0xff);
+		pkg.push_back((seq_ids[i] >> (1*8)) & 0xff);
+	}
+
+	// lossy
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, false, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_INIT2(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, uint64_t file_size, uint16_t transfer_id, uint8_t flags, const uint8_t* file_id, size_t file_id_size) {
+	// - 1 byte packet id
+	// - 4 byte (file_kind)
+	// - 8 bytes (data size)
+	// - 2 bytes (temporary_file_tf_id)
+	// - 1 byte (feature flags, the receiver acks the ones it supports)
+	// - X bytes (file_kind dependent id, differnt sizes)
+
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_INIT2);
+	for (size_t i = 0; i < sizeof(file_kind); i++) {
+		pkg.push_back((file_kind>>(i*8)) & 0xff);
+	}
+	for (size_t i = 0; i < sizeof(file_size); i++) {
+		pkg.push_back((file_size>>(i*8)) & 0xff);
+	}
+	pkg.push_back(transfer_id & 0xff);
+	pkg.push_back((transfer_id >> (1*8)) & 0xff);
+	pkg.push_back(flags);
+	for (size_t i = 0; i < file_id_size; i++) {
+		pkg.push_back(file_id[i]);
+	}
+
+	// lossless
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, true, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_INIT_ACK2(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id, uint8_t flags) {
+	// - 1 byte packet id
+	// - 2 bytes transfer_id
+	// - 1 byte (accepted feature flags)
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_INIT_ACK2);
+	pkg.push_back(transfer_id & 0xff);
+	pkg.push_back((transfer_id >> (1*8)) & 0xff);
+	pkg.push_back(flags);
+
+	// lossless
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, true, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_DATA2(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id, uint32_t sequence_id, bool has_timestamp, uint32_t timestamp, const uint8_t* data, size_t data_size) {
+	assert(data_size > 0);
+
+	// - 1 byte packet id
+	// - 2 bytes transfer_id
+	// - 4 bytes (sequence_id)
+	// - 4 bytes (timestamp) (if negotiated)
+	// - X bytes data
+	std::vector<uint8_t> pkg;
+	pkg.reserve(1+sizeof(transfer_id)+sizeof(sequence_id)+sizeof(timestamp)+data_size);
+	pkg.push_back(NGC_EXT::FT1_DATA2);
+	pkg.push_back(transfer_id & 0xff);
+	pkg.push_back((transfer_id >> (1*8)) & 0xff);
+	for (size_t i = 0; i < sizeof(sequence_id); i++) {
+		pkg.push_back((sequence_id>>(i*8)) & 0xff);
+	}
+	if (has_timestamp) {
+		for (size_t i = 0; i < sizeof(timestamp); i++) {
+			pkg.push_back((timestamp>>(i*8)) & 0xff);
+		}
+	}
+	pkg.insert(pkg.end(), data, data+data_size);
+
+	// lossy
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, false, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_DATA_ACK2(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id, bool has_window, size_t window, bool has_timestamps, uint32_t timestamp_sent, uint32_t timestamp_arrived, const uint32_t* seq_ids, size_t seq_ids_size) {
+	// - 1 byte packet id
+	// - 2 bytes transfer_id
+	// - 1 byte flags (_INIT2_FLAG_RECV_WINDOW and _INIT2_FLAG_ONE_WAY_DELAY, for what follows, and _DATA_ACK2_FLAG_REBUILT)
+	// - 4 bytes receive window (if negotiated)
+	// - 4 bytes timestamp of the newest segment (if negotiated)
+	// - 4 bytes timestamp of when it arrived, 0 for none (if negotiated)
+	// - array of 4 byte sequence_ids
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_DATA_ACK2);
+	pkg.push_back(transfer_id & 0xff);
+	pkg.push_back((transfer_id >> (1*8)) & 0xff);
+	pkg.push_back((has_window ? _INIT2_FLAG_RECV_WINDOW : 0) | (has_timestamps ? _INIT2_FLAG_ONE_WAY_DELAY : 0));
+	if (has_window) {
+		const uint32_t window_32 = std::min<size_t>(window, UINT32_MAX);
+		for (size_t i = 0; i < sizeof(window_32); i++) {
+			pkg.push_back((window_32>>(i*8)) & 0xff);
+		}
+	}
+	if (has_timestamps) {
+		for (size_t i = 0; i < sizeof(timestamp_sent); i++) {
+			pkg.push_back((timestamp_sent>>(i*8)) & 0xff);
+		}
+		for (size_t i = 0; i < sizeof(timestamp_arrived); i++) {
+			pkg.push_back((timestamp_arrived>>(i*8)) & 0xff);
+		}
+	}
+
+	for (size_t i = 0; i < seq_ids_size; i++) {
+		for (size_t j = 0; j < sizeof(uint32_t); j++) {
+			pkg.push_back((seq_ids[i]>>(j*8)) & 0xff);
+		}
+	}
+
+	// lossy
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, false, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_REQUEST_BATCH(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, const uint8_t* file_ids, size_t file_id_size, size_t count) {
+	// - 1 byte packet id
+	// - 4 byte file_kind
+	// - 1 byte file_id_size
+	// - array of file_ids (count * file_id_size bytes)
+	assert(file_id_size > 0 && file_id_size <= 0xff);
+	assert(count * file_id_size <= _REQUEST_BATCH_MAX_IDS_SIZE);
+
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_REQUEST_BATCH);
+	for (size_t i = 0; i < sizeof(file_kind); i++) {
+		pkg.push_back((file_kind>>(i*8)) & 0xff);
+	}
+	pkg.push_back(file_id_size);
+	pkg.insert(pkg.end(), file_ids, file_ids + count*file_id_size);
+
+	// lossless
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, true, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_INIT_DATA(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint32_t file_kind, const uint8_t* file_id, size_t file_id_size, const uint8_t* data, size_t data_size) {
+	// - 1 byte packet id
+	// - 4 byte file_kind
+	// - 1 byte file_id_size
+	// - X bytes file_id
+	// - rest is the whole file
+	assert(file_id_size <= 0xff);
+	assert(file_id_size + data_size <= _INIT_DATA_MAX_PAYLOAD_SIZE);
+
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_INIT_DATA);
+	for (size_t i = 0; i < sizeof(file_kind); i++) {
+		pkg.push_back((file_kind>>(i*8)) & 0xff);
+	}
+	pkg.push_back(file_id_size);
+	pkg.insert(pkg.end(), file_id, file_id + file_id_size);
+	pkg.insert(pkg.end(), data, data + data_size);
+
+	// lossless
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, true, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_FEC(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id, uint32_t first_seq_id, uint8_t count, uint16_t size_xor, const uint8_t* parity, size_t parity_size) {
+	// - 1 byte packet id
+	// - 2 byte transfer_id
+	// - 4 byte first sequence_id of the group
+	// - 1 byte number of segments in the group (consecutive sequence_ids)
+	// - 2 byte xor of the segment sizes
+	// - xor of the segments, zero padded to the largest
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_FEC);
+	for (size_t i = 0; i < sizeof(transfer_id); i++) {
+		pkg.push_back((transfer_id>>(i*8)) & 0xff);
+	}
+	for (size_t i = 0; i < sizeof(first_seq_id); i++) {
+		pkg.push_back((first_seq_id>>(i*8)) & 0xff);
+	}
+	pkg.push_back(count);
+	for (size_t i = 0; i < sizeof(size_xor); i++) {
+		pkg.push_back((size_xor>>(i*8)) & 0xff);
+	}
+	pkg.insert(pkg.end(), parity, parity + parity_size);
+
+	// lossy
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, false, std::move(pkg));
+}
+
+static bool _send_pkg_FT1_DONE(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, uint16_t transfer_id) {
+	// - 1 byte packet id
+	// - 2 byte transfer_id
+	std::vector<uint8_t> pkg;
+	pkg.push_back(NGC_EXT::FT1_DONE);
+	for (size_t i = 0; i < sizeof(transfer_id); i++) {
+		pkg.push_back((transfer_id>>(i*8)) & 0xff);
+	}
+
+	// lossless
+	return _send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, true, std::move(pkg));
+}
+
+static bool _send_transfer_data(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, NGC_FT1::Group::Peer& peer, uint16_t transfer_id, bool v2, bool timestamp, uint32_t sequence_id, const uint8_t* data, size_t data_size) {
+	const size_t timestamp_size = timestamp ? sizeof(uint32_t) : 0;
+	if (v2 && peer.v2_support == NGC_FT1::Group::Peer::V2Support::YES && _FRAME_RECORD_HEADER_SIZE + 2 + 4 + timestamp_size + data_size <= _FRAME_MAX_RECORDS_SIZE) {
+		// small enough to share a packet, sent at the end of iterate
+		std::vector<uint8_t> record;
+		record.push_back(NGC_EXT::FT1_DATA2);
+		const size_t body_size = 2 + 4 + timestamp_size + data_size;
+		record.push_back(body_size & 0xff);
+		record.push_back((body_size >> 8) & 0xff);
+		for (size_t i = 0; i < sizeof(transfer_id); i++) {
+			record.push_back((transfer_id>>(i*8)) & 0xff);
+		}
+		for (size_t i = 0; i < sizeof(sequence_id); i++) {
+			record.push_back((sequence_id>>(i*8)) & 0xff);
+		}
+		if (timestamp) {
+			const uint32_t now = _timestamp_now();
+			for (size_t i = 0; i < sizeof(now); i++) {
+				record.push_back((now>>(i*8)) & 0xff);
+			}
+		}
+		record.insert(record.end(), data, data + data_size);
+		peer.frame_records.push_back(std::move(record));
+		return true;
+	} else if (v2) {
+		return _send_pkg_FT1_DATA2(ngc_ft1_ctx, tox, group_number, peer_number, transfer_id, sequence_id, timestamp, _timestamp_now(), data, data_size);
+	} else {
+		assert(transfer_id < 256);
+		return _send_pkg_FT1_DATA(ngc_ft1_ctx, tox, group_number, peer_number, transfer_id, sequence_id, data, data_size);
+	}
+}
+
+// true if the request was answered from the cache
+static bool _serve_request_from_cache(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	uint32_t file_kind,
+	const uint8_t* file_id, size_t file_id_size
+) {
+	if (!ngc_ft1_ctx->cacheEnabled(file_kind)) {
+		return false;
+	}
+
+	auto cached = ngc_ft1_ctx->cacheGet({file_kind, std::vector(file_id, file_id+file_id_size)});
+	if (!cached) {
+		return false;
+	}
+
+	if (NGC_FT1_send_inline_private(tox, ngc_ft1_ctx, group_number, peer_number, file_kind, file_id, file_id_size, cached->data(), cached->size())) {
+		return true;
+	}
+
+	uint16_t transfer_id {0};
+	if (!NGC_FT1_send_init_private(tox, ngc_ft1_ctx, group_number, peer_number, file_kind, file_id, file_id_size, cached->size(), &transfer_id)) {
+		// no transfer slot (or the peer is gone), let the app have a go at it
+		return false;
+	}
+
+	auto& transfer = ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number].send_transfers.at(transfer_id);
+	transfer.cache_data = std::move(cached);
+	transfer.read_async = false;
+	transfer.cache_filling = false;
+	transfer.cache_fill = {};
+
+	return true;
+}
+
+static void _flush_frames(NGC_FT1* ngc_ft1_ctx, const Tox* tox, uint32_t group_number, uint32_t peer_number, NGC_FT1::Group::Peer& peer) {
+	// acks first, they are small and time sensitive
+	std::vector<std::vector<uint8_t>> records;
+	for (const uint16_t transfer_id : peer.frame_ack_transfers) {
+		auto t_it = peer.recv_transfers.find(transfer_id);
+		if (t_it == peer.recv_transfers.end()) {
+			continue;
+		}
+		auto& transfer = t_it->second;
+
+		std::vector<uint32_t> seq_ids = transfer.frame_acks_prev;
+		seq_ids.insert(seq_ids.end(), transfer.frame_acks.cbegin(), transfer.frame_acks.cend());
+		transfer.frame_acks_prev = std::move(transfer.frame_acks);
+		transfer.frame_acks.clear();
+
+		// acks of rebuilt segments go last, into records of their own
+		const size_t rebuilt_first = std::stable_partition(seq_ids.begin(), seq_ids.end(), [&transfer](uint32_t seq_id) {
+			return !transfer.fec_rebuilt.count(seq_id);
+		}) - seq_ids.begin();
+
+		const size_t window_size = transfer.advertise_window ? 4 : 0;
+		transfer.advertised_window = transfer.rsb.window();
+		const uint32_t window = std::min<size_t>(transfer.advertised_window, UINT32_MAX);
+		const size_t timestamps_size = transfer.one_way_delay ? 8 : 0;
+		const uint8_t flags = (transfer.advertise_window ? _INIT2_FLAG_RECV_WINDOW : 0) | (transfer.one_way_delay ? _INIT2_FLAG_ONE_WAY_DELAY : 0);
+		const size_t max_seq_ids_per_record = (_FRAME_MAX_RECORDS_SIZE - _FRAME_RECORD_HEADER_SIZE - 2 - 1 - window_size - timestamps_size) / 4;
+		for (const bool rebuilt : {false, true}) {
+			const size_t end = rebuilt ? seq_ids.size() : rebuilt_first;
+			for (size_t i = rebuilt ? rebuilt_first : 0; i < end; i += max_seq_ids_per_record) {
+				const size_t count = std::min(max_seq_ids_per_record, end - i);
+				const size_t body_size = 2 + 1 + window_size + timestamps_size + count*4;
+
+				std::vector<uint8_t> record;
+				record.push_back(NGC_EXT::FT1_DATA_ACK2);
+				record.push_back(body_size & 0xff);
+				record.push_back((body_size >> 8) & 0xff);
+				record.push_back(transfer_id & 0xff);
+				record.push_back((transfer_id >> 8) & 0xff);
+				record.push_back(flags | (rebuilt ? _DATA_ACK2_FLAG_REBUILT : 0));
+				for (size_t k = 0; k < window_size; k++) {
+					record.push_back((window>>(k*8)) & 0xff);
+				}
+				if (transfer.one_way_delay) {
+					// only the first record carries the sample
+					const uint32_t arrived = i == 0 && !rebuilt ? transfer.timestamp_arrived : 0;
+					for (size_t k = 0; k < sizeof(uint32_t); k++) {
+						record.push_back((transfer.timestamp_sent>>(k*8)) & 0xff);
+					}
+					for (size_t k = 0; k < sizeof(uint32_t); k++) {
+						record.push_back((arrived>>(k*8)) & 0xff);
+					}
+				}
+				for (size_t j = i; j < i + count; j++) {
+					for (size_t k = 0; k < sizeof(uint32_t); k++) {
+						record.push_back((seq_ids[j]>>(k*8)) & 0xff);
+					}
+				}
+				records.push_back(std::move(record));
+			}
+		}
+		if (!seq_ids.empty()) {
+			transfer.timestamp_arrived = 0;
+		}
+	}
+	peer.frame_ack_transfers.clear();
+
+	records.insert(records.end(), std::make_move_iterator(peer.frame_records.begin()), std::make_move_iterator(peer.frame_records.end()));
+	peer.frame_records.clear();
+
+	// send a frame, a frame of 1 record is sent as the plain packet instead
+	auto send_frame = [&](const std::vector<const std::vector<uint8_t>*>& frame) {
+		if (frame.size() == 1) {
+			const auto& record = *frame.front();
+			std::vector<uint8_t> pkg;
+			pkg.push_back(record.front());
+			pkg.insert(pkg.end(), record.cbegin() + _FRAME_RECORD_HEADER_SIZE, record.cend());
+			// lossy
+			_send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, false, std::move(pkg));
+			return;
+		}
+
+		// - 1 byte packet id
+		// - array of records
+		//   - 1 byte packet id (FT1_DATA2 or FT1_DATA_ACK2)
+		//   - 2 byte size
+		//   - size bytes, the packet without packet id
+		std::vector<uint8_t> pkg;
+		pkg.push_back(NGC_EXT::FT1_FRAME);
+		for (const auto* record : frame) {
+			pkg.insert(pkg.end(), record->cbegin(), record->cend());
+		}
+		// lossy
+		_send_pkg(ngc_ft1_ctx, tox, group_number, peer_number, false, std::move(pkg));
+	};
+
+	std::vector<const std::vector<uint8_t>*> frame;
+	size_t frame_size {0};
+	for (const auto& record : records) {
+		if (frame_size + record.size() > _FRAME_MAX_RECORDS_SIZE) {
+			send_frame(frame);
+			frame.clear();
+			frame_size = 0;
+		}
+		frame.push_back(&record);
+		frame_size += record.size();
+	}
+	if (!frame.empty()) {
+		send_frame(frame);
+	}
+}
+
+#define _DATA_HAVE(x, error) if ((length - curser) < (x)) { error; }
+
+static void _handle_FT1_REQUEST(
+	Tox* tox,
+	NGC_EXT_CTX* ngc_ext_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	const uint8_t *data,
+	size_t length,
+	void* user_data
+) {
+	NGC_FT1* ngc_ft1_ctx = static_cast<NGC_FT1*>(user_data);
+	size_t curser = 0;
+
+	uint32_t file_kind {0u};
+	_DATA_HAVE(sizeof(file_kind), fprintf(stderr, "FT: packet too small, missing file_kind\n"); return)
+	for (size_t i = 0; i < sizeof(file_kind); i++, curser++) {
+		file_kind |= uint32_t(data[curser]) << (i*8);
+	}
+
+	fprintf(stderr, "FT: got FT request with file_kind %u [", file_kind);
+	for (size_t curser_copy = curser; curser_copy < length; curser_copy++) {
+		fprintf(stderr, "%02X", data[curser_copy]);
+	}
+	fprintf(stderr, "]\n");
+
+	if (_serve_request_from_cache(tox, ngc_ft1_ctx, group_number, peer_number, file_kind, data+curser, length-curser)) {
+		return;
+	}
+
+	NGC_FT1_recv_request_cb* fn_ptr = nullptr;
+	if (ngc_ft1_ctx->cb_recv_request.count(file_kind)) {
+		fn_ptr = ngc_ft1_ctx->cb_recv_request.at(file_kind);
+	}
+	void* ud_ptr = nullptr;
+	if (ngc_ft1_ctx->ud_recv_request.count(file_kind)) {
+		ud_ptr = ngc_ft1_ctx->ud_recv_request.at(file_kind);
+	}
+	if (fn_ptr) {
+		fn_ptr(tox, group_number, peer_number, data+curser, length-curser, ud_ptr);
+	} else {
+		fprintf(stderr, "FT: missing cb for requests\n");
+	}
+}
+
+static void _handle_FT1_REQUEST_BATCH(
+	Tox* tox,
+	NGC_EXT_CTX* ngc_ext_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	const uint8_t *data,
+	size_t length,
+	void* user_data
+) {
+	NGC_FT1* ngc_ft1_ctx = static_cast<NGC_FT1*>(user_data);
+	size_t curser = 0;
+
+	// batching is newer than the v2 packets
+	ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number].v2_support = NGC_FT1::Group::Peer::V2Support::YES;
+
+	// - 4 byte (file_kind)
+	uint32_t file_kind {0u};
+	_DATA_HAVE(sizeof(file_kind), fprintf(stderr, "FT: packet too small, missing file_kind\n"); return)
+	for (size_t i = 0; i < sizeof(file_kind); i++, curser++) {
+		file_kind |= uint32_t(data[curser]) << (i*8);
+	}
+
+	// - 1 byte (file_id_size)
+	_DATA_HAVE(sizeof(uint8_t), fprintf(stderr, "FT: packet too small, missing file_id_size\n"); return)
+	const size_t file_id_size = data[curser++];
+
+	// - array of file_ids
+	if (file_id_size == 0 || (length - curser) % file_id_size != 0) {
+		fprintf(stderr, "FT: request batch with misaligned file_ids\n");
+		return;
+	}
+	const size_t count = (length - curser) / file_id_size;
+
+	fprintf(stderr, "FT: got FT request batch with file_kind %u and %zu ids\n", file_kind, count);
+
+	std::vector<uint8_t> remaining;
+	remaining.reserve(length - curser);
+	for (size_t i = 0; i < count; i++) {
+		const uint8_t* file_id = data + curser + i*file_id_size;
+		if (!_serve_request_from_cache(tox, ngc_ft1_ctx, group_number, peer_number, file_kind, file_id, file_id_size)) {
+			remaining.insert(remaining.end(), file_id, file_id + file_id_size);
+		}
+	}
+	if (remaining.empty()) {
+		return;
+	}
+
+	if (ngc_ft1_ctx->cb_recv_request_batch.count(file_kind) && ngc_ft1_ctx->cb_recv_request_batch.at(file_kind)) {
+		void* ud_ptr = ngc_ft1_ctx->ud_recv_request_batch.count(file_kind) ? ngc_ft1_ctx->ud_recv_request_batch.at(file_kind) : nullptr;
+		ngc_ft1_ctx->cb_recv_request_batch.at(file_kind)(tox, group_number, peer_number, remaining.data(), file_id_size, remaining.size() / file_id_size, ud_ptr);
+		return;
+	}
+
+	// fall back to one call per id
+	NGC_FT1_recv_request_cb* fn_ptr = nullptr;
+	if (ngc_ft1_ctx->cb_recv_request.count(file_kind)) {
+		fn_ptr = ngc_ft1_ctx->cb_recv_request.at(file_kind);
+	}
+	void* ud_ptr = nullptr;
+	if (ngc_ft1_ctx->ud_recv_request.count(file_kind)) {
+		ud_ptr = ngc_ft1_ctx->ud_recv_request.at(file_kind);
+	}
+	if (!fn_ptr) {
+		fprintf(stderr, "FT: missing cb for requests\n");
+		return;
+	}
+	for (size_t offset = 0; offset < remaining.size(); offset += file_id_size) {
+		fn_ptr(tox, group_number, peer_number, remaining.data() + offset, file_id_size, ud_ptr);
+	}
+}
+
+static NGC_FT1::Group::Peer::RecvTransfer& _recv_transfer_create(
+	NGC_FT1* ngc_ft1_ctx,
+	NGC_FT1::Group::Peer& peer,
+
+	uint16_t transfer_id,
+	uint32_t file_kind,
+	const std::vector<uint8_t>& file_id,
+	size_t file_size,
+	bool v2
+) {
+	peer.recv_transfers[transfer_id] = NGC_FT1::Group::Peer::RecvTransfer{
+		file_kind,
+		file_id,
+		NGC_FT1::Group::Peer::RecvTransfer::State::INITED,
+		0.f,
+		file_size,
+		0u,
+		v2,
+	};
+	auto& transfer = peer.recv_transfers.at(transfer_id);
+	if (v2) {
+		transfer.rsb.seq_id_mask = 0xffffffff;
+	}
+	transfer.rsb.max_bytes = ngc_ft1_ctx->options.recv_window_size > 0 ? ngc_ft1_ctx->options.recv_window_size : _RECV_WINDOW_SIZE_DEFAULT;
+
+	if (file_kind == NGC_FT1_file_kind::TORRENT_V2_PIECE) {
+		transfer.verifier.emplace<SHA256>();
+	} else if (file_kind == NGC_FT1_file_kind::TORRENT_V2_FILE_HASHES) {
+		transfer.verifier.emplace<MerkleRootBuilder>();
+	}
+
+	// unverified data could be anything, so only verifiable kinds are cached on receive
+	if (
+		!std::holds_alternative<std::monostate>(transfer.verifier) &&
+		ngc_ft1_ctx->cacheEnabled(file_kind) &&
+		file_size > 0 && file_size <= ngc_ft1_ctx->cache.maxEntrySize()
+	) {
+		transfer.cache_filling = true;
+		transfer.cache_fill.reserve(file_size);
+	}
+
+	return transfer;
+}
+
+static void _handle_FT1_DATA_impl(Tox* tox, NGC_FT1* ngc_ft1_ctx, uint32_t group_number, uint32_t peer_number, const uint8_t *data, size_t length, bool v2);
+
+// v1 and v2 only differ in the header, v2 has a 2 byte transfer_id followed by a flags byte
+static void _handle_FT1_INIT_impl(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	const uint8_t *data,
+	size_t length,
+
+	bool v2
+) {
+	size_t curser = 0;
+
+	// - 4 byte (file_kind)
+	uint32_t file_kind {0u};
+	_DATA_HAVE(sizeof(file_kind), fprintf(stderr, "FT: packet too small, missing file_kind\n"); return)
+	for (size_t i = 0; i < sizeof(file_kind); i++, curser++) {
+		file_kind |= uint32_t(data[curser]) << (i*8);
+	}
+
+	// - 8 bytes (data size)
+	size_t file_size {0u};
+	_DATA_HAVE(sizeof(file_size), fprintf(stderr, "FT: packet too small, missing file_size\n"); return)
+	for (size_t i = 0; i < sizeof(file_size); i++, curser++) {
+		file_size |= size_t(data[curser]) << (i*8);
+	}
+
+	// - 1 or 2 bytes (temporary_file_tf_id, for this peer only, technically just a prefix to distinguish between simultainious fts)
+	const size_t transfer_id_size = v2 ? sizeof(uint16_t) : sizeof(uint8_t);
+	uint16_t transfer_id {0u};
+	_DATA_HAVE(transfer_id_size, fprintf(stderr, "FT: packet too small, missing transfer_id\n"); return)
+	for (size_t i = 0; i < transfer_id_size; i++, curser++) {
+		transfer_id |= uint16_t(data[curser]) << (i*8);
+	}
+
+	// - 1 byte (feature flags) (v2 only)
+	uint8_t flags {0u};
+	if (v2) {
+		_DATA_HAVE(sizeof(flags), fprintf(stderr, "FT: packet too small, missing flags\n"); return)
+		flags = data[curser++];
+	}
+
+	// - X bytes (file_kind dependent id, differnt sizes)
+
+	const std::vector file_id(data+curser, data+curser+(length-curser));
+	fprintf(stderr, "FT: got FT init%s with file_kind:%u file_size:%lu tf_id:%u flags:%02X [", v2 ? "2" : "", file_kind, file_size, transfer_id, flags);
+	for (size_t curser_copy = curser; curser_copy < length; curser_copy++) {
+		fprintf(stderr, "%02X", data[curser_copy]);
+	}
+	fprintf(stderr, "]\n");
+
+	// check if slot free ?
+	// did we allready ack this and the other side just did not see the ack?
+
+	NGC_FT1_recv_init_cb* fn_ptr = nullptr;
+	if (ngc_ft1_ctx->cb_recv_init.count(file_kind)) {
+		fn_ptr = ngc_ft1_ctx->cb_recv_init.at(file_kind);
+	}
+	void* ud_ptr = nullptr;
+	if (ngc_ft1_ctx->ud_recv_init.count(file_kind)) {
+		ud_ptr = ngc_ft1_ctx->ud_recv_init.at(file_kind);
+	}
+	bool accept_ft;
+	if (fn_ptr) {
+		// last part of message (file_id) is not yet parsed, just give it to cb
+		accept_ft = fn_ptr(tox, group_number, peer_number, data+curser, length-curser, transfer_id, file_size, ud_ptr);
+	} else {
+		fprintf(stderr, "FT: missing cb for init\n");
+		accept_ft = false;
+	}
+
+	if (accept_ft) {
+		uint8_t accepted_flags {0u};
+		if ((flags & _INIT2_FLAG_COMPRESSION) && SegmentCompressor::available()) {
+			accepted_flags |= _INIT2_FLAG_COMPRESSION;
+		}
+		if (flags & _INIT2_FLAG_FEC) {
+			accepted_flags |= _INIT2_FLAG_FEC;
+		}
+		if (flags & _INIT2_FLAG_RECV_WINDOW) {
+			accepted_flags |= _INIT2_FLAG_RECV_WINDOW;
+		}
+		if (flags & _INIT2_FLAG_ONE_WAY_DELAY) {
+			accepted_flags |= _INIT2_FLAG_ONE_WAY_DELAY;
+		}
+		if (flags & _INIT2_FLAG_DONE) {
+			accepted_flags |= _INIT2_FLAG_DONE;
+		}
+
+		if (v2) {
+			_send_pkg_FT1_INIT_ACK2(ngc_ft1_ctx, tox, group_number, peer_number, transfer_id, accepted_flags);
+		} else {
+			_send_pkg_FT1_INIT_ACK(ngc_ft1_ctx, tox, group_number, peer_number, transfer_id);
+		}
+#if defined(EXTRA_LOGGING) && EXTRA_LOGGING == 1
+		fprintf(stderr, "FT: accepted init\n");
+#endif
+		auto& peer = ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number];
+		if (peer.recv_transfers.count(transfer_id)) {
+			fprintf(stderr, "FT: overwriting existing recv_transfer %d\n", transfer_id);
+		}
+
+		auto& transfer = _recv_transfer_create(ngc_ft1_ctx, peer, transfer_id, file_kind, file_id, file_size, v2);
+		transfer.compressed = accepted_flags & _INIT2_FLAG_COMPRESSION;
+		transfer.fec = accepted_flags & _INIT2_FLAG_FEC;
+		transfer.advertise_window = accepted_flags & _INIT2_FLAG_RECV_WINDOW;
+		transfer.one_way_delay = accepted_flags & _INIT2_FLAG_ONE_WAY_DELAY;
+		transfer.confirm_done = accepted_flags & _INIT2_FLAG_DONE;
+
+		// data that arrived before the init
+		std::vector<std::vector<uint8_t>> early_pkgs;
+		for (auto e_it = peer.early_data.begin(); e_it != peer.early_data.end();) {
+			if (e_it->transfer_id == transfer_id) {
+				early_pkgs.push_back(std::move(e_it->pkg));
+				e_it = peer.early_data.erase(e_it);
+			} else {
+				e_it++;
+			}
+		}
+		if (v2) {
+			for (const auto& pkg : early_pkgs) {
+				_handle_FT1_DATA_impl(tox, ngc_ft1_ctx, group_number, peer_number, pkg.data(), pkg.size(), true);
+			}
+		}
+	} else {
+		// TODO deny?
+		fprintf(stderr, "FT: rejected init\n");
+
+		auto& peer = ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number];
+		peer.early_data.erase(
+			std::remove_if(peer.early_data.begin(), peer.early_data.end(), [transfer_id](const auto& e) { return e.transfer_id == transfer_id; }),
+			peer.early_data.end()
+		);
+	}
+}
+
+static void _handle_FT1_INIT(
+	Tox* tox,
+	NGC_EXT_CTX* ngc_ext_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	const uint8_t *data,
+	size_t length,
+	void* user_data
+) {
+	_handle_FT1_INIT_impl(tox, static_cast<NGC_FT1*>(user_data), group_number, peer_number, data, length, false);
+}
+
+static void _handle_FT1_INIT2(
+	Tox* tox,
+	NGC_EXT_CTX* ngc_ext_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	const uint8_t *data,
+	size_t length,
+	void* user_data
+) {
+	NGC_FT1* ngc_ft1_ctx = static_cast<NGC_FT1*>(user_data);
+	ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number].v2_support = NGC_FT1::Group::Peer::V2Support::YES;
+	_handle_FT1_INIT_impl(tox, ngc_ft1_ctx, group_number, peer_number, data, length, true);
+}
+
+static void _handle_FT1_INIT_ACK_impl(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	const uint8_t *data,
+	size_t length,
+
+	bool v2
+) {
+	size_t curser = 0;
+
+	// - 1 or 2 bytes (transfer_id)
+	const size_t transfer_id_size = v2 ? sizeof(uint16_t) : sizeof(uint8_t);
+	uint16_t transfer_id {0u};
+	_DATA_HAVE(transfer_id_size, fprintf(stderr, "FT: packet too small, missing transfer_id\n"); return)
+	for (size_t i = 0; i < transfer_id_size; i++, curser++) {
+		transfer_id |= uint16_t(data[curser]) << (i*8);
+	}
+
+	// - 1 byte (accepted feature flags) (v2 only)
+	uint8_t flags {0u};
+	if (v2) {
+		_DATA_HAVE(sizeof(flags), fprintf(stderr, "FT: packet too small, missing flags\n"); return)
+		flags = data[curser++];
+	}
+
+	// we now should start sending data
+
+	auto& groups = ngc_ft1_ctx->shardOf(group_number, peer_number).groups;
+	if (!groups.count(group_number)) {
+		fprintf(stderr, "FT: init_ack for unknown group\n");
+		return;
+	}
+
+	NGC_FT1::Group::Peer& peer = groups[group_number].peers[peer_number];
+	if (!peer.send_transfers.count(transfer_id)) {
+		fprintf(stderr, "FT: inti_ack for unknown transfer\n");
+		return;
+	}
+
+	NGC_FT1::Group::Peer::SendTransfer& transfer = peer.send_transfers.at(transfer_id);
+
+	if (transfer.v2 != v2) {
+		// we fell back to v1 and the peer acked the old init2 (or the other way around)
+		fprintf(stderr, "FT: init_ack version does not match init, ignoring\n");
+		return;
+	}
+
+	using State = NGC_FT1::Group::Peer::SendTransfer::State;
+	const bool implicitly_accepted = transfer.state != State::INIT_SENT && transfer.file_size_current > 0;
+	if (transfer.state != State::INIT_SENT && !implicitly_accepted) {
+		fprintf(stderr, "FT: inti_ack but not in INIT_SENT state\n");
+		return;
+	}
+
+	// flags the peer did not ack are off
+	// (early data is never compressed and has no timestamps, so it does not matter if it was acked before)
+	transfer.compressed = transfer.compression_offered && (flags & _INIT2_FLAG_COMPRESSION);
+	transfer.fec = transfer.fec_offered && (flags & _INIT2_FLAG_FEC);
+	transfer.one_way_delay = transfer.one_way_delay_offered && (flags & _INIT2_FLAG_ONE_WAY_DELAY);
+
+	if (implicitly_accepted) {
+		return; // allready accepted by acking optimistic data
+	}
+
+	// iterate will now call NGC_FT1_send_data_cb
+	transfer.state = State::SENDING;
+	transfer.time_since_activity = 0.f;
+}
+
+static void _handle_FT1_INIT_ACK(
+	Tox* tox,
+	NGC_EXT_CTX* ngc_ext_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	const uint8_t *data,
+	size_t length,
+	void* user_data
+) {
+	_handle_FT1_INIT_ACK_impl(tox, static_cast<NGC_FT1*>(user_data), group_number, peer_number, data, length, false);
+}
+
+static void _handle_FT1_INIT_ACK2(
+	Tox* tox,
+	NGC_EXT_CTX* ngc_ext_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	const uint8_t *data,
+	size_t length,
+	void* user_data
+) {
+	NGC_FT1* ngc_ft1_ctx = static_cast<NGC_FT1*>(user_data);
+	ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number].v2_support = NGC_FT1::Group::Peer::V2Support::YES;
+	_handle_FT1_INIT_ACK_impl(tox, ngc_ft1_ctx, group_number, peer_number, data, length, true);
+}
+
+// in order data, feeds the verifier and the cache and hands it to the app (or the recv_queue)
+static void _recv_transfer_deliver(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+	uint16_t transfer_id,
+
+	NGC_FT1::Group::Peer::RecvTransfer& transfer,
+	const uint8_t* data, size_t data_size
+) {
+	if (auto* sha256 = std::get_if<SHA256>(&transfer.verifier)) {
+		sha256->update(data, data_size);
+	} else if (auto* merkle = std::get_if<MerkleRootBuilder>(&transfer.verifier)) {
+		merkle->update(data, data_size);
+	}
+
+	if (transfer.cache_filling) {
+		transfer.cache_fill.insert(transfer.cache_fill.end(), data, data + data_size);
+	}
+
+	if (ngc_ft1_ctx->recvAsync(transfer.file_kind)) {
+		RecvQueue::Span span;
+		span.file_kind = transfer.file_kind;
+		span.group_number = group_number;
+		span.peer_number = peer_number;
+		span.transfer_id = transfer_id;
+		span.data_offset = transfer.file_size_current;
+		span.data = std::vector<uint8_t>(data, data + data_size);
+		ngc_ft1_ctx->recv_queue.push(std::move(span));
+	} else if (ngc_ft1_ctx->cb_recv_data.count(transfer.file_kind)) {
+		ngc_ft1_ctx->cb_recv_data.at(transfer.file_kind)(
+			tox,
+			group_number, peer_number,
+			transfer_id,
+			transfer.file_size_current, data, data_size,
+			ngc_ft1_ctx->ud_recv_data.count(transfer.file_kind) ? ngc_ft1_ctx->ud_recv_data.at(transfer.file_kind) : nullptr
+		);
+	}
+
+	transfer.file_size_current += data_size;
+}
+
+// checks the content against the file_id (if the file_kind is content addressed) and notifies the app
+static void _recv_transfer_done(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+	uint16_t transfer_id,
+
+	NGC_FT1::Group::Peer::RecvTransfer& transfer
+) {
+	bool verified = true;
+	if (transfer.file_size_current != transfer.file_size) {
+		// the peer sent more than it announced
+		verified = false;
+	} else if (auto* sha256 = std::get_if<SHA256>(&transfer.verifier)) {
+		const auto digest = sha256->finish();
+		verified = transfer.file_id.size() == digest.size() && std::equal(digest.cbegin(), digest.cend(), transfer.file_id.cbegin());
+	} else if (auto* merkle = std::get_if<MerkleRootBuilder>(&transfer.verifier)) {
+		MerkleRootBuilder::Digest root;
+		verified = merkle->finish(root) && transfer.file_id.size() == root.size() && std::equal(root.cbegin(), root.cend(), transfer.file_id.cbegin());
+	}
+	transfer.verifier = std::monostate{};
+
+	if (!verified) {
+		fprintf(stderr, "FT: warning, recv transfer %u failed verification\n", transfer_id);
+	} else if (transfer.cache_filling) {
+		ngc_ft1_ctx->cachePut({transfer.file_kind, transfer.file_id}, std::move(transfer.cache_fill));
+	}
+	transfer.cache_filling = false;
+	transfer.cache_fill = {};
+
+	if (ngc_ft1_ctx->recvAsync(transfer.file_kind)) {
+		// behind the data
+		RecvQueue::Span span;
+		span.file_kind = transfer.file_kind;
+		span.group_number = group_number;
+		span.peer_number = peer_number;
+		span.transfer_id = transfer_id;
+		span.data_offset = transfer.file_size_current;
+		span.done = true;
+		span.verified = verified;
+		ngc_ft1_ctx->recv_queue.push(std::move(span));
+		return;
+	}
+
+	NGC_FT1_recv_done_cb* fn_ptr = nullptr;
+	if (ngc_ft1_ctx->cb_recv_done.count(transfer.file_kind)) {
+		fn_ptr = ngc_ft1_ctx->cb_recv_done.at(transfer.file_kind);
+	}
+	void* ud_ptr = nullptr;
+	if (ngc_ft1_ctx->ud_recv_done.count(transfer.file_kind)) {
+		ud_ptr = ngc_ft1_ctx->ud_recv_done.at(transfer.file_kind);
+	}
+	if (fn_ptr) {
+		fn_ptr(tox, group_number, peer_number, transfer_id, verified, ud_ptr);
+	}
+}
+
+// delivers the in order data from the rsb, stops while the recv_queue is full
+static void _recv_transfer_pop(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+	uint16_t transfer_id,
+
+	NGC_FT1::Group::Peer::RecvTransfer& transfer
+) {
+	using State = NGC_FT1::Group::Peer::RecvTransfer::State;
+
+	// the data waits in the rsb, which shrinks the window
+	const bool async = ngc_ft1_ctx->recvAsync(transfer.file_kind);
+
+	// loop for chunks without holes
+	std::vector<uint8_t> decompressed;
+	while (transfer.state != State::DONE && transfer.rsb.canPop() && !(async && ngc_ft1_ctx->recv_queue.full())) {
+		auto data = transfer.rsb.pop();
+		if (transfer.compressed) {
+			decompressed.clear();
+			if (!ngc_ft1_ctx->shardOf(group_number, peer_number).compressor.decompress(data.data(), data.size(), transfer.file_size - transfer.file_size_current, decompressed)) {
+				// reported as failed, the rest is ignored
+				fprintf(stderr, "FT: error, invalid compressed segment in recv transfer %u\n", transfer_id);
+				transfer.state = State::DONE;
+				_recv_transfer_done(tox, ngc_ft1_ctx, group_number, peer_number, transfer_id, transfer);
+				break;
+			}
+			data = std::move(decompressed);
+		}
+		_recv_transfer_deliver(tox, ngc_ft1_ctx, group_number, peer_number, transfer_id, transfer, data.data(), data.size());
+	}
+
+	if (transfer.state == State::RECV && transfer.file_size_current >= transfer.file_size) {
+		transfer.state = State::DONE;
+		if (transfer.confirm_done) {
+			// the sender can stop right away, even if the last acks get lost
+			_send_pkg_FT1_DONE(ngc_ft1_ctx, tox, group_number, peer_number, transfer_id);
+		}
+		_recv_transfer_done(tox, ngc_ft1_ctx, group_number, peer_number, transfer_id, transfer);
+	}
+}
+
+// v1 uses 2 byte sequence_ids, v2 uses 4 byte sequence_ids
+static void _handle_FT1_DATA_impl(
+	Tox* tox,
+	NGC_FT1* ngc_ft1_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	const uint8_t *data, size_t length,
+
+	bool v2
+) {
+	size_t curser = 0;
+
+	// - 1 or 2 bytes (transfer_id)
+	const size_t transfer_id_size = v2 ? sizeof(uint16_t) : sizeof(uint8_t);
+	uint16_t transfer_id {0u};
+	_DATA_HAVE(transfer_id_size, fprintf(stderr, "FT: packet too small, missing transfer_id\n"); return)
+	for (size_t i = 0; i < transfer_id_size; i++, curser++) {
+		transfer_id |= uint16_t(data[curser]) << (i*8);
+	}
+
+	// - 2 or 4 bytes (sequence_id)
+	const size_t seq_id_size = v2 ? sizeof(uint32_t) : sizeof(uint16_t);
+	uint32_t sequence_id {0u};
+	_DATA_HAVE(seq_id_size, fprintf(stderr, "FT: packet too small, missing sequence_id\n"); return)
+	for (size_t i = 0; i < seq_id_size; i++, curser++) {
+		sequence_id |= uint32_t(data[curser]) << (i*8);
+	}
+
+	if (curser == length) {
+		fprintf(stderr, "FT: data of size 0!\n");
+		return;
+	}
+
+	auto& groups = ngc_ft1_ctx->shardOf(group_number, peer_number).groups;
+	if (!groups.count(group_number)) {
+		fprintf(stderr, "FT: data for unknown group\n");
+		return;
+	}
+
+	NGC_FT1::Group::Peer& peer = groups[group_number].peers[peer_number];
+
+	// might be optimistic data of a new transfer, replayed when the init arrives
+	// the id might still be taken by a done transfer, which would ack and drop it
+	const auto r_it = peer.recv_transfers.find(transfer_id);
+	const bool early = v2 && sequence_id < _EARLY_DATA_MAX_SEQ_ID && (
+		r_it == peer.recv_transfers.end() ||
+		r_it->second.state == NGC_FT1::Group::Peer::RecvTransfer::State::DONE
+	);
+	if (early) {
+		// an older transfer with the same id, that never got its init
+		peer.early_data.erase(
+			std::remove_if(peer.early_data.begin(), peer.early_data.end(), [transfer_id, sequence_id](const auto& e) {
+				return e.transfer_id == transfer_id && e.sequence_id == sequence_id;
+			}),
+			peer.early_data.end()
+		);
+
+		peer.early_data.push_back({transfer_id, sequence_id, std::vector(data, data+length)});
+		if (peer.early_data.size() > _EARLY_DATA_MAX_PACKETS) {
+			peer.early_data.pop_front();
+		}
+		return;
+	} else if (r_it == peer.recv_transfers.end()) {
+		fprintf(stderr, "FT: data for unknown transfer\n");
+		return;
+	}
+
+	auto& transfer = peer.recv_transfers.at(transfer_id);
+
+	if (transfer.v2 != v2) {
+		fprintf(stderr, "FT: data version does not match init\n");
+		return;
+	}
+
+	// - 4 bytes (timestamp) (if negotiated)
+	if (v2 && transfer.one_way_delay) {
+		uint32_t timestamp {0u};
+		_DATA_HAVE(sizeof(timestamp), fprintf(stderr, "FT: packet too small, missing timestamp\n"); return)
+		for (size_t i = 0; i < sizeof(timestamp); i++, curser++) {
+			timestamp |= uint32_t(data[curser]) << (i*8);
+		}
+		if (curser == length) {
+			fprintf(stderr, "FT: data of size 0!\n");
+			return;
+		}
+
+		// rebuilt segments have none
+		if (timestamp != 0) {
+			transfer.timestamp_sent = timestamp;
+			transfer.timestamp_arrived = _timestamp_now();
+		}
+	}
+
+	transfer.time_since_activity = 0.f;
+	transfer.time_since_window_update = -1.f; // the sender got it
+
+	if (transfer.fec) {
+		transfer.fec_segments[sequence_id] = std::vector<uint8_t>(data+curser, data+curser+(length-curser));
+		while (transfer.fec_segments.size() > _FEC_MAX_SEGMENTS_KEPT) {
+			transfer.fec_segments.erase(transfer.fec_segments.begin());
+		}
+	}
+
+	// do reassembly, ignore dups
+	if (!transfer.rsb.add(sequence_id, std::vector<uint8_t>(data+curser, data+curser+(length-curser)))) {
+#if defined(EXTRA_LOGGING) && EXTRA_LOGGING == 1
+		fprintf(stderr, "FT: recv window full, dropped seq %u\n", sequence_id);
+#endif
+		return;
+	}
+
+	if (!ngc_ft1_ctx->recvAsync(transfer.file_kind) && !ngc_ft1_ctx->cb_recv_data.count(transfer.file_kind)) {
+		fprintf(stderr, "FT: missing cb for recv_data\n");
+		return;
+	}
+
+	using State = NGC_FT1::Group::Peer::RecvTransfer::State;
+	if (transfer.state == State::INITED) {
+		transfer.state = State::RECV;
+	}
+
+	_recv_transfer_pop(tox, ngc_ft1_ctx, group_number, peer_number, transfer_id, transfer);
+
+	// send acks
+	if (v2 && peer.v2_support == NGC_FT1::Group::Peer::V2Support::YES) {
+		// coalesced and sent with the next flush
+		if (transfer.frame_acks.size() < _FRAME_MAX_ACKS_PER_TRANSFER) {
+			transfer.frame_acks.push_back(sequence_id);
+		}
+		peer.frame_ack_transfers.insert(transfer_id);
+		return;
+	}
+
+	std::vector<uint32_t> ack_seq_ids(transfer.rsb.ack_seq_ids.cbegin(), transfer.rsb.ack_seq_ids.cend());
+	if (!ack_seq_ids.empty()) {
+		if (v2) {
+			transfer.advertised_window = transfer.rsb.window();
+			_send_pkg_FT1_DATA_ACK2(ngc_ft1_ctx, tox, group_number, peer_number, transfer_id, transfer.advertise_window, transfer.advertised_window, transfer.one_way_delay, transfer.timestamp_sent, transfer.timestamp_arrived, ack_seq_ids.data(), ack_seq_ids.size());
+			transfer.timestamp_arrived = 0;
+		} else {
+			_send_pkg_FT1_DATA_ACK(ngc_ft1_ctx, tox, group_number, peer_number, transfer_id, ack_seq_ids.data(), ack_seq_ids.size());
+		}
+	}
+}
+
+static void _handle_FT1_DATA(
+	Tox* tox,
+	NGC_EXT_CTX* ngc_ext_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+
+	const uint8_t *data, size_t length,
+	void* user_data
+) {
+	_handle_FT1_DATA_impl(tox, static_cast<NGC_FT1*>(user_data), group_number, peer_number, data, length, false);
+}
+
+static void _handle_FT1_DATA2(
+	Tox* tox,
+	NGC_EXT_CTX* ngc_ext_ctx,
+
+	uint32_t group_number,
+	uint32_t peer_number,
 
-	// lossy
-	return tox_group_send_custom_private_packet(tox, group_number, peer_number, false, pkg.data(), pkg.size(), nullptr);
+	const uint8_t *data, size_t length,
+	void* user_data
+) {
+	_handle_FT1_DATA_impl(tox, static_cast<NGC_FT1*>(user_data), group_number, peer_number, data, length, true);
 }
 
-#define _DATA_HAVE(x, error) if ((length - curser) < (x)) { error; }
-
-static void _handle_FT1_REQUEST(
+// a whole (small) file in one lossless packet
+// to the app it looks like a transfer with a single recv_data call, on a currently unused transfer_id
+static void _handle_FT1_INIT_DATA(
 	Tox* tox,
 	NGC_EXT_CTX* ngc_ext_ctx,
 
 	uint32_t group_number,
 	uint32_t peer_number,
 
-	const uint8_t *data,
-	size_t length,
+	const uint8_t *data, size_t length,
 	void* user_data
 ) {
 	NGC_FT1* ngc_ft1_ctx = static_cast<NGC_FT1*>(user_data);
 	size_t curser = 0;
 
+	auto& peer = ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number];
+
+	// inline data is newer than the v2 packets
+	peer.v2_support = NGC_FT1::Group::Peer::V2Support::YES;
+
+	// - 4 byte (file_kind)
 	uint32_t file_kind {0u};
 	_DATA_HAVE(sizeof(file_kind), fprintf(stderr, "FT: packet too small, missing file_kind\n"); return)
 	for (size_t i = 0; i < sizeof(file_kind); i++, curser++) {
 		file_kind |= uint32_t(data[curser]) << (i*8);
 	}
 
-	fprintf(stderr, "FT: got FT request with file_kind %u [", file_kind);
-	for (size_t curser_copy = curser; curser_copy < length; curser_copy++) {
-		fprintf(stderr, "%02X", data[curser_copy]);
+	// - 1 byte (file_id_size)
+	_DATA_HAVE(sizeof(uint8_t), fprintf(stderr, "FT: packet too small, missing file_id_size\n"); return)
+	const size_t file_id_size = data[curser++];
+
+	// - X bytes (file_id)
+	_DATA_HAVE(file_id_size, fprintf(stderr, "FT: packet too small, missing file_id\n"); return)
+	const std::vector file_id(data+curser, data+curser+file_id_size);
+	curser += file_id_size;
+
+	// - rest (data)
+	const size_t file_size = length - curser;
+
+#if defined(EXTRA_LOGGING) && EXTRA_LOGGING == 1
+	fprintf(stderr, "FT: got FT init_data with file_kind:%u file_size:%lu\n", file_kind, file_size);
+#endif
+
+	// pick an id the app does not currently know, from the top so it does not collide with the sender allocating from 0
+	uint16_t transfer_id {0xffff};
+	while (peer.recv_transfers.count(transfer_id)) {
+		if (transfer_id == 0) {
+			fprintf(stderr, "FT: error: no free transfer_id for init_data\n");
+			return;
+		}
+		transfer_id--;
 	}
-	fprintf(stderr, "]\n");
 
-	NGC_FT1_recv_request_cb* fn_ptr = nullptr;
-	if (ngc_ft1_ctx->cb_recv_request.count(file_kind)) {
-		fn_ptr = ngc_ft1_ctx->cb_recv_request.at(file_kind);
+	NGC_FT1_recv_init_cb* init_fn_ptr = nullptr;
+	if (ngc_ft1_ctx->cb_recv_init.count(file_kind)) {
+		init_fn_ptr = ngc_ft1_ctx->cb_recv_init.at(file_kind);
 	}
-	void* ud_ptr = nullptr;
-	if (ngc_ft1_ctx->ud_recv_request.count(file_kind)) {
-		ud_ptr = ngc_ft1_ctx->ud_recv_request.at(file_kind);
+	if (!init_fn_ptr || (!ngc_ft1_ctx->recvAsync(file_kind) && !ngc_ft1_ctx->cb_recv_data.count(file_kind))) {
+		fprintf(stderr, "FT: missing cb for init_data\n");
+		return;
 	}
-	if (fn_ptr) {
-		fn_ptr(tox, group_number, peer_number, data+curser, length-curser, ud_ptr);
-	} else {
-		fprintf(stderr, "FT: missing cb for requests\n");
+
+	if (!init_fn_ptr(tox, group_number, peer_number, file_id.data(), file_id.size(), transfer_id, file_size, ngc_ft1_ctx->ud_recv_init.count(file_kind) ? ngc_ft1_ctx->ud_recv_init.at(file_kind) : nullptr)) {
+		fprintf(stderr, "FT: rejected init_data\n");
+		return;
+	}
+
+	auto& transfer = _recv_transfer_create(ngc_ft1_ctx, peer, transfer_id, file_kind, file_id, file_size, true);
+	transfer.state = NGC_FT1::Group::Peer::RecvTransfer::State::RECV;
+	if (file_size > 0) {
+		_recv_transfer_deliver(tox, ngc_ft1_ctx, group_number, peer_number, transfer_id, transfer, data+curser, file_size);
 	}
+	transfer.state = NGC_FT1::Group::Peer::RecvTransfer::State::DONE;
+	_recv_transfer_done(tox, ngc_ft1_ctx, group_number, peer_number, transfer_id, transfer);
+
+	// nothing to ack, lossless
+	peer.recv_transfers.erase(transfer_id);
 }
 
-static void _handle_FT1_INIT(
+static void _handle_FT1_DATA_ACK_impl(
 	Tox* tox,
-	NGC_EXT_CTX* ngc_ext_ctx,
+	NGC_FT1* ngc_ft1_ctx,
 
 	uint32_t group_number,
 	uint32_t peer_number,
 
 	const uint8_t *data,
 	size_t length,
-	void* user_data
+
+	bool v2
 ) {
-	NGC_FT1* ngc_ft1_ctx = static_cast<NGC_FT1*>(user_data);
 	size_t curser = 0;
 
-	// - 4 byte (file_kind)
-	uint32_t file_kind {0u};
-	_DATA_HAVE(sizeof(file_kind), fprintf(stderr, "FT: packet too small, missing file_kind\n"); return)
-	for (size_t i = 0; i < sizeof(file_kind); i++, curser++) {
-		file_kind |= uint32_t(data[curser]) << (i*8);
+	// - 1 or 2 bytes (transfer_id)
+	const size_t transfer_id_size = v2 ? sizeof(uint16_t) : sizeof(uint8_t);
+	uint16_t transfer_id {0u};
+	_DATA_HAVE(transfer_id_size, fprintf(stderr, "FT: packet too small, missing transfer_id\n"); return)
+	for (size_t i = 0; i < transfer_id_size; i++, curser++) {
+		transfer_id |= uint16_t(data[curser]) << (i*8);
 	}
 
-	// - 8 bytes (data size)
-	size_t file_size {0u};
-	_DATA_HAVE(sizeof(file_size), fprintf(stderr, "FT: packet too small, missing file_size\n"); return)
-	for (size_t i = 0; i < sizeof(file_size); i++, curser++) {
-		file_size |= size_t(data[curser]) << (i*8);
+	auto& groups = ngc_ft1_ctx->shardOf(group_number, peer_number).groups;
+	if (!groups.count(group_number)) {
+		fprintf(stderr, "FT: data_ack for unknown group\n");
+		return;
 	}
 
-	// - 1 byte (temporary_file_tf_id, for this peer only, technically just a prefix to distinguish between simultainious fts)
-	uint8_t transfer_id;
-	_DATA_HAVE(sizeof(transfer_id), fprintf(stderr, "FT: packet too small, missing transfer_id\n"); return)
-	transfer_id = data[curser++];
+	NGC_FT1::Group::Peer& peer = groups[group_number].peers[peer_number];
+	if (!peer.send_transfers.count(transfer_id)) {
+		// acks that were behind the FT1_DONE are normal
+#if defined(EXTRA_LOGGING) && EXTRA_LOGGING == 1
+		fprintf(stderr, "FT: data_ack for unknown transfer\n");
+#endif
+		return;
+	}
 
-	// - X bytes (file_kind dependent id, differnt sizes)
+	NGC_FT1::Group::Peer::SendTransfer& transfer = peer.send_transfers.at(transfer_id);
 
-	const std::vector file_id(data+curser, data+curser+(length-curser));
-	fprintf(stderr, "FT: got FT init with file_kind:%u file_size:%lu tf_id:%u [", file_kind, file_size, transfer_id);
-	for (size_t curser_copy = curser; curser_copy < length; curser_copy++) {
-		fprintf(stderr, "%02X", data[curser_copy]);
+	if (transfer.v2 != v2) {
+		fprintf(stderr, "FT: data_ack version does not match init\n");
+		return;
 	}
-	fprintf(stderr, "]\n");
 
-	// check if slot free ?
-	// did we allready ack this and the other side just did not see the ack?
+	using State = NGC_FT1::Group::Peer::SendTransfer::State;
+	if (transfer.state == State::INIT_SENT && transfer.ssb.size() > 0) {
+		// acked optimistic data, the init_ack is still underway
+		transfer.state = State::SENDING;
+	}
 
-	NGC_FT1_recv_init_cb* fn_ptr = nullptr;
-	if (ngc_ft1_ctx->cb_recv_init.count(file_kind)) {
-		fn_ptr = ngc_ft1_ctx->cb_recv_init.at(file_kind);
+	if (transfer.state != State::SENDING && transfer.state != State::FINISHING) {
+		fprintf(stderr, "FT: data_ack but not in SENDING or FINISHING state (%d)\n", int(transfer.state));
+		return;
 	}
-	void* ud_ptr = nullptr;
-	if (ngc_ft1_ctx->ud_recv_init.count(file_kind)) {
-		ud_ptr = ngc_ft1_ctx->ud_recv_init.at(file_kind);
+
+	// - 1 byte (flags, what follows and if the seq_ids were rebuilt) (v2 only)
+	// the layout does not depend on the init_ack, which might still be underway
+	uint8_t flags {0u};
+	if (v2) {
+		_DATA_HAVE(sizeof(flags), fprintf(stderr, "FT: packet too small, missing flags\n"); return)
+		flags = data[curser++];
 	}
-	bool accept_ft;
-	if (fn_ptr) {
-		// last part of message (file_id) is not yet parsed, just give it to cb
-		accept_ft = fn_ptr(tox, group_number, peer_number, data+curser, length-curser, transfer_id, file_size, ud_ptr);
-	} else {
-		fprintf(stderr, "FT: missing cb for init\n");
-		accept_ft = false;
+
+	// - 4 bytes (receive window) (v2 only, if negotiated)
+	if (flags & _INIT2_FLAG_RECV_WINDOW) {
+		uint32_t window {0u};
+		_DATA_HAVE(sizeof(window), fprintf(stderr, "FT: packet too small, missing window\n"); return)
+		for (size_t i = 0; i < sizeof(window); i++, curser++) {
+			window |= uint32_t(data[curser]) << (i*8);
+		}
+		transfer.recv_window = window;
 	}
 
-	if (accept_ft) {
-		_send_pkg_FT1_INIT_ACK(tox, group_number, peer_number, transfer_id);
-#if defined(EXTRA_LOGGING) && EXTRA_LOGGING == 1
-		fprintf(stderr, "FT: accepted init\n");
-#endif
-		auto& peer = ngc_ft1_ctx->groups[group_number].peers[peer_number];
-		if (peer.recv_transfers[transfer_id].has_value()) {
-			fprintf(stderr, "FT: overwriting existing recv_transfer %d\n", transfer_id);
+	// - 4 bytes (timestamp of the newest segment) (v2 only, if negotiated)
+	// - 4 bytes (timestamp of when it arrived, 0 for none) (v2 only, if negotiated)
+	uint32_t timestamp_sent {0u};
+	uint32_t timestamp_arrived {0u};
+	if (flags & _INIT2_FLAG_ONE_WAY_DELAY) {
+		_DATA_HAVE(sizeof(timestamp_sent) + sizeof(timestamp_arrived), fprintf(stderr, "FT: packet too small, missing timestamps\n"); return)
+		for (size_t i = 0; i < sizeof(timestamp_sent); i++, curser++) {
+			timestamp_sent |= uint32_t(data[curser]) << (i*8);
+		}
+		for (size_t i = 0; i < sizeof(timestamp_arrived); i++, curser++) {
+			timestamp_arrived |= uint32_t(data[curser]) << (i*8);
+		}
+	}
+
+	// - array of 2 or 4 byte sequence_ids
+	const size_t seq_id_size = v2 ? sizeof(uint32_t) : sizeof(uint16_t);
+
+	_DATA_HAVE(seq_id_size, fprintf(stderr, "FT: packet too small, atleast 1 seq_id\n"); return)
+
+	if ((length - curser) % seq_id_size != 0) {
+		fprintf(stderr, "FT: data_ack with misaligned data\n");
+		return;
+	}
+
+	transfer.time_since_activity = 0.f;
+	transfer.time_since_tail_probe = 0.f;
+	transfer.tail_probes = 0;
+
+	std::vector<LEDBAT::SeqIDType> seqs;
+	while (curser < length) {
+		uint32_t seq_id {0u};
+		for (size_t i = 0; i < seq_id_size; i++, curser++) {
+			seq_id |= uint32_t(data[curser]) << (i*8);
 		}
 
-		peer.recv_transfers[transfer_id] = NGC_FT1::Group::Peer::RecvTransfer{
-			file_kind,
-			file_id,
-			NGC_FT1::Group::Peer::RecvTransfer::State::INITED,
-			file_size,
-			0u,
-		};
+		seqs.push_back({transfer_id, seq_id});
+		transfer.ssb.erase(seq_id);
+		transfer.fec_lost_seq_ids.erase(seq_id);
+	}
+
+	if (timestamp_arrived != 0) {
+		// the difference of two unsynchronized clocks, made relative to the first one
+		// so it stays small and survives the timestamps wrapping around
+		const uint32_t one_way_delay = timestamp_arrived - timestamp_sent;
+		if (!peer.one_way_delay_reference_set) {
+			peer.one_way_delay_reference_set = true;
+			peer.one_way_delay_reference = one_way_delay;
+		}
+		peer.cca.onOneWayDelay(int32_t(one_way_delay - peer.one_way_delay_reference));
+	}
+
+	if (flags & _DATA_ACK2_FLAG_REBUILT) {
+		// rebuilt from parity, it is unknown when what they were rebuilt from arrived
+		peer.cca.onDelivered(seqs);
 	} else {
-		// TODO deny?
-		fprintf(stderr, "FT: rejected init\n");
+		peer.cca.onAck(seqs);
+	}
+
+	// delete if all packets acked
+	if (transfer.file_size == transfer.file_size_current && transfer.ssb.size() == 0) {
+		fprintf(stderr, "FT: %d done\n", transfer_id);
+		const uint32_t file_kind = transfer.file_kind;
+		peer.send_transfers.erase(transfer_id);
+		_send_transfer_done(tox, ngc_ft1_ctx, group_number, peer_number, transfer_id, file_kind, true);
 	}
 }
 
-static void _handle_FT1_INIT_ACK(
+static void _handle_FT1_DATA_ACK(
 	Tox* tox,
 	NGC_EXT_CTX* ngc_ext_ctx,
 
@@ -718,119 +3477,187 @@ static void _handle_FT1_INIT_ACK(
 	size_t length,
 	void* user_data
 ) {
-	NGC_FT1* ngc_ft1_ctx = static_cast<NGC_FT1*>(user_data);
-	size_t curser = 0;
+	_handle_FT1_DATA_ACK_impl(tox, static_cast<NGC_FT1*>(user_data), group_number, peer_number, data, length, false);
+}
 
-	// - 1 byte (transfer_id)
-	uint8_t transfer_id;
-	_DATA_HAVE(sizeof(transfer_id), fprintf(stderr, "FT: packet too small, missing transfer_id\n"); return)
-	transfer_id = data[curser++];
+static void _handle_FT1_DATA_ACK2(
+	Tox* tox,
+	NGC_EXT_CTX* ngc_ext_ctx,
 
-	// we now should start sending data
+	uint32_t group_number,
+	uint32_t peer_number,
 
-	auto& groups = ngc_ft1_ctx->groups;
-	if (!groups.count(group_number)) {
-		fprintf(stderr, "FT: init_ack for unknown group\n");
-		return;
-	}
+	const uint8_t *data,
+	size_t length,
+	void* user_data
+) {
+	_handle_FT1_DATA_ACK_impl(tox, static_cast<NGC_FT1*>(user_data), group_number, peer_number, data, length, true);
+}
 
-	NGC_FT1::Group::Peer& peer = groups[group_number].peers[peer_number];
-	if (!peer.send_transfers[transfer_id].has_value()) {
-		fprintf(stderr, "FT: inti_ack for unknown transfer\n");
-		return;
-	}
+static void _handle_FT1_FRAME(
+	Tox* tox,
+	NGC_EXT_CTX* ngc_ext_ctx,
 
-	NGC_FT1::Group::Peer::SendTransfer& transfer = peer.send_transfers[transfer_id].value();
+	uint32_t group_number,
+	uint32_t peer_number,
 
-	using State = NGC_FT1::Group::Peer::SendTransfer::State;
-	if (transfer.state != State::INIT_SENT) {
-		fprintf(stderr, "FT: inti_ack but not in INIT_SENT state\n");
-		return;
-	}
+	const uint8_t *data,
+	size_t length,
+	void* user_data
+) {
+	NGC_FT1* ngc_ft1_ctx = static_cast<NGC_FT1*>(user_data);
+	size_t curser = 0;
 
-	// iterate will now call NGC_FT1_send_data_cb
-	transfer.state = State::SENDING;
-	transfer.time_since_activity = 0.f;
+	// frames are newer than the v2 packets
+	ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number].v2_support = NGC_FT1::Group::Peer::V2Support::YES;
+
+	while (curser < length) {
+		// - 1 byte (packet id)
+		_DATA_HAVE(_FRAME_RECORD_HEADER_SIZE, fprintf(stderr, "FT: frame record too small, missing header\n"); return)
+		const uint8_t pkg_id = data[curser++];
+
+		// - 2 bytes (size)
+		size_t record_size {0u};
+		for (size_t i = 0; i < sizeof(uint16_t); i++, curser++) {
+			record_size |= size_t(data[curser]) << (i*8);
+		}
+		_DATA_HAVE(record_size, fprintf(stderr, "FT: frame record too small, missing body\n"); return)
+
+		// - size bytes (packet without id)
+		if (pkg_id == NGC_EXT::FT1_DATA2) {
+			_handle_FT1_DATA_impl(tox, ngc_ft1_ctx, group_number, peer_number, data+curser, record_size, true);
+		} else if (pkg_id == NGC_EXT::FT1_DATA_ACK2) {
+			_handle_FT1_DATA_ACK_impl(tox, ngc_ft1_ctx, group_number, peer_number, data+curser, record_size, true);
+		} else {
+			fprintf(stderr, "FT: frame record with unsupported packet id %u\n", pkg_id);
+		}
+		curser += record_size;
+	}
 }
 
-static void _handle_FT1_DATA(
+static void _handle_FT1_FEC(
 	Tox* tox,
 	NGC_EXT_CTX* ngc_ext_ctx,
 
 	uint32_t group_number,
 	uint32_t peer_number,
 
-	const uint8_t *data, size_t length,
+	const uint8_t *data,
+	size_t length,
 	void* user_data
 ) {
 	NGC_FT1* ngc_ft1_ctx = static_cast<NGC_FT1*>(user_data);
 	size_t curser = 0;
 
-	// - 1 byte (transfer_id)
-	uint8_t transfer_id;
-	_DATA_HAVE(sizeof(transfer_id), fprintf(stderr, "FT: packet too small, missing transfer_id\n"); return)
-	transfer_id = data[curser++];
-
-	// - 2 bytes (sequence_id)
-	uint16_t sequence_id;
-	_DATA_HAVE(sizeof(sequence_id), fprintf(stderr, "FT: packet too small, missing sequence_id\n"); return)
-	sequence_id = data[curser++];
-	sequence_id |= data[curser++] << (1*8);
+	// fec is newer than the v2 packets
+	NGC_FT1::Group::Peer& peer = ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number];
+	peer.v2_support = NGC_FT1::Group::Peer::V2Support::YES;
 
-	if (curser == length) {
-		fprintf(stderr, "FT: data of size 0!\n");
-		return;
+	// - 2 bytes (transfer_id)
+	uint16_t transfer_id {0u};
+	_DATA_HAVE(sizeof(transfer_id), fprintf(stderr, "FT: packet too small, missing transfer_id\n"); return)
+	for (size_t i = 0; i < sizeof(transfer_id); i++, curser++) {
+		transfer_id |= uint16_t(data[curser]) << (i*8);
 	}
 
-	auto& groups = ngc_ft1_ctx->groups;
-	if (!groups.count(group_number)) {
-		fprintf(stderr, "FT: data for unknown group\n");
-		return;
+	// - 4 bytes (first sequence_id)
+	uint32_t first_seq_id {0u};
+	_DATA_HAVE(sizeof(first_seq_id), fprintf(stderr, "FT: packet too small, missing sequence_id\n"); return)
+	for (size_t i = 0; i < sizeof(first_seq_id); i++, curser++) {
+		first_seq_id |= uint32_t(data[curser]) << (i*8);
 	}
 
-	NGC_FT1::Group::Peer& peer = groups[group_number].peers[peer_number];
-	if (!peer.recv_transfers[transfer_id].has_value()) {
-		fprintf(stderr, "FT: data for unknown transfer\n");
-		return;
-	}
+	// - 1 byte (count)
+	_DATA_HAVE(1, fprintf(stderr, "FT: packet too small, missing count\n"); return)
+	const uint8_t count = data[curser++];
 
-	auto& transfer = peer.recv_transfers[transfer_id].value();
+	// - 2 bytes (size xor)
+	uint16_t size_xor {0u};
+	_DATA_HAVE(sizeof(size_xor), fprintf(stderr, "FT: packet too small, missing size\n"); return)
+	for (size_t i = 0; i < sizeof(size_xor); i++, curser++) {
+		size_xor |= uint16_t(data[curser]) << (i*8);
+	}
 
-	// do reassembly, ignore dups
-	transfer.rsb.add(sequence_id, std::vector<uint8_t>(data+curser, data+curser+(length-curser)));
+	// - X bytes (parity)
+	const uint8_t* parity = data + curser;
+	const size_t parity_size = length - curser;
 
-	NGC_FT1_recv_data_cb* fn_ptr = nullptr;
-	if (ngc_ft1_ctx->cb_recv_data.count(transfer.file_kind)) {
-		fn_ptr = ngc_ft1_ctx->cb_recv_data.at(transfer.file_kind);
+	if (!peer.recv_transfers.count(transfer_id)) {
+		return; // might be done allready
 	}
-
-	void* ud_ptr = nullptr;
-	if (ngc_ft1_ctx->ud_recv_data.count(transfer.file_kind)) {
-		ud_ptr = ngc_ft1_ctx->ud_recv_data.at(transfer.file_kind);
+	auto& transfer = peer.recv_transfers.at(transfer_id);
+	if (!transfer.fec || transfer.state == NGC_FT1::Group::Peer::RecvTransfer::State::DONE) {
+		return;
 	}
 
-	if (!fn_ptr) {
-		fprintf(stderr, "FT: missing cb for recv_data\n");
+	// xor can only rebuild a single missing segment
+	bool missing {false};
+	uint32_t missing_seq_id {0u};
+	for (uint32_t i = 0; i < count; i++) {
+		const uint32_t seq_id = first_seq_id + i;
+		if (transfer.fec_segments.count(seq_id)) {
+			continue;
+		}
+		if (missing || _seq_id_before(seq_id, transfer.rsb.next_seq_id, transfer.rsb.seq_id_mask)) {
+			return; // more than one, or allready popped and forgotten
+		}
+		missing = true;
+		missing_seq_id = seq_id;
+	}
+	if (!missing) {
 		return;
 	}
 
-	// loop for chunks without holes
-	while (transfer.rsb.canPop()) {
-		auto data = transfer.rsb.pop();
+	std::vector<uint8_t> segment(parity, parity + parity_size);
+	uint16_t segment_size = size_xor;
+	for (uint32_t i = 0; i < count; i++) {
+		const uint32_t seq_id = first_seq_id + i;
+		if (seq_id == missing_seq_id) {
+			continue;
+		}
+		const auto& other = transfer.fec_segments.at(seq_id);
+		if (other.size() > segment.size()) {
+			fprintf(stderr, "FT: fec parity smaller than segment\n");
+			return;
+		}
+		for (size_t j = 0; j < other.size(); j++) {
+			segment[j] ^= other[j];
+		}
+		segment_size ^= other.size();
+	}
+	if (segment_size == 0 || segment_size > segment.size()) {
+		fprintf(stderr, "FT: fec rebuilt invalid segment size %u\n", segment_size);
+		return;
+	}
+	segment.resize(segment_size);
 
-		fn_ptr(tox, group_number, peer_number, transfer_id, transfer.file_size_current, data.data(), data.size(), ud_ptr);
+#if defined(EXTRA_LOGGING) && EXTRA_LOGGING == 1
+	fprintf(stderr, "FT: fec rebuilt seq %u of tf %u\n", missing_seq_id, transfer_id);
+#endif
 
-		transfer.file_size_current += data.size();
+	// as if it arrived
+	std::vector<uint8_t> pkg;
+	for (size_t i = 0; i < sizeof(transfer_id); i++) {
+		pkg.push_back((transfer_id>>(i*8)) & 0xff);
+	}
+	for (size_t i = 0; i < sizeof(missing_seq_id); i++) {
+		pkg.push_back((missing_seq_id>>(i*8)) & 0xff);
 	}
+	if (transfer.one_way_delay) {
+		pkg.insert(pkg.end(), sizeof(uint32_t), 0); // no timestamp
+	}
+	pkg.insert(pkg.end(), segment.cbegin(), segment.cend());
 
-	// send acks
-	std::vector<uint16_t> ack_seq_ids(transfer.rsb.ack_seq_ids.cbegin(), transfer.rsb.ack_seq_ids.cend());
-	if (!ack_seq_ids.empty()) {
-		_send_pkg_FT1_DATA_ACK(tox, group_number, peer_number, transfer_id, ack_seq_ids.data(), ack_seq_ids.size());
+	// the sender's segment did not arrive, so its ack is no delay sample
+	transfer.fec_rebuilt.insert(missing_seq_id);
+	while (transfer.fec_rebuilt.size() > _FEC_MAX_SEGMENTS_KEPT) {
+		transfer.fec_rebuilt.erase(transfer.fec_rebuilt.begin());
 	}
+
+	_handle_FT1_DATA_impl(tox, ngc_ft1_ctx, group_number, peer_number, pkg.data(), pkg.size(), true);
 }
 
-static void _handle_FT1_DATA_ACK(
+static void _handle_FT1_DONE(
 	Tox* tox,
 	NGC_EXT_CTX* ngc_ext_ctx,
 
@@ -844,56 +3671,42 @@ static void _handle_FT1_DATA_ACK(
 	NGC_FT1* ngc_ft1_ctx = static_cast<NGC_FT1*>(user_data);
 	size_t curser = 0;
 
-	// - 1 byte (transfer_id)
-	uint8_t transfer_id;
-	_DATA_HAVE(sizeof(transfer_id), fprintf(stderr, "FT: packet too small, missing transfer_id\n"); return)
-	transfer_id = data[curser++];
+	// done is newer than the v2 packets
+	NGC_FT1::Group::Peer& peer = ngc_ft1_ctx->shardOf(group_number, peer_number).groups[group_number].peers[peer_number];
+	peer.v2_support = NGC_FT1::Group::Peer::V2Support::YES;
 
-	auto& groups = ngc_ft1_ctx->groups;
-	if (!groups.count(group_number)) {
-		fprintf(stderr, "FT: data_ack for unknown group\n");
-		return;
+	// - 2 bytes (transfer_id)
+	uint16_t transfer_id {0u};
+	_DATA_HAVE(sizeof(transfer_id), fprintf(stderr, "FT: packet too small, missing transfer_id\n"); return)
+	for (size_t i = 0; i < sizeof(transfer_id); i++, curser++) {
+		transfer_id |= uint16_t(data[curser]) << (i*8);
 	}
 
-	NGC_FT1::Group::Peer& peer = groups[group_number].peers[peer_number];
-	if (!peer.send_transfers[transfer_id].has_value()) {
-		fprintf(stderr, "FT: data_ack for unknown transfer\n");
-		return;
+	auto t_it = peer.send_transfers.find(transfer_id);
+	if (t_it == peer.send_transfers.end()) {
+		return; // allready done by the acks
 	}
+	auto& transfer = t_it->second;
 
-	NGC_FT1::Group::Peer::SendTransfer& transfer = peer.send_transfers[transfer_id].value();
-
+	// only after all data was sent, anything else is a stale or bogus done for a reused transfer_id
 	using State = NGC_FT1::Group::Peer::SendTransfer::State;
-	if (transfer.state != State::SENDING && transfer.state != State::FINISHING) {
-		fprintf(stderr, "FT: data_ack but not in SENDING or FINISHING state (%d)\n", int(transfer.state));
+	if ((transfer.state != State::SENDING && transfer.state != State::FINISHING) || transfer.file_size_current != transfer.file_size) {
+		fprintf(stderr, "FT: done for %d, but not all data was sent yet (state %d), ignoring\n", transfer_id, int(transfer.state));
 		return;
 	}
 
-	_DATA_HAVE(sizeof(uint16_t), fprintf(stderr, "FT: packet too small, atleast 1 seq_id\n"); return)
-
-	if ((length - curser) % sizeof(uint16_t) != 0) {
-		fprintf(stderr, "FT: data_ack with misaligned data\n");
-		return;
-	}
-
-	transfer.time_since_activity = 0.f;
-
+	// the peer has all data, so what is still in flight arrived, its acks are just behind
+	// we do not know when it arrived, so it is no delay sample
 	std::vector<LEDBAT::SeqIDType> seqs;
-	while (curser < length) {
-		uint16_t seq_id = data[curser++];
-		seq_id |= data[curser++] << (1*8);
-
-		seqs.push_back({transfer_id, seq_id});
-		transfer.ssb.erase(seq_id);
+	for (const auto& [id, entry] : transfer.ssb.entries) {
+		seqs.push_back({transfer_id, id});
 	}
-	peer.cca.onAck(seqs);
+	peer.cca.onDelivered(seqs);
 
-	// delete if all packets acked
-	if (transfer.file_size == transfer.file_size_current && transfer.ssb.size() == 0) {
-		fprintf(stderr, "FT: %d done\n", transfer_id);
-		peer.send_transfers[transfer_id].reset();
-	}
+	fprintf(stderr, "FT: %d done (confirmed)\n", transfer_id);
+	const uint32_t file_kind = transfer.file_kind;
+	peer.send_transfers.erase(t_it);
+	_send_transfer_done(tox, ngc_ft1_ctx, group_number, peer_number, transfer_id, file_kind, true);
 }
 
 #undef _DATA_HAVE
-
@@ -24,6 +24,67 @@ struct NGC_FT1_options {
 
 	//float sending_resend_without_ack_after; // 5sec
 	float sending_give_up_after; // 30sec
+
+	// start sending data right after the init, without waiting for the ack (v2 peers only)
+	// the receiver buffers it until it accepted the init, saves a roundtrip per transfer
+	bool optimistic_init_data; // false
+
+	// bytes of out of order data buffered per receiving transfer, 0 -> 256KiB
+	// more is dropped and resent, v2 senders keep their unacked data below what is left
+	size_t recv_window_size; // 0
+
+	// bytes of data queued for file kinds received asynchronously, 0 -> 4MiB
+	// (see NGC_FT1_set_recv_async_file_kind())
+	size_t recv_queue_size; // 0
+
+	// bytes read ahead per sending transfer, for file kinds sent asynchronously, 0 -> 256KiB
+	// (see NGC_FT1_set_send_async_file_kind())
+	size_t send_read_ahead_size; // 0
+
+	// bytes of served/received files kept in memory, 0 disables the cache
+	// (see NGC_FT1_set_cache_file_kind())
+	size_t chunk_cache_size; // 0
+
+	// offer compressed transfers to v2 peers (zstd level, negative is faster), 0 disables
+	// needs a build with NGC_FT1_ZSTD=1, without it the offer is never made or accepted
+	// segments are compressed one by one, so recv_data offsets are unchanged
+	// data that does not compress is detected and sent as is
+	int compression_level; // 0
+
+	// offer forward error correction to v2 peers, xor parity over groups of data segments
+	// the receiver rebuilds a single lost segment per group without waiting for a resend
+	// the group size adapts to the loss fec could not repair, no parity is sent while there is no loss
+	bool fec; // false
+
+	// offer send timestamps on data segments to v2 peers, the receiver echoes them with the arrival time
+	// congestion control then uses the one way delay, so queues on the return path and late acks do not slow the sending down
+	// no data is sent before the init is acked while it is offered
+	bool one_way_delay; // false
+
+	// queuing delay congestion control aims for, in seconds, 0 -> 0.030 (0.120 for tcp relayed peers)
+	// it is raised with the jitter seen per peer, up to the max, 0 -> 0.300
+	// higher fills bigger buffers, lower backs off sooner from other traffic
+	float target_delay_min; // 0
+	float target_delay_max; // 0
+
+	// handle packets and iterate on an engine thread, NGC_FT1_iterate only sends what it queued
+	// so call it about as often as tox_iterate, until then the packets wait in the queue
+	// (the data segments are timestamped when they leave it, so the wait does not count as network delay)
+	// the tox thread hands the packets over without locking, the public api is thread safe then,
+	// the callbacks are called on the engine thread and must not call tox functions
+	bool threaded; // false
+
+	// engine threads in threaded mode, the peers are spread over them, 0 -> 1
+	// busy peers are moved from the busiest to the least busy thread
+	// with more than one, callbacks can only call the api for peers of their thread, and not change settings
+	size_t engine_threads; // 0
+};
+
+struct NGC_FT1_cache_stats {
+	uint64_t hits; // requests served from the cache
+	uint64_t misses; // requests for a cached file_kind that went to the app
+	size_t entries;
+	size_t bytes;
 };
 
 // uint32_t - same as tox friend ft
@@ -44,6 +105,7 @@ typedef enum NGC_FT1_file_kind /*: uint32_t*/ {
 
 	// id: hash of the info, like a torrent infohash (using the same hash as the data)
 	// TODO: determain internal format
+	// INFO and INFO2 are implemented in ngc_ft1_sha1.h, integers are little endian
 	// draft: (for single file)
 	//   - 256 bytes | filename
 	//   - 8bytes | file size
@@ -91,6 +153,7 @@ typedef enum NGC_FT1_file_kind /*: uint32_t*/ {
 	TORRENT_V2_METAINFO,
 	// id: root hash
 	// contains all the leaf hashes for a file root hash
+	// (32 bytes each, padded with zero hashes to a power of 2 when building the tree, see bep 52)
 	TORRENT_V2_FILE_HASHES,
 	// id: sha256
 	// always of size 16KiB, except if last piece in file
@@ -107,6 +170,72 @@ void NGC_FT1_kill(NGC_FT1* ngc_ft1_ctx);
 // time_delta in seconds
 void NGC_FT1_iterate(Tox *tox, NGC_FT1* ngc_ft1_ctx, float time_delta);
 
+// ========== cache ==========
+// files of enabled kinds are kept in an LRU cache, keyed by (file_kind, file_id), once:
+// - they where fully sent (the data came from send_data)
+// - they where fully received and verified (only TORRENT_V2_PIECE and TORRENT_V2_FILE_HASHES)
+// requests for cached files are answered directly, recv_request and send_data are not called.
+// only enable this for kinds where the file_id always refers to the same content (not ID)
+void NGC_FT1_set_cache_file_kind(NGC_FT1* ngc_ft1_ctx, uint32_t file_kind, bool enabled);
+void NGC_FT1_get_cache_stats(const NGC_FT1* ngc_ft1_ctx, struct NGC_FT1_cache_stats* stats_out);
+
+// ========== async recv ==========
+// data of enabled kinds is not handed to recv_data, but queued, to be written by threads of the app
+// instead of recv_done, a last span with done set is queued behind the data of a transfer
+// once the queue is full, the data stays buffered in the transfer and the sender is slowed down
+// the app has to stop popping before NGC_FT1_kill()
+void NGC_FT1_set_recv_async_file_kind(NGC_FT1* ngc_ft1_ctx, uint32_t file_kind, bool enabled);
+
+struct NGC_FT1_recv_span {
+	uint32_t file_kind;
+	uint32_t group_number;
+	uint32_t peer_number;
+	uint16_t transfer_id;
+
+	size_t data_offset;
+	const uint8_t* data; // valid until released
+	size_t data_size;
+
+	bool done; // no data, see NGC_FT1_recv_done_cb
+	bool verified;
+};
+
+// thread safe, waits up to timeout_ms for a span
+// spans of a transfer are popped in order, but with more than one thread they might be handled out of order
+bool NGC_FT1_recv_async_pop(NGC_FT1* ngc_ft1_ctx, uint32_t timeout_ms, struct NGC_FT1_recv_span* span_out);
+// thread safe, frees the data and makes room in the queue
+void NGC_FT1_recv_async_release(NGC_FT1* ngc_ft1_ctx, const struct NGC_FT1_recv_span* span);
+
+// ========== async send ==========
+// data of enabled kinds is not requested with send_data, but read ahead by threads of the app
+// iterate only sends what was read, so slow storage does not block the tox thread
+// enable before sending, transfers served from the cache are not read
+// the app has to stop popping before NGC_FT1_kill()
+void NGC_FT1_set_send_async_file_kind(NGC_FT1* ngc_ft1_ctx, uint32_t file_kind, bool enabled);
+
+struct NGC_FT1_send_read {
+	uint32_t file_kind;
+	uint32_t group_number;
+	uint32_t peer_number;
+	uint16_t transfer_id;
+
+	size_t data_offset;
+	uint8_t* data; // fill with data_size bytes
+	size_t data_size;
+};
+
+// thread safe, waits up to timeout_ms for a read
+bool NGC_FT1_send_async_pop(NGC_FT1* ngc_ft1_ctx, uint32_t timeout_ms, struct NGC_FT1_send_read* read_out);
+// thread safe, the data is sent from the next iterate on
+void NGC_FT1_send_async_complete(NGC_FT1* ngc_ft1_ctx, const struct NGC_FT1_send_read* read);
+
+// ========== reread send ==========
+// in flight data of enabled kinds is not kept until it is acked, only its file range
+// resends call send_data again, so sender memory does not grow with the window
+// send_data has to return the same data for the same offset every time
+// enable before sending, not for kinds sent asynchronously. disables compression for them
+void NGC_FT1_set_send_reread_file_kind(NGC_FT1* ngc_ft1_ctx, uint32_t file_kind, bool enabled);
+
 // TODO: announce
 // ========== request ==========
 
@@ -132,6 +261,32 @@ void NGC_FT1_register_callback_recv_request(
 	void* user_data
 );
 
+// many requests of the same file_kind, in as few packets as possible
+// file_ids: count ids of file_id_size bytes each, back to back
+// falls back to one FT1_REQUEST per id, if the peer is not known to understand batches
+void NGC_FT1_send_request_batch_private(
+	Tox *tox, NGC_FT1* ngc_ft1_ctx,
+	uint32_t group_number, uint32_t peer_number,
+	uint32_t file_kind,
+	const uint8_t* file_ids, size_t file_id_size, size_t count
+);
+
+// if no batch cb is registered for a file_kind, recv_request is called for each id instead
+// ids that are served from the cache are not included
+typedef void NGC_FT1_recv_request_batch_cb(
+	Tox *tox,
+	uint32_t group_number, uint32_t peer_number,
+	const uint8_t* file_ids, size_t file_id_size, size_t count,
+	void* user_data
+);
+
+void NGC_FT1_register_callback_recv_request_batch(
+	NGC_FT1* ngc_ft1_ctx,
+	uint32_t file_kind,
+	NGC_FT1_recv_request_batch_cb* callback,
+	void* user_data
+);
+
 // ========== send/accept ==========
 
 // public does not make sense here
@@ -141,7 +296,18 @@ bool NGC_FT1_send_init_private(
 	uint32_t file_kind,
 	const uint8_t* file_id, size_t file_id_size,
 	size_t file_size,
-	uint8_t* transfer_id
+	uint16_t* transfer_id
+);
+
+// small files (about 1.3KiB including the file_id) in a single lossless packet, skipping the init/ack/data roundtrips
+// the receiver sees recv_init, a single recv_data and recv_done, all during the same call
+// returns false if it does not fit or the peer is not known to understand it, use NGC_FT1_send_init_private() then
+bool NGC_FT1_send_inline_private(
+	Tox *tox, NGC_FT1* ngc_ft1_ctx,
+	uint32_t group_number, uint32_t peer_number,
+	uint32_t file_kind,
+	const uint8_t* file_id, size_t file_id_size,
+	const uint8_t* data, size_t data_size
 );
 
 // return true to accept, false to deny
@@ -149,7 +315,7 @@ typedef bool NGC_FT1_recv_init_cb(
 	Tox *tox,
 	uint32_t group_number, uint32_t peer_number,
 	const uint8_t* file_id, size_t file_id_size,
-	const uint8_t transfer_id,
+	const uint16_t transfer_id,
 	const size_t file_size,
 	void* user_data
 );
@@ -168,7 +334,7 @@ typedef void NGC_FT1_recv_data_cb(
 
 	uint32_t group_number,
 	uint32_t peer_number,
-	uint8_t transfer_id,
+	uint16_t transfer_id,
 
 	size_t data_offset, const uint8_t* data, size_t data_size,
 	void* user_data
@@ -181,13 +347,36 @@ void NGC_FT1_register_callback_recv_data(
 	void* user_data
 );
 
+// called once all data of a transfer was received
+// TORRENT_V2_PIECE (sha256 of the data) and TORRENT_V2_FILE_HASHES (merkle root of the leaf hashes)
+// are checked against the file_id while the data streams in, verified is false on mismatch.
+// the data was allready handed to recv_data, so drop it and request it again (preferably from someone else)
+// for all other file kinds verified is always true
+typedef void NGC_FT1_recv_done_cb(
+	Tox *tox,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+	uint16_t transfer_id,
+
+	bool verified,
+	void* user_data
+);
+
+void NGC_FT1_register_callback_recv_done(
+	NGC_FT1* ngc_ft1_ctx,
+	uint32_t file_kind,
+	NGC_FT1_recv_done_cb* callback,
+	void* user_data
+);
+
 // request to fill data_size bytes into data
 typedef void NGC_FT1_send_data_cb(
 	Tox *tox,
 
 	uint32_t group_number,
 	uint32_t peer_number,
-	uint8_t transfer_id,
+	uint16_t transfer_id,
 
 	size_t data_offset, uint8_t* data, size_t data_size,
 	void* user_data
@@ -200,6 +389,26 @@ void NGC_FT1_register_callback_send_data(
 	void* user_data
 );
 
+// called once a sending transfer ended and its transfer_id is free again
+// complete is true if the peer acked (or confirmed) all data, false if it was given up
+typedef void NGC_FT1_send_done_cb(
+	Tox *tox,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+	uint16_t transfer_id,
+
+	bool complete,
+	void* user_data
+);
+
+void NGC_FT1_register_callback_send_done(
+	NGC_FT1* ngc_ft1_ctx,
+	uint32_t file_kind,
+	NGC_FT1_send_done_cb* callback,
+	void* user_data
+);
+
 
 // ========== peer online/offline ==========
 //void NGC_FT1_peer_online(Tox* tox, NGC_FT1* ngc_hs1_ctx, uint32_t group_number, uint32_t peer_number, bool online);
@@ -0,0 +1,346 @@
+#include "./ngc_ft1_sha1.h"
+
+#include "./ngc_ft1.h"
+
+#include "./sha1.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+static_assert(SHA1::DIGEST_SIZE == NGC_FT1_SHA1_SIZE);
+
+static size_t _thread_count(size_t thread_count) {
+	if (thread_count == 0) {
+		thread_count = std::thread::hardware_concurrency();
+	}
+	return std::max<size_t>(thread_count, 1);
+}
+
+void NGC_FT1_sha1(const uint8_t* data, size_t data_size, uint8_t hash_out[NGC_FT1_SHA1_SIZE]) {
+	const auto digest = SHA1::hash(data, data_size);
+	std::copy(digest.cbegin(), digest.cend(), hash_out);
+}
+
+// ========== info ==========
+
+// HASH_SHA1_INFO:
+//   - 256 bytes | filename (zero padded)
+//   - 8 bytes | file size
+//   - 4 bytes | chunk size
+//   - array of chunk hashes (20 bytes)
+// HASH_SHA1_INFO2:
+//   - c-string | filename
+//   - 8 bytes | file size
+//   - 4 bytes | chunk size
+//   - array of chunk hashes (20 bytes)
+static constexpr size_t _INFO_FILE_NAME_SIZE {256};
+
+bool NGC_FT1_sha1_info_parse(
+	uint32_t info_file_kind,
+	const uint8_t* info, size_t info_size,
+	NGC_FT1_sha1_info_view* view_out
+) {
+	assert(view_out);
+
+	size_t curser = 0;
+
+	const char* file_name = reinterpret_cast<const char*>(info);
+	size_t file_name_size {0};
+	if (info_file_kind == NGC_FT1_file_kind::HASH_SHA1_INFO) {
+		if (info_size < _INFO_FILE_NAME_SIZE) {
+			fprintf(stderr, "FT: sha1 info too small, missing filename\n");
+			return false;
+		}
+		file_name_size = strnlen(file_name, _INFO_FILE_NAME_SIZE);
+		curser += _INFO_FILE_NAME_SIZE;
+	} else if (info_file_kind == NGC_FT1_file_kind::HASH_SHA1_INFO2) {
+		const uint8_t* terminator = static_cast<const uint8_t*>(std::memchr(info, '\0', info_size));
+		if (terminator == nullptr) {
+			fprintf(stderr, "FT: sha1 info2 filename not terminated\n");
+			return false;
+		}
+		file_name_size = terminator - info;
+		curser += file_name_size + 1;
+	} else {
+		fprintf(stderr, "FT: sha1 info of unsupported kind %u\n", info_file_kind);
+		return false;
+	}
+
+	if (info_size - curser < sizeof(uint64_t) + sizeof(uint32_t)) {
+		fprintf(stderr, "FT: sha1 info too small, missing sizes\n");
+		return false;
+	}
+
+	uint64_t file_size {0u};
+	for (size_t i = 0; i < sizeof(file_size); i++, curser++) {
+		file_size |= uint64_t(info[curser]) << (i*8);
+	}
+
+	uint32_t chunk_size {0u};
+	for (size_t i = 0; i < sizeof(chunk_size); i++, curser++) {
+		chunk_size |= uint32_t(info[curser]) << (i*8);
+	}
+
+	if (chunk_size == 0) {
+		fprintf(stderr, "FT: sha1 info with chunk size 0\n");
+		return false;
+	}
+
+	if ((info_size - curser) % NGC_FT1_SHA1_SIZE != 0) {
+		fprintf(stderr, "FT: sha1 info with misaligned chunk hashes\n");
+		return false;
+	}
+
+	const size_t chunk_count = (info_size - curser) / NGC_FT1_SHA1_SIZE;
+	if ((file_size + chunk_size - 1) / chunk_size != chunk_count) {
+		fprintf(stderr, "FT: sha1 info chunk count does not match file size\n");
+		return false;
+	}
+
+	view_out->file_name = file_name;
+	view_out->file_name_size = file_name_size;
+	view_out->file_size = file_size;
+	view_out->chunk_size = chunk_size;
+	view_out->chunk_hashes = info + curser;
+	view_out->chunk_count = chunk_count;
+
+	return true;
+}
+
+bool NGC_FT1_sha1_info_build_from_file(
+	uint32_t info_file_kind,
+	const char* file_path,
+	const char* file_name,
+	uint32_t chunk_size,
+	size_t thread_count,
+	uint8_t** info_out, size_t* info_size_out,
+	uint8_t info_hash_out[NGC_FT1_SHA1_SIZE]
+) {
+	assert(file_path);
+	assert(file_name);
+	assert(info_out);
+	assert(info_size_out);
+
+	if (chunk_size == 0) {
+		return false;
+	}
+
+	const size_t file_name_size = strlen(file_name);
+	if (info_file_kind == NGC_FT1_file_kind::HASH_SHA1_INFO) {
+		if (file_name_size > _INFO_FILE_NAME_SIZE) {
+			fprintf(stderr, "FT: sha1 info filename too long\n");
+			return false;
+		}
+	} else if (info_file_kind != NGC_FT1_file_kind::HASH_SHA1_INFO2) {
+		fprintf(stderr, "FT: sha1 info of unsupported kind %u\n", info_file_kind);
+		return false;
+	}
+
+	uint64_t file_size {0};
+	{
+		std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+		if (!file.is_open()) {
+			fprintf(stderr, "FT: sha1 info failed to open '%s'\n", file_path);
+			return false;
+		}
+		file_size = file.tellg();
+	}
+
+	const size_t chunk_count = (file_size + chunk_size - 1) / chunk_size;
+	std::vector<uint8_t> chunk_hashes(chunk_count * NGC_FT1_SHA1_SIZE);
+
+	// every thread has its own file handle and pulls the next chunk index
+	std::atomic_size_t next_chunk {0};
+	std::atomic_bool failed {false};
+	auto worker_fn = [&]() {
+		std::ifstream file(file_path, std::ios::binary);
+		if (!file.is_open()) {
+			failed = true;
+			return;
+		}
+
+		std::vector<uint8_t> buffer(chunk_size);
+		for (size_t i = next_chunk++; i < chunk_count && !failed; i = next_chunk++) {
+			const size_t size = std::min<uint64_t>(chunk_size, file_size - uint64_t(i)*chunk_size);
+			file.seekg(uint64_t(i)*chunk_size);
+			file.read(reinterpret_cast<char*>(buffer.data()), size);
+			if (!file) {
+				failed = true;
+				return;
+			}
+
+			const auto digest = SHA1::hash(buffer.data(), size);
+			std::copy(digest.cbegin(), digest.cend(), chunk_hashes.begin() + i*NGC_FT1_SHA1_SIZE);
+		}
+	};
+
+	{
+		std::vector<std::thread> threads;
+		const size_t count = std::min(_thread_count(thread_count), std::max<size_t>(chunk_count, 1));
+		for (size_t i = 1; i < count; i++) {
+			threads.emplace_back(worker_fn);
+		}
+		worker_fn(); // this thread helps too
+		for (auto& t : threads) {
+			t.join();
+		}
+	}
+
+	if (failed) {
+		fprintf(stderr, "FT: sha1 info failed reading '%s'\n", file_path);
+		return false;
+	}
+
+	std::vector<uint8_t> info;
+	if (info_file_kind == NGC_FT1_file_kind::HASH_SHA1_INFO) {
+		info.resize(_INFO_FILE_NAME_SIZE, 0);
+		std::memcpy(info.data(), file_name, file_name_size);
+	} else {
+		info.insert(info.end(), file_name, file_name + file_name_size + 1);
+	}
+	for (size_t i = 0; i < sizeof(file_size); i++) {
+		info.push_back((file_size>>(i*8)) & 0xff);
+	}
+	for (size_t i = 0; i < sizeof(chunk_size); i++) {
+		info.push_back((chunk_size>>(i*8)) & 0xff);
+	}
+	info.insert(info.end(), chunk_hashes.cbegin(), chunk_hashes.cend());
+
+	if (info_hash_out != nullptr) {
+		NGC_FT1_sha1(info.data(), info.size(), info_hash_out);
+	}
+
+	*info_out = new uint8_t[info.size()];
+	std::copy(info.cbegin(), info.cend(), *info_out);
+	*info_size_out = info.size();
+
+	return true;
+}
+
+void NGC_FT1_sha1_info_free(uint8_t* info) {
+	delete[] info;
+}
+
+// ========== verifier ==========
+
+struct NGC_FT1_sha1_verifier {
+	struct Job {
+		std::vector<uint8_t> data;
+		SHA1::Digest expected_hash;
+		uint64_t tag;
+	};
+
+	struct Result {
+		uint64_t tag;
+		bool ok;
+	};
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool quit {false};
+
+	std::deque<Job> jobs;
+	std::vector<Result> results;
+
+	std::vector<std::thread> threads;
+
+	void workerFn(void) {
+		std::unique_lock lock(mutex);
+		while (true) {
+			cv.wait(lock, [this]() { return quit || !jobs.empty(); });
+			if (quit) {
+				return;
+			}
+
+			Job job = std::move(jobs.front());
+			jobs.pop_front();
+
+			lock.unlock();
+			const bool ok = SHA1::hash(job.data.data(), job.data.size()) == job.expected_hash;
+			lock.lock();
+
+			results.push_back({job.tag, ok});
+		}
+	}
+};
+
+NGC_FT1_sha1_verifier* NGC_FT1_sha1_verifier_new(size_t thread_count) {
+	NGC_FT1_sha1_verifier* verifier = new NGC_FT1_sha1_verifier;
+
+	thread_count = _thread_count(thread_count);
+	for (size_t i = 0; i < thread_count; i++) {
+		verifier->threads.emplace_back(&NGC_FT1_sha1_verifier::workerFn, verifier);
+	}
+
+	return verifier;
+}
+
+void NGC_FT1_sha1_verifier_kill(NGC_FT1_sha1_verifier* verifier) {
+	if (verifier == nullptr) {
+		return;
+	}
+
+	{
+		std::lock_guard lock(verifier->mutex);
+		verifier->quit = true;
+	}
+	verifier->cv.notify_all();
+
+	for (auto& t : verifier->threads) {
+		t.join();
+	}
+
+	delete verifier;
+}
+
+void NGC_FT1_sha1_verifier_submit(
+	NGC_FT1_sha1_verifier* verifier,
+	const uint8_t* data, size_t data_size,
+	const uint8_t expected_hash[NGC_FT1_SHA1_SIZE],
+	uint64_t tag
+) {
+	assert(verifier);
+
+	NGC_FT1_sha1_verifier::Job job;
+	job.data = std::vector<uint8_t>(data, data+data_size);
+	std::copy(expected_hash, expected_hash+NGC_FT1_SHA1_SIZE, job.expected_hash.begin());
+	job.tag = tag;
+
+	{
+		std::lock_guard lock(verifier->mutex);
+		verifier->jobs.push_back(std::move(job));
+	}
+	verifier->cv.notify_one();
+}
+
+size_t NGC_FT1_sha1_verifier_poll(
+	NGC_FT1_sha1_verifier* verifier,
+	NGC_FT1_sha1_verifier_result_cb* callback,
+	void* user_data
+) {
+	assert(verifier);
+
+	std::vector<NGC_FT1_sha1_verifier::Result> results;
+	{
+		std::lock_guard lock(verifier->mutex);
+		results.swap(verifier->results);
+	}
+
+	if (callback != nullptr) {
+		for (const auto& r : results) {
+			callback(r.tag, r.ok, user_data);
+		}
+	}
+
+	return results.size();
+}
+
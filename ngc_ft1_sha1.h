@@ -0,0 +1,93 @@
+#ifndef C_NGC_FT1_SHA1_H
+#define C_NGC_FT1_SHA1_H
+
+// this is a c header
+
+// reference implementation of the HASH_SHA1_INFO and HASH_SHA1_INFO2 formats (see NGC_FT1_file_kind)
+// and HASH_SHA1_CHUNK verification
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NGC_FT1_SHA1_SIZE 20
+
+// ========== hashing ==========
+
+void NGC_FT1_sha1(const uint8_t* data, size_t data_size, uint8_t hash_out[NGC_FT1_SHA1_SIZE]);
+
+// ========== info ==========
+
+// points into the info blob, only valid as long as the blob is
+typedef struct NGC_FT1_sha1_info_view {
+	const char* file_name; // NOT null terminated
+	size_t file_name_size;
+
+	uint64_t file_size;
+	uint32_t chunk_size;
+
+	const uint8_t* chunk_hashes; // chunk_count * NGC_FT1_SHA1_SIZE bytes
+	size_t chunk_count;
+} NGC_FT1_sha1_info_view;
+
+// info_file_kind is HASH_SHA1_INFO or HASH_SHA1_INFO2
+// does not copy, checks that the chunk count matches the file size
+bool NGC_FT1_sha1_info_parse(
+	uint32_t info_file_kind,
+	const uint8_t* info, size_t info_size,
+	NGC_FT1_sha1_info_view* view_out
+);
+
+// hashes the file in chunk_size chunks, spread over thread_count threads (0 means all cores)
+// info_out has to be freed with NGC_FT1_sha1_info_free()
+// info_hash_out is the file_id for info_file_kind
+bool NGC_FT1_sha1_info_build_from_file(
+	uint32_t info_file_kind,
+	const char* file_path,
+	const char* file_name, // name stored in the info
+	uint32_t chunk_size,
+	size_t thread_count,
+	uint8_t** info_out, size_t* info_size_out,
+	uint8_t info_hash_out[NGC_FT1_SHA1_SIZE]
+);
+
+void NGC_FT1_sha1_info_free(uint8_t* info);
+
+// ========== verifier ==========
+
+// verifies chunks against their hash on worker threads
+typedef struct NGC_FT1_sha1_verifier NGC_FT1_sha1_verifier;
+
+// thread_count 0 means all cores
+NGC_FT1_sha1_verifier* NGC_FT1_sha1_verifier_new(size_t thread_count);
+// waits for running jobs, pending results are dropped
+void NGC_FT1_sha1_verifier_kill(NGC_FT1_sha1_verifier* verifier);
+
+// data is copied, tag is handed back in the result
+void NGC_FT1_sha1_verifier_submit(
+	NGC_FT1_sha1_verifier* verifier,
+	const uint8_t* data, size_t data_size,
+	const uint8_t expected_hash[NGC_FT1_SHA1_SIZE],
+	uint64_t tag
+);
+
+typedef void NGC_FT1_sha1_verifier_result_cb(uint64_t tag, bool ok, void* user_data);
+
+// calls callback for every finished job, on the calling thread
+// returns the number of results
+size_t NGC_FT1_sha1_verifier_poll(
+	NGC_FT1_sha1_verifier* verifier,
+	NGC_FT1_sha1_verifier_result_cb* callback,
+	void* user_data
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // C_NGC_FT1_SHA1_H
+
@@ -0,0 +1,608 @@
+#include "./ngc_ft1_swarm.h"
+
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+struct NGC_FT1_swarm {
+	NGC_FT1* ngc_ft1_ctx {nullptr};
+	uint32_t chunk_file_kind {0u};
+
+	// TODO: make configurable
+	static constexpr float request_timeout_min {5.f}; // seconds without an init
+	static constexpr float transfer_timeout {20.f}; // seconds without data
+	static constexpr float missing_forget_after {60.f}; // peers might get chunks later
+	static constexpr size_t max_requests_per_peer {64};
+	static constexpr size_t max_requests_per_chunk {2}; // endgame
+
+	struct Download {
+		uint32_t group_number {0u};
+
+		size_t chunk_id_size {0};
+		std::vector<uint8_t> chunk_ids;
+		size_t chunk_count {0};
+		size_t chunk_size {0};
+		uint64_t file_size {0};
+
+		std::vector<bool> have;
+		std::vector<uint8_t> requests_in_flight; // per chunk
+		size_t chunks_missing {0};
+
+		// all chunks before this are either present or requested
+		size_t request_cursor {0};
+
+		NGC_FT1_swarm_chunk_done_cb* cb {nullptr};
+		void* ud {nullptr};
+
+		std::vector<uint8_t> chunkID(size_t chunk_index) const {
+			const auto begin = chunk_ids.cbegin() + chunk_index*chunk_id_size;
+			return {begin, begin + chunk_id_size};
+		}
+
+		size_t chunkSize(size_t chunk_index) const {
+			return std::min<uint64_t>(chunk_size, file_size - uint64_t(chunk_index)*chunk_size);
+		}
+	};
+	std::map<uint32_t, Download> downloads;
+	uint32_t next_download_id {0};
+
+	using ChunkRef = std::pair<uint32_t, size_t>; // download_id, chunk_index
+
+	// chunk_id -> chunks with that id (the same content can appear multiple times)
+	std::map<std::vector<uint8_t>, std::vector<ChunkRef>> chunk_lookup;
+
+	struct Peer {
+		struct Request {
+			ChunkRef chunk;
+			float time_since_request {0.f};
+		};
+		// requested, but no init yet
+		std::vector<Request> requests;
+
+		struct Transfer {
+			std::vector<uint8_t> chunk_id;
+			std::vector<uint8_t> data;
+			size_t bytes_received {0};
+			float time_since_request {0.f};
+			float time_since_activity {0.f};
+		};
+		std::map<uint16_t, Transfer> transfers;
+
+		// estimates, updated on every completed chunk
+		float latency {0.5f}; // request to first data, seconds
+		float rate {0.f}; // bytes/s per chunk transfer
+
+		// chunks this peer could not deliver, dont ask again for a while
+		std::map<ChunkRef, float> missing; // -> time since
+
+		size_t inFlight(void) const {
+			return requests.size() + transfers.size();
+		}
+
+		// how many chunks we want in flight with this peer
+		// the delivery rate times the latency is what the peers congestion window allows per rtt
+		size_t budget(size_t chunk_size) const {
+			if (rate <= 0.f || chunk_size == 0) {
+				return 2; // no samples yet
+			}
+			const float window = rate * latency / chunk_size;
+			return std::clamp<size_t>(std::ceil(window) + 1, 1, max_requests_per_peer);
+		}
+	};
+	std::map<std::pair<uint32_t, uint32_t>, Peer> peers; // (group_number, peer_number)
+
+	// helper
+
+	void requestFailed(Peer& peer, const ChunkRef& chunk) {
+		peer.missing[chunk] = 0.f;
+		auto d_it = downloads.find(chunk.first);
+		if (d_it == downloads.end()) {
+			return;
+		}
+		auto& dl = d_it->second;
+		if (dl.requests_in_flight[chunk.second] > 0) {
+			dl.requests_in_flight[chunk.second]--;
+		}
+		dl.request_cursor = std::min(dl.request_cursor, chunk.second);
+	}
+
+	void chunkDone(Tox* tox, const std::vector<uint8_t>& chunk_id, const std::vector<uint8_t>& data) {
+		auto l_it = chunk_lookup.find(chunk_id);
+		if (l_it == chunk_lookup.end()) {
+			return;
+		}
+
+		// copy, the callback might remove downloads
+		const auto refs = l_it->second;
+		for (const auto& [download_id, chunk_index] : refs) {
+			auto d_it = downloads.find(download_id);
+			if (d_it == downloads.end()) {
+				continue;
+			}
+			auto& dl = d_it->second;
+			if (dl.have[chunk_index] || dl.chunkSize(chunk_index) != data.size()) {
+				continue;
+			}
+
+			dl.have[chunk_index] = true;
+			dl.requests_in_flight[chunk_index] = 0;
+			dl.chunks_missing--;
+
+			if (dl.cb != nullptr) {
+				dl.cb(tox, download_id, chunk_index, data.data(), data.size(), dl.ud);
+			}
+		}
+	}
+
+	// next chunk for this peer, prefers chunks nobody requested yet
+	bool pickChunk(const std::pair<uint32_t, uint32_t>& peer_key, const Peer& peer, ChunkRef& chunk_out) {
+		auto is_requested_from_peer = [this, &peer](const ChunkRef& chunk) {
+			for (const auto& r : peer.requests) {
+				if (r.chunk == chunk) {
+					return true;
+				}
+			}
+			const auto chunk_id = downloads.at(chunk.first).chunkID(chunk.second);
+			for (const auto& [transfer_id, transfer] : peer.transfers) {
+				if (transfer.chunk_id == chunk_id) {
+					return true;
+				}
+			}
+			return false;
+		};
+
+		for (size_t max_inflight = 0; max_inflight < max_requests_per_chunk; max_inflight++) {
+			for (auto& [download_id, dl] : downloads) {
+				if (dl.group_number != peer_key.first || dl.chunks_missing == 0) {
+					continue;
+				}
+
+				// only request chunks twice for the last few, so a slow peer does not hold up the end
+				if (max_inflight > 0 && dl.chunks_missing > peers.size()) {
+					continue;
+				}
+
+				bool advance_cursor = max_inflight == 0;
+				for (size_t i = max_inflight == 0 ? dl.request_cursor : 0; i < dl.chunk_count; i++) {
+					if (dl.have[i] || dl.requests_in_flight[i] > max_inflight) {
+						if (advance_cursor) {
+							dl.request_cursor = i + 1;
+						}
+						continue;
+					}
+					advance_cursor = false;
+
+					const ChunkRef chunk {download_id, i};
+					if (dl.requests_in_flight[i] != max_inflight || peer.missing.count(chunk) || is_requested_from_peer(chunk)) {
+						continue;
+					}
+
+					chunk_out = chunk;
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+};
+
+static bool _swarm_recv_init(
+	Tox *tox,
+	uint32_t group_number, uint32_t peer_number,
+	const uint8_t* file_id, size_t file_id_size,
+	const uint16_t transfer_id,
+	const size_t file_size,
+	void* user_data
+) {
+	auto* swarm = static_cast<NGC_FT1_swarm*>(user_data);
+
+	const std::vector<uint8_t> chunk_id(file_id, file_id+file_id_size);
+	auto l_it = swarm->chunk_lookup.find(chunk_id);
+	if (l_it == swarm->chunk_lookup.end()) {
+		return false; // not ours
+	}
+
+	bool wanted = false;
+	for (const auto& [download_id, chunk_index] : l_it->second) {
+		const auto& dl = swarm->downloads.at(download_id);
+		if (dl.group_number == group_number && !dl.have[chunk_index] && dl.chunkSize(chunk_index) == file_size) {
+			wanted = true;
+			break;
+		}
+	}
+	if (!wanted) {
+		return false;
+	}
+
+	// unrequested chunks are fine too, but we only track known peers
+	auto p_it = swarm->peers.find({group_number, peer_number});
+	if (p_it == swarm->peers.end()) {
+		return false;
+	}
+	auto& peer = p_it->second;
+
+	float time_since_request {0.f};
+	for (auto r_it = peer.requests.begin(); r_it != peer.requests.end(); r_it++) {
+		const auto& dl = swarm->downloads.at(r_it->chunk.first);
+		if (dl.chunkID(r_it->chunk.second) == chunk_id) {
+			time_since_request = r_it->time_since_request;
+			peer.requests.erase(r_it);
+			break;
+		}
+	}
+
+	auto& transfer = peer.transfers[transfer_id];
+	transfer.chunk_id = chunk_id;
+	transfer.data.resize(file_size);
+	transfer.bytes_received = 0;
+	transfer.time_since_request = time_since_request;
+	transfer.time_since_activity = 0.f;
+
+	return true;
+}
+
+static void _swarm_recv_data(
+	Tox *tox,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+	uint16_t transfer_id,
+
+	size_t data_offset, const uint8_t* data, size_t data_size,
+	void* user_data
+) {
+	auto* swarm = static_cast<NGC_FT1_swarm*>(user_data);
+
+	auto p_it = swarm->peers.find({group_number, peer_number});
+	if (p_it == swarm->peers.end()) {
+		return;
+	}
+	auto& peer = p_it->second;
+
+	auto t_it = peer.transfers.find(transfer_id);
+	if (t_it == peer.transfers.end()) {
+		return;
+	}
+	auto& transfer = t_it->second;
+
+	if (data_offset + data_size > transfer.data.size()) {
+		fprintf(stderr, "FT: swarm: data out of bounds\n");
+		return;
+	}
+
+	if (transfer.bytes_received == 0) {
+		peer.latency = peer.latency * 0.8f + transfer.time_since_request * 0.2f;
+	}
+
+	std::memcpy(transfer.data.data() + data_offset, data, data_size);
+	transfer.bytes_received += data_size;
+	transfer.time_since_activity = 0.f;
+}
+
+// completion is signaled by ft1, after it checked the chunk (if the file_kind can be checked)
+static void _swarm_recv_done(
+	Tox *tox,
+
+	uint32_t group_number,
+	uint32_t peer_number,
+	uint16_t transfer_id,
+
+	bool verified,
+	void* user_data
+) {
+	auto* swarm = static_cast<NGC_FT1_swarm*>(user_data);
+
+	auto p_it = swarm->peers.find({group_number, peer_number});
+	if (p_it == swarm->peers.end()) {
+		return;
+	}
+	auto& peer = p_it->second;
+
+	auto t_it = peer.transfers.find(transfer_id);
+	if (t_it == peer.transfers.end()) {
+		return;
+	}
+
+	// move out, the map might change in the callback
+	auto chunk_id = std::move(t_it->second.chunk_id);
+	auto chunk_data = std::move(t_it->second.data);
+	const float time_since_request = t_it->second.time_since_request;
+	peer.transfers.erase(t_it);
+
+	if (!verified) {
+		// get it from someone else
+		fprintf(stderr, "FT: swarm: peer %u sent a corrupted chunk\n", peer_number);
+		auto l_it = swarm->chunk_lookup.find(chunk_id);
+		if (l_it != swarm->chunk_lookup.end()) {
+			for (const auto& chunk : l_it->second) {
+				if (swarm->downloads.at(chunk.first).group_number == group_number) {
+					swarm->requestFailed(peer, chunk);
+				}
+			}
+		}
+		return;
+	}
+
+	const float duration = std::max(time_since_request - peer.latency, 0.001f);
+	const float rate = chunk_data.size() / duration;
+	peer.rate = peer.rate <= 0.f ? rate : peer.rate * 0.8f + rate * 0.2f;
+
+	swarm->chunkDone(tox, chunk_id, chunk_data);
+}
+
+NGC_FT1_swarm* NGC_FT1_swarm_new(NGC_FT1* ngc_ft1_ctx, uint32_t chunk_file_kind) {
+	assert(ngc_ft1_ctx);
+
+	NGC_FT1_swarm* swarm = new NGC_FT1_swarm;
+	swarm->ngc_ft1_ctx = ngc_ft1_ctx;
+	swarm->chunk_file_kind = chunk_file_kind;
+
+	NGC_FT1_register_callback_recv_init(ngc_ft1_ctx, chunk_file_kind, _swarm_recv_init, swarm);
+	NGC_FT1_register_callback_recv_data(ngc_ft1_ctx, chunk_file_kind, _swarm_recv_data, swarm);
+	NGC_FT1_register_callback_recv_done(ngc_ft1_ctx, chunk_file_kind, _swarm_recv_done, swarm);
+
+	return swarm;
+}
+
+void NGC_FT1_swarm_kill(NGC_FT1_swarm* swarm) {
+	if (swarm == nullptr) {
+		return;
+	}
+
+	NGC_FT1_register_callback_recv_init(swarm->ngc_ft1_ctx, swarm->chunk_file_kind, nullptr, nullptr);
+	NGC_FT1_register_callback_recv_data(swarm->ngc_ft1_ctx, swarm->chunk_file_kind, nullptr, nullptr);
+	NGC_FT1_register_callback_recv_done(swarm->ngc_ft1_ctx, swarm->chunk_file_kind, nullptr, nullptr);
+
+	delete swarm;
+}
+
+void NGC_FT1_swarm_iterate(Tox *tox, NGC_FT1_swarm* swarm, float time_delta) {
+	assert(swarm);
+
+	// timeouts
+	for (auto& [peer_key, peer] : swarm->peers) {
+		// a slow peer gets more time
+		const float request_timeout = std::max(NGC_FT1_swarm::request_timeout_min, peer.latency * 4.f);
+
+		for (auto it = peer.missing.begin(); it != peer.missing.end();) {
+			it->second += time_delta;
+			if (it->second >= NGC_FT1_swarm::missing_forget_after) {
+				it = peer.missing.erase(it);
+			} else {
+				it++;
+			}
+		}
+
+		for (auto it = peer.requests.begin(); it != peer.requests.end();) {
+			it->time_since_request += time_delta;
+			if (it->time_since_request >= request_timeout) {
+				// peer does not have it, or it got lost
+				// TODO: rerequest lost requests from the same peer?
+				const auto chunk = it->chunk;
+				it = peer.requests.erase(it);
+				swarm->requestFailed(peer, chunk);
+				peer.latency = std::min(peer.latency * 2.f, request_timeout);
+			} else {
+				it++;
+			}
+		}
+
+		for (auto it = peer.transfers.begin(); it != peer.transfers.end();) {
+			it->second.time_since_request += time_delta;
+			it->second.time_since_activity += time_delta;
+			if (it->second.time_since_activity >= NGC_FT1_swarm::transfer_timeout) {
+				fprintf(stderr, "FT: swarm: chunk transfer timed out\n");
+				auto l_it = swarm->chunk_lookup.find(it->second.chunk_id);
+				it = peer.transfers.erase(it);
+				if (l_it != swarm->chunk_lookup.end()) {
+					for (const auto& chunk : l_it->second) {
+						swarm->requestFailed(peer, chunk);
+					}
+				}
+				peer.rate /= 2.f;
+			} else {
+				it++;
+			}
+		}
+	}
+
+	// fastest peers get to pick first
+	std::vector<std::pair<std::pair<uint32_t, uint32_t>, NGC_FT1_swarm::Peer*>> sorted_peers;
+	for (auto& [peer_key, peer] : swarm->peers) {
+		sorted_peers.push_back({peer_key, &peer});
+	}
+	std::sort(sorted_peers.begin(), sorted_peers.end(), [](const auto& a, const auto& b) {
+		return a.second->latency < b.second->latency;
+	});
+
+	for (auto& [peer_key, peer_ptr] : sorted_peers) {
+		auto& peer = *peer_ptr;
+
+		// all downloads in a group share the peer
+		size_t chunk_size {0};
+		for (const auto& [download_id, dl] : swarm->downloads) {
+			if (dl.group_number == peer_key.first) {
+				chunk_size = std::max(chunk_size, dl.chunk_size);
+			}
+		}
+		if (chunk_size == 0) {
+			continue;
+		}
+
+		const size_t budget = peer.budget(chunk_size);
+		while (peer.inFlight() < budget) {
+			NGC_FT1_swarm::ChunkRef chunk;
+			if (!swarm->pickChunk(peer_key, peer, chunk)) {
+				break;
+			}
+
+			auto& dl = swarm->downloads.at(chunk.first);
+			const auto chunk_id = dl.chunkID(chunk.second);
+			NGC_FT1_send_request_private(
+				tox, swarm->ngc_ft1_ctx,
+				peer_key.first, peer_key.second,
+				swarm->chunk_file_kind,
+				chunk_id.data(), chunk_id.size()
+			);
+
+			dl.requests_in_flight[chunk.second]++;
+			peer.requests.push_back({chunk, 0.f});
+		}
+	}
+}
+
+bool NGC_FT1_swarm_add_download(
+	NGC_FT1_swarm* swarm,
+	uint32_t group_number,
+	const uint8_t* chunk_ids, size_t chunk_id_size, size_t chunk_count,
+	size_t chunk_size, uint64_t file_size,
+	NGC_FT1_swarm_chunk_done_cb* callback,
+	void* user_data,
+	uint32_t* download_id
+) {
+	assert(swarm);
+
+	if (chunk_ids == nullptr || chunk_id_size == 0 || chunk_size == 0) {
+		fprintf(stderr, "FT: swarm: invalid download\n");
+		return false;
+	}
+
+	if ((file_size + chunk_size - 1) / chunk_size != chunk_count) {
+		fprintf(stderr, "FT: swarm: chunk count does not match file size\n");
+		return false;
+	}
+
+	const uint32_t id = swarm->next_download_id++;
+	auto& dl = swarm->downloads[id];
+	dl.group_number = group_number;
+	dl.chunk_id_size = chunk_id_size;
+	dl.chunk_ids = std::vector<uint8_t>(chunk_ids, chunk_ids + chunk_id_size*chunk_count);
+	dl.chunk_count = chunk_count;
+	dl.chunk_size = chunk_size;
+	dl.file_size = file_size;
+	dl.have.resize(chunk_count, false);
+	dl.requests_in_flight.resize(chunk_count, 0);
+	dl.chunks_missing = chunk_count;
+	dl.cb = callback;
+	dl.ud = user_data;
+
+	for (size_t i = 0; i < chunk_count; i++) {
+		swarm->chunk_lookup[dl.chunkID(i)].push_back({id, i});
+	}
+
+	if (download_id != nullptr) {
+		*download_id = id;
+	}
+
+	return true;
+}
+
+void NGC_FT1_swarm_remove_download(NGC_FT1_swarm* swarm, uint32_t download_id) {
+	assert(swarm);
+
+	auto d_it = swarm->downloads.find(download_id);
+	if (d_it == swarm->downloads.end()) {
+		return;
+	}
+	const auto& dl = d_it->second;
+
+	for (size_t i = 0; i < dl.chunk_count; i++) {
+		auto l_it = swarm->chunk_lookup.find(dl.chunkID(i));
+		if (l_it == swarm->chunk_lookup.end()) {
+			continue;
+		}
+		auto& refs = l_it->second;
+		refs.erase(std::remove(refs.begin(), refs.end(), NGC_FT1_swarm::ChunkRef{download_id, i}), refs.end());
+		if (refs.empty()) {
+			swarm->chunk_lookup.erase(l_it);
+		}
+	}
+
+	for (auto& [peer_key, peer] : swarm->peers) {
+		peer.requests.erase(std::remove_if(peer.requests.begin(), peer.requests.end(), [download_id](const auto& r) {
+			return r.chunk.first == download_id;
+		}), peer.requests.end());
+
+		for (auto it = peer.missing.begin(); it != peer.missing.end();) {
+			if (it->first.first == download_id) {
+				it = peer.missing.erase(it);
+			} else {
+				it++;
+			}
+		}
+		// running transfers finish, but are ignored
+	}
+
+	swarm->downloads.erase(d_it);
+}
+
+void NGC_FT1_swarm_set_chunk_have(NGC_FT1_swarm* swarm, uint32_t download_id, size_t chunk_index, bool have) {
+	assert(swarm);
+
+	auto d_it = swarm->downloads.find(download_id);
+	if (d_it == swarm->downloads.end() || chunk_index >= d_it->second.chunk_count) {
+		return;
+	}
+	auto& dl = d_it->second;
+
+	if (dl.have[chunk_index] == have) {
+		return;
+	}
+
+	dl.have[chunk_index] = have;
+	if (have) {
+		dl.chunks_missing--;
+	} else {
+		dl.chunks_missing++;
+		dl.requests_in_flight[chunk_index] = 0;
+		dl.request_cursor = std::min(dl.request_cursor, chunk_index);
+	}
+}
+
+bool NGC_FT1_swarm_download_done(const NGC_FT1_swarm* swarm, uint32_t download_id) {
+	assert(swarm);
+
+	auto d_it = swarm->downloads.find(download_id);
+	if (d_it == swarm->downloads.end()) {
+		return false;
+	}
+
+	return d_it->second.chunks_missing == 0;
+}
+
+void NGC_FT1_swarm_add_peer(NGC_FT1_swarm* swarm, uint32_t group_number, uint32_t peer_number) {
+	assert(swarm);
+
+	swarm->peers[{group_number, peer_number}];
+}
+
+void NGC_FT1_swarm_remove_peer(NGC_FT1_swarm* swarm, uint32_t group_number, uint32_t peer_number) {
+	assert(swarm);
+
+	auto p_it = swarm->peers.find({group_number, peer_number});
+	if (p_it == swarm->peers.end()) {
+		return;
+	}
+	auto& peer = p_it->second;
+
+	// give everything in flight back
+	for (const auto& r : peer.requests) {
+		swarm->requestFailed(peer, r.chunk);
+	}
+	for (const auto& [transfer_id, transfer] : peer.transfers) {
+		auto l_it = swarm->chunk_lookup.find(transfer.chunk_id);
+		if (l_it != swarm->chunk_lookup.end()) {
+			for (const auto& chunk : l_it->second) {
+				swarm->requestFailed(peer, chunk);
+			}
+		}
+	}
+
+	swarm->peers.erase(p_it);
+}
+
@@ -0,0 +1,78 @@
+#ifndef C_NGC_FT1_SWARM_H
+#define C_NGC_FT1_SWARM_H
+
+// this is a c header
+
+// multi source downloads for content addressed file kinds (HASH_SHA1_CHUNK, TORRENT_V2_PIECE ...)
+// chunks are requested in parallel from all added peers that have them
+
+#include <tox/tox.h>
+
+#include "./ngc_ft1.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ========== struct / typedef ==========
+
+typedef struct NGC_FT1_swarm NGC_FT1_swarm;
+
+// ========== init / kill ==========
+
+// takes over the recv_init, recv_data and recv_done callbacks for chunk_file_kind
+// dont register your own for that file kind
+// not thread safe, so it does not work with NGC_FT1_options::threaded
+NGC_FT1_swarm* NGC_FT1_swarm_new(NGC_FT1* ngc_ft1_ctx, uint32_t chunk_file_kind);
+void NGC_FT1_swarm_kill(NGC_FT1_swarm* swarm);
+
+// ========== iterate ==========
+// time_delta in seconds
+// sends out new requests and times out old ones
+void NGC_FT1_swarm_iterate(Tox *tox, NGC_FT1_swarm* swarm, float time_delta);
+
+// ========== downloads ==========
+
+// called once per completed chunk, data is only valid during the call
+// only TORRENT_V2_PIECE chunks are verified (by ft1), corrupted ones are requested again automatically
+// other kinds are NOT verified, call NGC_FT1_swarm_set_chunk_have(..., false) to get it again
+typedef void NGC_FT1_swarm_chunk_done_cb(
+	Tox *tox,
+	uint32_t download_id,
+	size_t chunk_index,
+	const uint8_t* data, size_t data_size,
+	void* user_data
+);
+
+// chunk_ids: chunk_count ids of chunk_id_size bytes each, back to back (eg the hash array of an info)
+// every chunk is chunk_size big, except the last, which is what is left of file_size
+bool NGC_FT1_swarm_add_download(
+	NGC_FT1_swarm* swarm,
+	uint32_t group_number,
+	const uint8_t* chunk_ids, size_t chunk_id_size, size_t chunk_count,
+	size_t chunk_size, uint64_t file_size,
+	NGC_FT1_swarm_chunk_done_cb* callback,
+	void* user_data,
+	uint32_t* download_id
+);
+
+void NGC_FT1_swarm_remove_download(NGC_FT1_swarm* swarm, uint32_t download_id);
+
+// mark a chunk as present (eg when resuming) or as missing (eg failed verification)
+void NGC_FT1_swarm_set_chunk_have(NGC_FT1_swarm* swarm, uint32_t download_id, size_t chunk_index, bool have);
+
+// true if all chunks are present
+bool NGC_FT1_swarm_download_done(const NGC_FT1_swarm* swarm, uint32_t download_id);
+
+// ========== peers ==========
+
+// peers we can request chunks from, remove them when they go offline
+void NGC_FT1_swarm_add_peer(NGC_FT1_swarm* swarm, uint32_t group_number, uint32_t peer_number);
+void NGC_FT1_swarm_remove_peer(NGC_FT1_swarm* swarm, uint32_t group_number, uint32_t peer_number);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // C_NGC_FT1_SWARM_H
+
@@ -0,0 +1,69 @@
+#include "./recv_queue.hpp"
+
+void RecvQueue::setCapacity(size_t capacity) {
+	std::lock_guard lock(_mutex);
+	_capacity = capacity;
+}
+
+bool RecvQueue::full(void) {
+	std::lock_guard lock(_mutex);
+	return _bytes >= _capacity;
+}
+
+void RecvQueue::push(Span&& span) {
+	{
+		std::lock_guard lock(_mutex);
+		_bytes += span.data.size();
+		_queue.push_back(std::move(span));
+	}
+	_cv.notify_one();
+}
+
+bool RecvQueue::pop(std::chrono::milliseconds timeout, Span& span_out, const uint8_t*& data_out, size_t& data_size_out) {
+	std::unique_lock lock(_mutex);
+	if (!_cv.wait_for(lock, timeout, [this]() { return !_queue.empty(); })) {
+		return false;
+	}
+
+	Span& span = _queue.front();
+
+	span_out.file_kind = span.file_kind;
+	span_out.group_number = span.group_number;
+	span_out.peer_number = span.peer_number;
+	span_out.transfer_id = span.transfer_id;
+	span_out.data_offset = span.data_offset;
+	span_out.done = span.done;
+	span_out.verified = span.verified;
+
+	// the vector buffer does not move with the vector, so the pointer stays valid
+	span_out.data.clear();
+	data_out = nullptr;
+	data_size_out = span.data.size();
+	if (!span.data.empty()) {
+		data_out = span.data.data();
+		_popped[data_out] = std::move(span.data);
+	}
+
+	_queue.pop_front();
+	return true;
+}
+
+void RecvQueue::release(const uint8_t* data) {
+	if (data == nullptr) {
+		return;
+	}
+
+	std::lock_guard lock(_mutex);
+	auto it = _popped.find(data);
+	if (it == _popped.end()) {
+		return;
+	}
+	_bytes -= it->second.size();
+	_popped.erase(it);
+}
+
+size_t RecvQueue::bytes(void) {
+	std::lock_guard lock(_mutex);
+	return _bytes;
+}
+
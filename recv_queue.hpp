@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// bounded queue of received data, filled by the tox thread and drained by app threads
+// popped data stays owned by the queue (and counts against the capacity) until it is released
+struct RecvQueue {
+	public:
+		struct Span {
+			uint32_t file_kind {0};
+			uint32_t group_number {0};
+			uint32_t peer_number {0};
+			uint16_t transfer_id {0};
+
+			size_t data_offset {0};
+			std::vector<uint8_t> data;
+
+			// last span of a transfer, without data
+			bool done {false};
+			bool verified {false};
+		};
+
+	public:
+		void setCapacity(size_t capacity);
+
+		// the tox thread stops popping the reassembly buffers while full
+		bool full(void);
+
+		// never blocks, might go over the capacity
+		void push(Span&& span);
+
+		// waits up to timeout for a span, span_out gets everything but the data
+		// the data stays valid until release()
+		bool pop(std::chrono::milliseconds timeout, Span& span_out, const uint8_t*& data_out, size_t& data_size_out);
+
+		void release(const uint8_t* data);
+
+		// queued + popped but not released
+		size_t bytes(void);
+
+	private:
+		std::mutex _mutex;
+		std::condition_variable _cv;
+
+		size_t _capacity {0};
+		size_t _bytes {0};
+
+		std::deque<Span> _queue;
+		// data pointer -> popped buffer
+		std::map<const uint8_t*, std::vector<uint8_t>> _popped;
+};
+
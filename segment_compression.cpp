@@ -0,0 +1,101 @@
+#include "./segment_compression.hpp"
+
+#if defined(NGC_FT1_ZSTD) && NGC_FT1_ZSTD == 1
+#include <zstd.h>
+#endif
+
+
+#if defined(NGC_FT1_ZSTD) && NGC_FT1_ZSTD == 1
+
+SegmentCompressor::SegmentCompressor(void) {
+	_cctx = ZSTD_createCCtx();
+	_dctx = ZSTD_createDCtx();
+}
+
+SegmentCompressor::~SegmentCompressor(void) {
+	ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(_cctx));
+	ZSTD_freeDCtx(static_cast<ZSTD_DCtx*>(_dctx));
+}
+
+bool SegmentCompressor::available(void) {
+	return true;
+}
+
+bool SegmentCompressor::compress(const uint8_t* data, size_t data_size, int level, std::vector<uint8_t>& out) {
+	out.clear();
+	if (_cctx == nullptr || data_size == 0) {
+		return false;
+	}
+
+	out.resize(1 + ZSTD_compressBound(data_size));
+	out[0] = ZSTD;
+	const size_t ret = ZSTD_compressCCtx(static_cast<ZSTD_CCtx*>(_cctx), out.data() + 1, out.size() - 1, data, data_size, level);
+	if (ZSTD_isError(ret)) {
+		out.clear();
+		return false;
+	}
+	out.resize(1 + ret);
+
+	return true;
+}
+
+bool SegmentCompressor::decompress(const uint8_t* segment, size_t segment_size, size_t max_size, std::vector<uint8_t>& out) {
+	if (segment_size < 2) {
+		return false;
+	}
+
+	if (segment[0] == RAW) {
+		if (segment_size - 1 > max_size) {
+			return false;
+		}
+		out.insert(out.end(), segment + 1, segment + segment_size);
+		return true;
+	} else if (segment[0] != ZSTD || _dctx == nullptr) {
+		return false;
+	}
+
+	// the frame header has to contain the size, we never allocate more than max_size
+	const unsigned long long content_size = ZSTD_getFrameContentSize(segment + 1, segment_size - 1);
+	if (content_size == ZSTD_CONTENTSIZE_UNKNOWN || content_size == ZSTD_CONTENTSIZE_ERROR || content_size > max_size) {
+		return false;
+	}
+
+	const size_t offset = out.size();
+	out.resize(offset + content_size);
+	const size_t ret = ZSTD_decompressDCtx(static_cast<ZSTD_DCtx*>(_dctx), out.data() + offset, content_size, segment + 1, segment_size - 1);
+	if (ZSTD_isError(ret) || ret != content_size) {
+		out.resize(offset);
+		return false;
+	}
+
+	return true;
+}
+
+#else
+
+SegmentCompressor::SegmentCompressor(void) {
+}
+
+SegmentCompressor::~SegmentCompressor(void) {
+}
+
+bool SegmentCompressor::available(void) {
+	return false;
+}
+
+bool SegmentCompressor::compress(const uint8_t*, size_t, int, std::vector<uint8_t>& out) {
+	out.clear();
+	return false;
+}
+
+bool SegmentCompressor::decompress(const uint8_t* segment, size_t segment_size, size_t max_size, std::vector<uint8_t>& out) {
+	// RAW segments can always be read
+	if (segment_size < 2 || segment[0] != RAW || segment_size - 1 > max_size) {
+		return false;
+	}
+	out.insert(out.end(), segment + 1, segment + segment_size);
+	return true;
+}
+
+#endif
+
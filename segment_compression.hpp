@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// per segment compression for compressed transfers
+// every segment is compressed on its own, so segments can be decompressed in order as they are popped
+// and the recv_data offsets stay offsets into the uncompressed file
+//
+// compressed segment:
+//   - 1 byte marker (RAW or ZSTD)
+//   - payload (the plain data or one zstd frame)
+//
+// only available if built with NGC_FT1_ZSTD=1 (and linked against zstd),
+// otherwise available() is false and the flag is never offered or accepted
+struct SegmentCompressor {
+	public:
+		enum Marker : uint8_t {
+			RAW = 0u,
+			ZSTD = 1u,
+		};
+
+	public:
+		SegmentCompressor(void);
+		~SegmentCompressor(void);
+		SegmentCompressor(const SegmentCompressor&) = delete;
+		SegmentCompressor& operator=(const SegmentCompressor&) = delete;
+
+		static bool available(void);
+
+		// writes a ZSTD segment to out, the caller decides if it is worth it over a RAW one
+		bool compress(const uint8_t* data, size_t data_size, int level, std::vector<uint8_t>& out);
+
+		// appends the content of a segment to out, fails if it is malformed or would grow bigger than max_size
+		bool decompress(const uint8_t* segment, size_t segment_size, size_t max_size, std::vector<uint8_t>& out);
+
+	private:
+		void* _cctx {nullptr};
+		void* _dctx {nullptr};
+};
+
@@ -0,0 +1,69 @@
+#include "./send_read_queue.hpp"
+
+uint64_t SendReadQueue::push(Read&& read) {
+	uint64_t id {0};
+	{
+		std::lock_guard lock(_mutex);
+		id = _next_id++;
+		read.id = id;
+		_queue.push_back(std::move(read));
+	}
+	_cv.notify_one();
+	return id;
+}
+
+bool SendReadQueue::pop(std::chrono::milliseconds timeout, Read& read_out, uint8_t*& data_out, size_t& data_size_out) {
+	std::unique_lock lock(_mutex);
+	if (!_cv.wait_for(lock, timeout, [this]() { return !_queue.empty(); })) {
+		return false;
+	}
+
+	Read& read = _queue.front();
+
+	read_out.id = read.id;
+	read_out.file_kind = read.file_kind;
+	read_out.group_number = read.group_number;
+	read_out.peer_number = read.peer_number;
+	read_out.transfer_id = read.transfer_id;
+	read_out.data_offset = read.data_offset;
+	read_out.data.clear();
+
+	// the vector buffer does not move with the vector, so the pointer stays valid
+	data_out = read.data.data();
+	data_size_out = read.data.size();
+	if (data_out != nullptr) {
+		_popped[data_out] = std::move(read);
+	}
+
+	_queue.pop_front();
+	return true;
+}
+
+void SendReadQueue::complete(const uint8_t* data) {
+	if (data == nullptr) {
+		return;
+	}
+
+	std::lock_guard lock(_mutex);
+	auto it = _popped.find(data);
+	if (it == _popped.end()) {
+		return;
+	}
+	_completed.push_back(std::move(it->second));
+	_popped.erase(it);
+}
+
+void SendReadQueue::takeCompleted(std::vector<Read>& reads_out, const std::function<bool(const Read&)>& fn) {
+	reads_out.clear();
+
+	std::lock_guard lock(_mutex);
+	for (auto it = _completed.begin(); it != _completed.end();) {
+		if (fn(*it)) {
+			reads_out.push_back(std::move(*it));
+			it = _completed.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
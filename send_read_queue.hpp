@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// reads of send data, requested by the tox thread and done by app threads
+// a popped read is filled by the app and handed back with complete(),
+// the tox thread picks the completed reads up on the next iterate
+struct SendReadQueue {
+	public:
+		struct Read {
+			uint64_t id {0}; // set by push()
+
+			uint32_t file_kind {0};
+			uint32_t group_number {0};
+			uint32_t peer_number {0};
+			uint16_t transfer_id {0};
+
+			size_t data_offset {0};
+			std::vector<uint8_t> data; // sized by the requester
+		};
+
+	public:
+		// never blocks, returns the id of the read
+		uint64_t push(Read&& read);
+
+		// waits up to timeout for a read, read_out gets everything but the data
+		// the data has to be filled and handed back with complete()
+		bool pop(std::chrono::milliseconds timeout, Read& read_out, uint8_t*& data_out, size_t& data_size_out);
+
+		void complete(const uint8_t* data);
+
+		// moves the completed reads fn accepts into reads_out
+		void takeCompleted(std::vector<Read>& reads_out, const std::function<bool(const Read&)>& fn);
+
+	private:
+		std::mutex _mutex;
+		std::condition_variable _cv;
+
+		uint64_t _next_id {1};
+
+		std::deque<Read> _queue;
+		// data pointer -> popped read
+		std::map<const uint8_t*, Read> _popped;
+		std::vector<Read> _completed;
+};
+
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+
+// per transfer buffers of the segments in flight
+
+// sequence ids wrap around, so they are compared using serial number arithmetic (rfc1982)
+// seq_id_mask is the largest representable sequence id (0xffff for v1, 0xffffffff for v2)
+inline bool _seq_id_before(uint32_t a, uint32_t b, uint32_t seq_id_mask) {
+	const uint32_t dist = (b - a) & seq_id_mask;
+	return dist != 0 && dist <= seq_id_mask/2;
+}
+
+struct SendSequenceBuffer {
+	struct SSBEntry {
+		std::vector<uint8_t> data; // the data (variable size, but smaller than 500), empty if only the range is kept
+		float time_since_activity {0.f};
+
+		// size of the data, offset into the file only if just the range is kept
+		size_t offset {0};
+		size_t size {0};
+	};
+
+	// sequence_id -> entry
+	std::map<uint32_t, SSBEntry> entries;
+
+	uint32_t next_seq_id {0};
+	uint32_t seq_id_mask {0xffff};
+
+	// sum of the data sizes in entries (kept or not)
+	size_t bytes {0};
+
+	void erase(uint32_t seq) {
+		auto it = entries.find(seq);
+		if (it != entries.end()) {
+			bytes -= it->second.size;
+			entries.erase(it);
+		}
+	}
+
+	// inflight chunks
+	size_t size(void) const {
+		return entries.size();
+	}
+
+	// the entry that was added first, the map order breaks where the ids wrap around
+	// only valid if not empty
+	uint32_t oldest(void) const {
+		assert(!entries.empty());
+		// ids at or above next_seq_id are from before the wrap
+		auto it = entries.lower_bound(next_seq_id);
+		if (it == entries.end()) {
+			it = entries.begin();
+		}
+		return it->first;
+	}
+
+	// a span of more than half the sequence space in flight would make acks ambiguous
+	// (a single old entry that is never acked also counts, not just the number of entries)
+	bool canAdd(void) const {
+		return entries.empty() || ((next_seq_id - oldest()) & seq_id_mask) < seq_id_mask/2;
+	}
+
+	uint32_t add(std::vector<uint8_t>&& data) {
+		assert(canAdd());
+		const size_t size = data.size();
+		bytes += size;
+		entries[next_seq_id] = {std::move(data), 0.f, 0, size};
+		const uint32_t seq_id = next_seq_id;
+		next_seq_id = (next_seq_id + 1) & seq_id_mask;
+		return seq_id;
+	}
+
+	// only the range is kept, the data has to be read again for resends
+	uint32_t addRange(size_t offset, size_t size) {
+		assert(canAdd());
+		bytes += size;
+		entries[next_seq_id] = {{}, 0.f, offset, size};
+		const uint32_t seq_id = next_seq_id;
+		next_seq_id = (next_seq_id + 1) & seq_id_mask;
+		return seq_id;
+	}
+
+	template<typename FN>
+	void for_each(float time_delta, FN&& fn) {
+		for (auto& [id, entry] : entries) {
+			entry.time_since_activity += time_delta;
+			fn(id, entry);
+		}
+	}
+};
+
+struct RecvSequenceBuffer {
+	struct RSBEntry {
+		std::vector<uint8_t> data;
+	};
+
+	// sequence_id -> entry
+	std::map<uint32_t, RSBEntry> entries;
+
+	uint32_t next_seq_id {0};
+	uint32_t seq_id_mask {0xffff};
+
+	// list of seq_ids to ack, this is seperate bc rsbentries are deleted once processed
+	std::deque<uint32_t> ack_seq_ids;
+
+	// bound for the out of order data in entries
+	size_t max_bytes {SIZE_MAX};
+	size_t bytes {0};
+
+	void erase(uint32_t seq) {
+		auto it = entries.find(seq);
+		if (it != entries.end()) {
+			bytes -= it->second.data.size();
+			entries.erase(it);
+		}
+	}
+
+	// inflight chunks
+	size_t size(void) const {
+		return entries.size();
+	}
+
+	// what the sender can still send without us dropping it
+	size_t window(void) const {
+		return bytes < max_bytes ? max_bytes - bytes : 0;
+	}
+
+	// returns false if it did not fit, it is not acked and has to be resent
+	bool add(uint32_t seq_id, std::vector<uint8_t>&& data) {
+		// allready popped, this is a resend
+		// without this check an old dup would be delivered as new data once the seq_ids wrap around
+		const bool is_new = !_seq_id_before(seq_id, next_seq_id, seq_id_mask) && !entries.count(seq_id);
+
+		// the next in order segment is always taken, it is popped right away
+		if (is_new && seq_id != next_seq_id && bytes + data.size() > max_bytes) {
+			return false;
+		}
+
+		// always ack, the sender might have missed our previous ack
+		ack_seq_ids.push_back(seq_id);
+		if (ack_seq_ids.size() > 3) { // TODO: magic
+			ack_seq_ids.pop_front();
+		}
+
+		if (is_new) {
+			bytes += data.size();
+			entries[seq_id] = {data};
+		}
+
+		return true;
+	}
+
+	bool canPop(void) const {
+		return entries.count(next_seq_id);
+	}
+
+	std::vector<uint8_t> pop(void) {
+		assert(canPop());
+		auto tmp_data = entries.at(next_seq_id).data;
+		erase(next_seq_id);
+		next_seq_id = (next_seq_id + 1) & seq_id_mask;
+		return tmp_data;
+	}
+};
+
@@ -0,0 +1,124 @@
+#include "./sha1.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static uint32_t _rotl(uint32_t x, int n) {
+	return (x << n) | (x >> (32 - n));
+}
+
+SHA1::SHA1(void) {
+	reset();
+}
+
+void SHA1::reset(void) {
+	_h = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+	_block_size = 0;
+	_total_size = 0;
+}
+
+void SHA1::update(const uint8_t* data, size_t data_size) {
+	_total_size += data_size;
+
+	// fill partial block first
+	if (_block_size > 0) {
+		const size_t fill = std::min(data_size, _block.size() - _block_size);
+		std::memcpy(_block.data() + _block_size, data, fill);
+		_block_size += fill;
+		data += fill;
+		data_size -= fill;
+
+		if (_block_size < _block.size()) {
+			return;
+		}
+		processBlock(_block.data());
+		_block_size = 0;
+	}
+
+	// full blocks directly from the input
+	while (data_size >= _block.size()) {
+		processBlock(data);
+		data += _block.size();
+		data_size -= _block.size();
+	}
+
+	std::memcpy(_block.data(), data, data_size);
+	_block_size = data_size;
+}
+
+SHA1::Digest SHA1::finish(void) {
+	const uint64_t total_bits = _total_size * 8;
+
+	// padding: 0x80, zeros, 8 byte big endian bit count
+	const uint8_t pad_start {0x80};
+	update(&pad_start, 1);
+	const uint8_t zero {0x00};
+	while (_block_size != 56) {
+		update(&zero, 1);
+	}
+
+	uint8_t length_bytes[8];
+	for (size_t i = 0; i < 8; i++) {
+		length_bytes[i] = (total_bits >> ((7-i)*8)) & 0xff;
+	}
+	update(length_bytes, 8);
+
+	Digest digest;
+	for (size_t i = 0; i < _h.size(); i++) {
+		digest[i*4+0] = (_h[i] >> 24) & 0xff;
+		digest[i*4+1] = (_h[i] >> 16) & 0xff;
+		digest[i*4+2] = (_h[i] >> 8) & 0xff;
+		digest[i*4+3] = _h[i] & 0xff;
+	}
+
+	reset();
+
+	return digest;
+}
+
+void SHA1::processBlock(const uint8_t* block) {
+	uint32_t w[80];
+	for (size_t i = 0; i < 16; i++) {
+		w[i] = uint32_t(block[i*4]) << 24 | uint32_t(block[i*4+1]) << 16 | uint32_t(block[i*4+2]) << 8 | uint32_t(block[i*4+3]);
+	}
+	for (size_t i = 16; i < 80; i++) {
+		w[i] = _rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+	}
+
+	uint32_t a = _h[0];
+	uint32_t b = _h[1];
+	uint32_t c = _h[2];
+	uint32_t d = _h[3];
+	uint32_t e = _h[4];
+
+	for (size_t i = 0; i < 80; i++) {
+		uint32_t f, k;
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+
+		const uint32_t tmp = _rotl(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = _rotl(b, 30);
+		b = a;
+		a = tmp;
+	}
+
+	_h[0] += a;
+	_h[1] += b;
+	_h[2] += c;
+	_h[3] += d;
+	_h[4] += e;
+}
+
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// SHA-1: https://www.rfc-editor.org/rfc/rfc3174
+// only used for content addressing (HASH_SHA1_*), not for security
+
+struct SHA1 {
+	public:
+		static constexpr size_t DIGEST_SIZE {20};
+		using Digest = std::array<uint8_t, DIGEST_SIZE>;
+
+	public:
+		SHA1(void);
+
+		void update(const uint8_t* data, size_t data_size);
+
+		// object is reset afterwards
+		Digest finish(void);
+
+		static Digest hash(const uint8_t* data, size_t data_size) {
+			SHA1 sha1;
+			sha1.update(data, data_size);
+			return sha1.finish();
+		}
+
+	private:
+		void reset(void);
+		void processBlock(const uint8_t* block);
+
+	private: // state
+		std::array<uint32_t, 5> _h;
+		std::array<uint8_t, 64> _block;
+		size_t _block_size {0};
+		uint64_t _total_size {0};
+};
+
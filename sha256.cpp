@@ -0,0 +1,228 @@
+#include "./sha256.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static constexpr uint32_t _K[64] {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static constexpr uint32_t _H0[8] {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static inline uint32_t _rotr(uint32_t x, int n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t _load_be32(const uint8_t* p) {
+	return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | uint32_t(p[3]);
+}
+
+static inline void _store_be32(uint8_t* p, uint32_t v) {
+	p[0] = (v >> 24) & 0xff;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+}
+
+// process one block for N lanes at once
+// every array is indexed [word][lane], so the inner loops are over lanes
+template<size_t N>
+static void _process_blocks(uint32_t (&h)[8][N], const uint8_t* const (&blocks)[N]) {
+	uint32_t w[64][N];
+	for (size_t i = 0; i < 16; i++) {
+		for (size_t l = 0; l < N; l++) {
+			w[i][l] = _load_be32(blocks[l] + i*4);
+		}
+	}
+	for (size_t i = 16; i < 64; i++) {
+		for (size_t l = 0; l < N; l++) {
+			const uint32_t s0 = _rotr(w[i-15][l], 7) ^ _rotr(w[i-15][l], 18) ^ (w[i-15][l] >> 3);
+			const uint32_t s1 = _rotr(w[i-2][l], 17) ^ _rotr(w[i-2][l], 19) ^ (w[i-2][l] >> 10);
+			w[i][l] = w[i-16][l] + s0 + w[i-7][l] + s1;
+		}
+	}
+
+	uint32_t v[8][N];
+	for (size_t i = 0; i < 8; i++) {
+		for (size_t l = 0; l < N; l++) {
+			v[i][l] = h[i][l];
+		}
+	}
+
+	for (size_t i = 0; i < 64; i++) {
+		for (size_t l = 0; l < N; l++) {
+			const uint32_t a = v[0][l], b = v[1][l], c = v[2][l], d = v[3][l];
+			const uint32_t e = v[4][l], f = v[5][l], g = v[6][l], hh = v[7][l];
+
+			const uint32_t S1 = _rotr(e, 6) ^ _rotr(e, 11) ^ _rotr(e, 25);
+			const uint32_t ch = (e & f) ^ (~e & g);
+			const uint32_t tmp1 = hh + S1 + ch + _K[i] + w[i][l];
+			const uint32_t S0 = _rotr(a, 2) ^ _rotr(a, 13) ^ _rotr(a, 22);
+			const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+			const uint32_t tmp2 = S0 + maj;
+
+			v[7][l] = g;
+			v[6][l] = f;
+			v[5][l] = e;
+			v[4][l] = d + tmp1;
+			v[3][l] = c;
+			v[2][l] = b;
+			v[1][l] = a;
+			v[0][l] = tmp1 + tmp2;
+		}
+	}
+
+	for (size_t i = 0; i < 8; i++) {
+		for (size_t l = 0; l < N; l++) {
+			h[i][l] += v[i][l];
+		}
+	}
+}
+
+// the final one or two blocks: rest of message, 0x80, zeros, 8 byte big endian bit count
+static size_t _make_tail(uint8_t (&tail)[128], const uint8_t* rest, size_t rest_size, uint64_t total_size) {
+	std::memset(tail, 0, sizeof(tail));
+	std::memcpy(tail, rest, rest_size);
+	tail[rest_size] = 0x80;
+
+	const size_t tail_size = rest_size + 1 + 8 <= 64 ? 64 : 128;
+	const uint64_t total_bits = total_size * 8;
+	for (size_t i = 0; i < 8; i++) {
+		tail[tail_size - 1 - i] = (total_bits >> (i*8)) & 0xff;
+	}
+
+	return tail_size;
+}
+
+SHA256::SHA256(void) {
+	reset();
+}
+
+void SHA256::reset(void) {
+	std::copy(std::begin(_H0), std::end(_H0), _h.begin());
+	_block_size = 0;
+	_total_size = 0;
+}
+
+void SHA256::update(const uint8_t* data, size_t data_size) {
+	_total_size += data_size;
+
+	uint32_t h[8][1];
+	for (size_t i = 0; i < 8; i++) {
+		h[i][0] = _h[i];
+	}
+
+	// fill partial block first
+	if (_block_size > 0) {
+		const size_t fill = std::min(data_size, _block.size() - _block_size);
+		std::memcpy(_block.data() + _block_size, data, fill);
+		_block_size += fill;
+		data += fill;
+		data_size -= fill;
+
+		if (_block_size == _block.size()) {
+			const uint8_t* const blocks[1] {_block.data()};
+			_process_blocks<1>(h, blocks);
+			_block_size = 0;
+		}
+	}
+
+	// full blocks directly from the input
+	while (data_size >= _block.size()) {
+		const uint8_t* const blocks[1] {data};
+		_process_blocks<1>(h, blocks);
+		data += _block.size();
+		data_size -= _block.size();
+	}
+
+	for (size_t i = 0; i < 8; i++) {
+		_h[i] = h[i][0];
+	}
+
+	if (data_size > 0) {
+		std::memcpy(_block.data(), data, data_size);
+		_block_size = data_size;
+	}
+}
+
+SHA256::Digest SHA256::finish(void) {
+	uint8_t tail[128];
+	const size_t tail_size = _make_tail(tail, _block.data(), _block_size, _total_size);
+
+	uint32_t h[8][1];
+	for (size_t i = 0; i < 8; i++) {
+		h[i][0] = _h[i];
+	}
+	for (size_t offset = 0; offset < tail_size; offset += 64) {
+		const uint8_t* const blocks[1] {tail + offset};
+		_process_blocks<1>(h, blocks);
+	}
+
+	Digest digest;
+	for (size_t i = 0; i < 8; i++) {
+		_store_be32(digest.data() + i*4, h[i][0]);
+	}
+
+	reset();
+
+	return digest;
+}
+
+void SHA256::hashMany(const uint8_t* data, size_t message_size, size_t count, uint8_t* out) {
+	const size_t full_blocks = message_size / 64;
+	const size_t rest_size = message_size % 64;
+
+	size_t m = 0;
+	for (; m + LANES <= count; m += LANES) {
+		uint32_t h[8][LANES];
+		for (size_t i = 0; i < 8; i++) {
+			for (size_t l = 0; l < LANES; l++) {
+				h[i][l] = _H0[i];
+			}
+		}
+
+		for (size_t b = 0; b < full_blocks; b++) {
+			const uint8_t* blocks[LANES];
+			for (size_t l = 0; l < LANES; l++) {
+				blocks[l] = data + (m+l)*message_size + b*64;
+			}
+			_process_blocks<LANES>(h, reinterpret_cast<const uint8_t* const (&)[LANES]>(blocks));
+		}
+
+		// all messages have the same size, so the tails line up
+		uint8_t tails[LANES][128];
+		size_t tail_size {0};
+		for (size_t l = 0; l < LANES; l++) {
+			tail_size = _make_tail(tails[l], data + (m+l)*message_size + full_blocks*64, rest_size, message_size);
+		}
+		for (size_t offset = 0; offset < tail_size; offset += 64) {
+			const uint8_t* blocks[LANES];
+			for (size_t l = 0; l < LANES; l++) {
+				blocks[l] = tails[l] + offset;
+			}
+			_process_blocks<LANES>(h, reinterpret_cast<const uint8_t* const (&)[LANES]>(blocks));
+		}
+
+		for (size_t l = 0; l < LANES; l++) {
+			for (size_t i = 0; i < 8; i++) {
+				_store_be32(out + (m+l)*DIGEST_SIZE + i*4, h[i][l]);
+			}
+		}
+	}
+
+	// rest one by one
+	for (; m < count; m++) {
+		const auto digest = hash(data + m*message_size, message_size);
+		std::copy(digest.cbegin(), digest.cend(), out + m*DIGEST_SIZE);
+	}
+}
+
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// SHA-256: https://www.rfc-editor.org/rfc/rfc6234
+
+struct SHA256 {
+	public:
+		static constexpr size_t DIGEST_SIZE {32};
+		using Digest = std::array<uint8_t, DIGEST_SIZE>;
+
+		// number of messages hashed side by side in hashMany()
+		static constexpr size_t LANES {8};
+
+	public:
+		SHA256(void);
+
+		void update(const uint8_t* data, size_t data_size);
+
+		// object is reset afterwards
+		Digest finish(void);
+
+		static Digest hash(const uint8_t* data, size_t data_size) {
+			SHA256 sha256;
+			sha256.update(data, data_size);
+			return sha256.finish();
+		}
+
+		// hash count messages of the same size, stored back to back in data
+		// digests are written back to back into out
+		// the messages are processed LANES at a time in lockstep, which the compiler can vectorize
+		static void hashMany(const uint8_t* data, size_t message_size, size_t count, uint8_t* out);
+
+	private:
+		void reset(void);
+
+	private: // state
+		std::array<uint32_t, 8> _h;
+		std::array<uint8_t, 64> _block;
+		size_t _block_size {0};
+		uint64_t _total_size {0};
+};
+
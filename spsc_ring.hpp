@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// lock free single producer single consumer ring buffer
+// push() and pop() can be called from one thread each, capacity is rounded up to a power of 2
+template<typename T>
+struct SPSCRing {
+	public:
+		explicit SPSCRing(size_t capacity) {
+			size_t size {1};
+			while (size < capacity) {
+				size <<= 1;
+			}
+			_slots.resize(size);
+			_mask = size - 1;
+		}
+
+		SPSCRing(const SPSCRing&) = delete;
+		SPSCRing& operator=(const SPSCRing&) = delete;
+
+		// producer, fails if full
+		bool push(T&& value) {
+			const size_t head = _head.load(std::memory_order_relaxed);
+			if (head - _tail.load(std::memory_order_acquire) > _mask) {
+				return false;
+			}
+			_slots[head & _mask] = std::move(value);
+			_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		// consumer, fails if empty
+		bool pop(T& value_out) {
+			const size_t tail = _tail.load(std::memory_order_relaxed);
+			if (tail == _head.load(std::memory_order_acquire)) {
+				return false;
+			}
+			value_out = std::move(_slots[tail & _mask]);
+			_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// either side
+		bool empty(void) const {
+			return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_acquire);
+		}
+
+	private:
+		std::vector<T> _slots;
+		size_t _mask {0};
+
+		// on their own cache lines, written by different threads
+		alignas(64) std::atomic<size_t> _head {0}; // next slot to write
+		alignas(64) std::atomic<size_t> _tail {0}; // next slot to read
+};
+